@@ -0,0 +1,795 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <tag-tracker.h>
+#include <calibration_file.h>
+#include <candidate_detector.h>
+#include <frame_recording.h>
+#include <marker_identifier.h>
+#include <marker_tracker.h>
+#include <mjpeg_stream_source.h>
+
+#define DEFAULT_BENCH_WIDTH 1920
+#define DEFAULT_BENCH_HEIGHT 1080
+#define DEFAULT_BENCH_MARKERS 4
+#define DEFAULT_BENCH_FRAMES 100
+#define DEFAULT_BENCH_ITERATIONS 1
+#define DEFAULT_BENCH_THREADS 1
+#define DEFAULT_BENCH_TOLERANCE 0.1
+// Quality used to encode synthetic frames and frames of video files, so every frame is decoded from memory during the benchmark.
+#define BENCH_JPEG_QUALITY 95
+// Exit code when the run is slower than the baseline by more than the tolerance.
+#define BENCH_REGRESSION_EXIT_CODE 2
+// Mean distance in pixels between the corners of two detections of the same marker, for --compare-candidates to count them as equal.
+#define BENCH_CORNER_MATCH_DISTANCE 2.0
+
+namespace po = boost::program_options;
+
+enum BenchStage {
+  STAGE_DECODE,
+  STAGE_DETECT,
+  STAGE_POSE,
+  STAGE_DRAW,
+  STAGE_TOTAL,
+  STAGE_COUNT
+};
+
+static const char* stageNames[STAGE_COUNT] = {"decode", "detect", "pose", "draw", "total"};
+
+struct StageSummary {
+  double p50 = 0;
+  double p95 = 0;
+  double p99 = 0;
+  double mean = 0;
+};
+
+struct BenchResult {
+  double fps = 0;
+  uint64_t frames = 0;
+  double markersPerFrame = 0;
+  StageSummary stages[STAGE_COUNT];
+};
+
+// Latencies of one thread, in milliseconds. Every thread has its own, so nothing is shared while the benchmark runs.
+struct ThreadSamples {
+  std::vector<double> latencies[STAGE_COUNT];
+  uint64_t markers = 0;
+};
+
+double millisecondsBetween(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+// Nearest rank percentile of sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+
+  size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+StageSummary summarize(std::vector<double>& values) {
+  StageSummary summary;
+
+  if (values.empty()) {
+    return summary;
+  }
+
+  std::sort(values.begin(), values.end());
+  summary.p50 = percentile(values, 50);
+  summary.p95 = percentile(values, 95);
+  summary.p99 = percentile(values, 99);
+
+  double sum = 0;
+  for (double v : values) {
+    sum += v;
+  }
+  summary.mean = sum / values.size();
+
+  return summary;
+}
+
+// Render a grid of markers onto a white canvas. The grid is shifted a little from frame to frame,
+// so consecutive frames are not identical. Return no frames if the markers do not fit into the resolution.
+std::vector<std::vector<uchar> > generateFrames(cv::aruco::PredefinedDictionaryType dict, int markerCount, cv::Size resolution, int frameCount) {
+  cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dict);
+  markerCount = std::min(markerCount, dictionary.bytesList.rows);
+
+  int cols = std::max(1, (int)std::ceil(std::sqrt((double)markerCount)));
+  int rows = std::max(1, (markerCount + cols - 1) / cols);
+  int cellSize = std::min(resolution.width / cols, resolution.height / rows);
+  // Leave a white border around every marker, so they do not touch.
+  int markerPixels = cellSize * 6 / 10;
+  // Markers are only shifted within the white border of their cell.
+  int maxShift = (cellSize - markerPixels) / 4;
+
+  // Every bit of the marker and its black border needs at least one pixel.
+  if (markerPixels < dictionary.markerSize + 2) {
+    std::cerr << "Error: " << markerCount << " markers do not fit into " << resolution.width << "x" << resolution.height << "." << std::endl;
+    return {};
+  }
+
+  std::vector<cv::Mat> markers(markerCount);
+  for (int id = 0; id < markerCount; id++) {
+    cv::Mat marker;
+    cv::aruco::generateImageMarker(dictionary, id, markerPixels, marker, 1);
+    cv::cvtColor(marker, markers[id], cv::COLOR_GRAY2BGR);
+  }
+
+  std::vector<std::vector<uchar> > frames(frameCount);
+  std::vector<int> encodeParams = {cv::IMWRITE_JPEG_QUALITY, BENCH_JPEG_QUALITY};
+
+  for (int f = 0; f < frameCount; f++) {
+    cv::Mat canvas(resolution, CV_8UC3, cv::Scalar(255, 255, 255));
+    int shift = maxShift > 0 ? f % (2 * maxShift) - maxShift : 0;
+
+    for (int id = 0; id < markerCount; id++) {
+      int x = (id % cols) * cellSize + (cellSize - markerPixels) / 2 + shift;
+      int y = (id / cols) * cellSize + (cellSize - markerPixels) / 2 + shift;
+      markers[id].copyTo(canvas(cv::Rect(x, y, markerPixels, markerPixels)));
+    }
+
+    cv::imencode(".jpg", canvas, frames[f], encodeParams);
+  }
+
+  return frames;
+}
+
+// Read the encoded frames of an image sequence (glob pattern), or encode the frames of a video file or recording.
+// Frames of recordings are encoded losslessly, so the benchmark sees exactly the recorded pixels.
+std::vector<std::vector<uchar> > loadFrames(const std::string& source, int maxFrames, cv::Size& resolution) {
+  std::vector<std::vector<uchar> > frames;
+
+  if (isRecording(source)) {
+    ReplaySource replay(source, false);
+    cv::Mat frame;
+    std::chrono::steady_clock::time_point captureTime;
+
+    while ((int)frames.size() < maxFrames && replay.read(frame, captureTime)) {
+      resolution = frame.size();
+      frames.emplace_back();
+      cv::imencode(".png", frame, frames.back());
+    }
+
+    return frames;
+  }
+
+  if (source.find('*') != std::string::npos) {
+    std::vector<cv::String> paths;
+    cv::glob(source, paths);
+
+    for (const cv::String& path : paths) {
+      if ((int)frames.size() >= maxFrames) {
+        break;
+      }
+
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      if (!file) {
+        std::cerr << "Warning: Could not read " << path << ", skipping it." << std::endl;
+        continue;
+      }
+
+      std::vector<uchar> data(file.tellg());
+      file.seekg(0);
+      file.read(reinterpret_cast<char*>(data.data()), data.size());
+
+      // Anything that does not decode would only fail later on a detection thread, so it is checked once here.
+      cv::Mat decoded;
+      if (file && !data.empty()) {
+        decoded = cv::imdecode(data, cv::IMREAD_COLOR);
+      }
+
+      if (decoded.empty()) {
+        std::cerr << "Warning: Could not read " << path << ", skipping it." << std::endl;
+        continue;
+      }
+
+      if (resolution.area() == 0) {
+        resolution = decoded.size();
+      }
+
+      frames.push_back(std::move(data));
+    }
+
+    return frames;
+  }
+
+  cv::VideoCapture cap(source);
+  std::vector<int> encodeParams = {cv::IMWRITE_JPEG_QUALITY, BENCH_JPEG_QUALITY};
+  cv::Mat frame;
+
+  while ((int)frames.size() < maxFrames && cap.read(frame)) {
+    resolution = frame.size();
+    frames.emplace_back();
+    cv::imencode(".jpg", frame, frames.back(), encodeParams);
+  }
+
+  return frames;
+}
+
+// Every thread processes frames with its own tracker until all frames of all iterations were taken.
+// decodeScale 0 decodes every frame to full resolution BGR, like cv::VideoCapture. Otherwise frames are decoded to grayscale
+// at 1/decodeScale resolution for detection, and again in color for drawing, like MjpegStreamSource and tag-tracker do.
+BenchResult runBenchmark(const std::vector<std::vector<uchar> >& frames, const MarkerTrackerConfig& config, int threadCount, int iterations, int decodeScale) {
+  std::vector<ThreadSamples> samples(threadCount);
+  std::atomic<uint64_t> nextFrame = 0;
+  uint64_t totalFrames = (uint64_t)frames.size() * iterations;
+
+  auto worker = [&](ThreadSamples& threadSamples) {
+    MarkerTracker tracker(config);
+    TrackedFrame frame;
+    cv::Mat canvas;
+
+    for (uint64_t i = nextFrame++; i < totalFrames; i = nextFrame++) {
+      auto start = std::chrono::steady_clock::now();
+
+      frame.sequence = i;
+      frame.captureTime = start;
+      cv::Mat encoded(1, frames[i % frames.size()].size(), CV_8U, const_cast<uchar*>(frames[i % frames.size()].data()));
+      if (decodeScale > 0) {
+        decodeJpeg(encoded, decodeScale, true, frame.image);
+      } else {
+        frame.image = cv::imdecode(encoded, cv::IMREAD_COLOR);
+      }
+      auto decoded = std::chrono::steady_clock::now();
+
+      tracker.detect(frame);
+      auto detected = std::chrono::steady_clock::now();
+
+      tracker.estimatePose(frame);
+      auto estimated = std::chrono::steady_clock::now();
+
+      if (decodeScale > 0) {
+        decodeJpeg(encoded, decodeScale, false, canvas);
+      } else {
+        frame.image.copyTo(canvas);
+      }
+      tracker.drawOverlay(canvas, frame);
+      auto drawn = std::chrono::steady_clock::now();
+
+      threadSamples.latencies[STAGE_DECODE].push_back(millisecondsBetween(start, decoded));
+      threadSamples.latencies[STAGE_DETECT].push_back(millisecondsBetween(decoded, detected));
+      threadSamples.latencies[STAGE_POSE].push_back(millisecondsBetween(detected, estimated));
+      threadSamples.latencies[STAGE_DRAW].push_back(millisecondsBetween(estimated, drawn));
+      threadSamples.latencies[STAGE_TOTAL].push_back(millisecondsBetween(start, drawn));
+      threadSamples.markers += frame.markerIds.size();
+    }
+  };
+
+  for (ThreadSamples& threadSamples : samples) {
+    for (std::vector<double>& latencies : threadSamples.latencies) {
+      latencies.reserve(totalFrames / threadCount + 1);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threadCount; t++) {
+    threads.emplace_back(worker, std::ref(samples[t]));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  double seconds = millisecondsBetween(start, std::chrono::steady_clock::now()) / 1000.0;
+
+  BenchResult result;
+  result.frames = totalFrames;
+  result.fps = seconds > 0 ? totalFrames / seconds : 0;
+
+  uint64_t markers = 0;
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    std::vector<double> all;
+    for (ThreadSamples& threadSamples : samples) {
+      all.insert(all.end(), threadSamples.latencies[s].begin(), threadSamples.latencies[s].end());
+    }
+    result.stages[s] = summarize(all);
+  }
+  for (ThreadSamples& threadSamples : samples) {
+    markers += threadSamples.markers;
+  }
+  result.markersPerFrame = totalFrames > 0 ? (double)markers / totalFrames : 0;
+
+  return result;
+}
+
+// Run the stock detector on every frame and identify all of its markers and rejected candidates again with MarkerIdentifier.
+// The codes sampled from the candidates are also looked up with both MarkerIdentifier::lookup and cv::aruco::Dictionary::identify,
+// which compares the dictionary search alone. Return false if MarkerIdentifier disagreed with the stock detector anywhere.
+bool verifyIdentification(const std::vector<std::vector<uchar> >& frames, const MarkerTrackerConfig& config, int decodeScale, int verbosity) {
+  cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(config.dict);
+  cv::aruco::ArucoDetector detector(dictionary, config.detectorParams);
+  MarkerIdentifier identifier(dictionary, config.detectorParams);
+
+  if (!identifier.isSupported()) {
+    std::cout << "Markers of " << dictName(config.dict) << " have too many bits for the fast identification." << std::endl;
+    return false;
+  }
+
+  cv::Mat gray, bits;
+  std::vector<int> ids;
+  std::vector<std::vector<cv::Point2f> > corners, rejected;
+  std::vector<cv::Point2f> candidate;
+  uint64_t markerCount = 0, markerMismatches = 0, rejectedCount = 0, rejectedDecoded = 0, codeCount = 0, lookupMismatches = 0;
+  double identifyMs = 0, lookupMs = 0, stockLookupMs = 0;
+
+  for (size_t f = 0; f < frames.size(); f++) {
+    cv::Mat encoded(1, frames[f].size(), CV_8U, const_cast<uchar*>(frames[f].data()));
+    if (decodeScale > 0) {
+      decodeJpeg(encoded, decodeScale, true, gray);
+    } else {
+      gray = cv::imdecode(encoded, cv::IMREAD_GRAYSCALE);
+    }
+
+    detector.detectMarkers(gray, corners, ids, rejected);
+
+    for (size_t i = 0; i < corners.size() + rejected.size(); i++) {
+      bool isMarker = i < corners.size();
+      const std::vector<cv::Point2f>& stockCorners = isMarker ? corners[i] : rejected[i - corners.size()];
+      candidate = stockCorners;
+      int id = -1;
+
+      auto start = std::chrono::steady_clock::now();
+      bool found = identifier.identify(gray, candidate, id);
+      identifyMs += millisecondsBetween(start, std::chrono::steady_clock::now());
+
+      if (isMarker) {
+        markerCount++;
+        // The corners of a detected marker are already rotated, so identifying them again must not rotate them any further.
+        if (!found || id != ids[i] || candidate != stockCorners) {
+          markerMismatches++;
+          if (verbosity > 0) {
+            std::cout << std::format("Frame {}: marker {} was identified as {}.\n", f, ids[i], found ? std::to_string(id) : "nothing");
+          }
+        }
+      } else {
+        rejectedCount++;
+        if (found) {
+          rejectedDecoded++;
+          if (verbosity > 0) {
+            std::cout << std::format("Frame {}: rejected candidate {} was identified as {}.\n", f, i - corners.size(), id);
+          }
+        }
+      }
+
+      uint64_t code;
+      if (!identifier.extractCode(gray, stockCorners, code)) {
+        continue;
+      }
+
+      identifier.unpackCode(code, bits);
+      int fastId = -1, fastRotation = -1, stockId = -1, stockRotation = -1;
+
+      start = std::chrono::steady_clock::now();
+      bool fastFound = identifier.lookup(code, fastId, fastRotation);
+      auto looked = std::chrono::steady_clock::now();
+      bool stockFound = dictionary.identify(bits, stockId, stockRotation, config.detectorParams.errorCorrectionRate);
+      stockLookupMs += millisecondsBetween(looked, std::chrono::steady_clock::now());
+      lookupMs += millisecondsBetween(start, looked);
+      codeCount++;
+
+      if (fastFound != stockFound || (fastFound && (fastId != stockId || fastRotation != stockRotation))) {
+        lookupMismatches++;
+      }
+    }
+  }
+
+  uint64_t candidateCount = markerCount + rejectedCount;
+  std::cout << std::format("{} markers, {} identified differently\n", markerCount, markerMismatches);
+  std::cout << std::format("{} rejected candidates, {} identified as a marker\n", rejectedCount, rejectedDecoded);
+  std::cout << std::format("{} codes, {} looked up differently than by cv::aruco::Dictionary::identify\n", codeCount, lookupMismatches);
+  std::cout << std::format("identify: {:.2f} us per candidate\n", candidateCount > 0 ? identifyMs * 1000 / candidateCount : 0.0);
+  std::cout << std::format("lookup: {:.3f} us per code, cv::aruco::Dictionary::identify: {:.3f} us per code\n",
+                           codeCount > 0 ? lookupMs * 1000 / codeCount : 0.0, codeCount > 0 ? stockLookupMs * 1000 / codeCount : 0.0);
+
+  if (rejectedDecoded > 0) {
+    // The stock detector only tries one of several nearly identical contours of a marker, and rejects the others untried.
+    std::cout << "Note: Rejected candidates that are identified are usually a second contour of a detected marker." << std::endl;
+  }
+
+  return markerMismatches == 0 && lookupMismatches == 0;
+}
+
+// Run the stock detector and CandidateDetector on every frame and compare the markers they find. A marker counts as found by both,
+// if the other detector found the same ID with corners that are on average within BENCH_CORNER_MATCH_DISTANCE pixels.
+// Return false if any marker was only found by one of them.
+bool compareCandidates(const std::vector<std::vector<uchar> >& frames, const MarkerTrackerConfig& config, int decodeScale, int verbosity) {
+  cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(config.dict);
+  cv::aruco::ArucoDetector detector(dictionary, config.detectorParams);
+  CandidateDetector candidateDetector(dictionary, config.detectorParams);
+
+  cv::Mat gray;
+  std::vector<int> stockIds, fastIds;
+  std::vector<std::vector<cv::Point2f> > stockCorners, stockRejected, fastCorners, fastRejected;
+  uint64_t stockMarkers = 0, fastMarkers = 0, stockCandidates = 0, fastCandidates = 0, matched = 0, missed = 0, extra = 0;
+  double stockMs = 0, fastMs = 0, cornerDistance = 0;
+
+  // Mean distance between the corners of two detections, or infinity for different markers.
+  auto distance = [](int idA, const std::vector<cv::Point2f>& a, int idB, const std::vector<cv::Point2f>& b) {
+    if (idA != idB) {
+      return (double)INFINITY;
+    }
+
+    double sum = 0;
+    for (int c = 0; c < 4; c++) {
+      sum += cv::norm(a[c] - b[c]);
+    }
+    return sum / 4;
+  };
+
+  for (size_t f = 0; f < frames.size(); f++) {
+    cv::Mat encoded(1, frames[f].size(), CV_8U, const_cast<uchar*>(frames[f].data()));
+    if (decodeScale > 0) {
+      decodeJpeg(encoded, decodeScale, true, gray);
+    } else {
+      gray = cv::imdecode(encoded, cv::IMREAD_GRAYSCALE);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    detector.detectMarkers(gray, stockCorners, stockIds, stockRejected);
+    auto stockDone = std::chrono::steady_clock::now();
+    candidateDetector.detectMarkers(gray, fastCorners, fastIds, fastRejected);
+    auto fastDone = std::chrono::steady_clock::now();
+
+    stockMs += millisecondsBetween(start, stockDone);
+    fastMs += millisecondsBetween(stockDone, fastDone);
+    stockMarkers += stockIds.size();
+    fastMarkers += fastIds.size();
+    stockCandidates += stockIds.size() + stockRejected.size();
+    fastCandidates += fastIds.size() + fastRejected.size();
+
+    for (size_t i = 0; i < stockIds.size(); i++) {
+      double closest = INFINITY;
+      for (size_t j = 0; j < fastIds.size(); j++) {
+        closest = std::min(closest, distance(stockIds[i], stockCorners[i], fastIds[j], fastCorners[j]));
+      }
+
+      if (closest <= BENCH_CORNER_MATCH_DISTANCE) {
+        matched++;
+        cornerDistance += closest;
+      } else {
+        missed++;
+        if (verbosity > 0) {
+          std::cout << std::format("Frame {}: marker {} was only found by the stock detector.\n", f, stockIds[i]);
+        }
+      }
+    }
+
+    for (size_t j = 0; j < fastIds.size(); j++) {
+      double closest = INFINITY;
+      for (size_t i = 0; i < stockIds.size(); i++) {
+        closest = std::min(closest, distance(stockIds[i], stockCorners[i], fastIds[j], fastCorners[j]));
+      }
+
+      if (closest > BENCH_CORNER_MATCH_DISTANCE) {
+        extra++;
+        if (verbosity > 0) {
+          std::cout << std::format("Frame {}: marker {} was only found by the fast candidate detector.\n", f, fastIds[j]);
+        }
+      }
+    }
+  }
+
+  double frameCount = frames.size();
+  std::cout << std::format("{:<10}{:>12}{:>14}{:>12}\n", "detector", "markers", "candidates", "ms/frame");
+  std::cout << std::format("{:<10}{:>12}{:>14}{:>12.3f}\n", "stock", stockMarkers, stockCandidates, stockMs / frameCount);
+  std::cout << std::format("{:<10}{:>12}{:>14}{:>12.3f}\n", "fast", fastMarkers, fastCandidates, fastMs / frameCount);
+  std::cout << std::format("{} markers found by both, with {:.3f} px mean corner distance. {} only found by the stock detector, {} only by the fast one.\n",
+                           matched, matched > 0 ? cornerDistance / matched : 0.0, missed, extra);
+
+  return missed == 0 && extra == 0;
+}
+
+void printResult(const BenchResult& result) {
+  std::cout << std::format("{} frames, {:.1f} fps, {:.2f} markers per frame\n", result.frames, result.fps, result.markersPerFrame);
+  std::cout << std::format("{:<8}{:>10}{:>10}{:>10}{:>10}\n", "stage", "mean ms", "p50 ms", "p95 ms", "p99 ms");
+
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    const StageSummary& stage = result.stages[s];
+    std::cout << std::format("{:<8}{:>10.3f}{:>10.3f}{:>10.3f}{:>10.3f}\n", stageNames[s], stage.mean, stage.p50, stage.p95, stage.p99);
+  }
+}
+
+bool saveResult(const std::string& path, const BenchResult& result, const std::string& description) {
+  cv::FileStorage fs(path, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_JSON);
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  fs << "description" << description;
+  fs << "fps" << result.fps;
+  fs << "frames" << (int)result.frames;
+  fs << "markers_per_frame" << result.markersPerFrame;
+
+  fs << "stages" << "{";
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    fs << stageNames[s] << "{";
+    fs << "mean" << result.stages[s].mean;
+    fs << "p50" << result.stages[s].p50;
+    fs << "p95" << result.stages[s].p95;
+    fs << "p99" << result.stages[s].p99;
+    fs << "}";
+  }
+  fs << "}";
+
+  return true;
+}
+
+bool loadResult(const std::string& path, BenchResult& result, std::string& description) {
+  cv::FileStorage fs;
+
+  try {
+    fs.open(path, cv::FileStorage::READ);
+  } catch (const cv::Exception&) {
+  }
+
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  description = fs["description"].string();
+  result.fps = (double)fs["fps"];
+  result.frames = (int)fs["frames"];
+  result.markersPerFrame = (double)fs["markers_per_frame"];
+
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    cv::FileNode stage = fs["stages"][stageNames[s]];
+    result.stages[s].mean = (double)stage["mean"];
+    result.stages[s].p50 = (double)stage["p50"];
+    result.stages[s].p95 = (double)stage["p95"];
+    result.stages[s].p99 = (double)stage["p99"];
+  }
+
+  return true;
+}
+
+// Print the relative change of every value against the baseline. Return false if the run regressed by more than tolerance,
+// either in throughput or in the p95 latency of any stage.
+bool compareResult(const BenchResult& result, const BenchResult& baseline, double tolerance) {
+  bool ok = true;
+
+  auto change = [](double value, double reference) {
+    return reference > 0 ? value / reference - 1.0 : 0.0;
+  };
+
+  double fpsChange = change(result.fps, baseline.fps);
+  std::cout << std::format("fps: {:.1f} -> {:.1f} ({:+.1f}%)\n", baseline.fps, result.fps, fpsChange * 100);
+  if (fpsChange < -tolerance) {
+    std::cout << "  Regression: throughput dropped by more than " << tolerance * 100 << "%." << std::endl;
+    ok = false;
+  }
+
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    double p95Change = change(result.stages[s].p95, baseline.stages[s].p95);
+    std::cout << std::format("{} p95: {:.3f} ms -> {:.3f} ms ({:+.1f}%)\n", stageNames[s], baseline.stages[s].p95, result.stages[s].p95, p95Change * 100);
+
+    if (p95Change > tolerance) {
+      std::cout << "  Regression: p95 latency of " << stageNames[s] << " grew by more than " << tolerance * 100 << "%." << std::endl;
+      ok = false;
+    }
+  }
+
+  if (std::abs(result.markersPerFrame - baseline.markersPerFrame) > 1e-6) {
+    std::cout << std::format("Warning: {:.2f} markers per frame instead of {:.2f} in the baseline. The runs may not be comparable.\n",
+                             result.markersPerFrame, baseline.markersPerFrame);
+  }
+
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  int verbosity = 0;
+  std::string source = "";
+  cv::aruco::PredefinedDictionaryType dict = cv::aruco::DICT_6X6_250;
+  double markerLength = 0.1;
+  int markerCount = DEFAULT_BENCH_MARKERS;
+  int width = DEFAULT_BENCH_WIDTH;
+  int height = DEFAULT_BENCH_HEIGHT;
+  int frameCount = DEFAULT_BENCH_FRAMES;
+  int iterations = DEFAULT_BENCH_ITERATIONS;
+  int threadCount = DEFAULT_BENCH_THREADS;
+  int cvThreads = -1;
+  int decodeScale = 0;
+  std::string calibrationFile = "";
+  std::string baselineFile = "";
+  std::string saveBaselineFile = "";
+  double tolerance = DEFAULT_BENCH_TOLERANCE;
+  MarkerTrackerConfig trackerConfig;
+
+  po::options_description desc("Available options", HELP_LINE_LENGTH, HELP_DESCRIPTION_LENGTH);
+
+  desc.add_options()
+    ("help,h", "Show this message.")
+    ("verbose,v", po::value<int>()->default_value(0)->implicit_value(1), "Display additional information.")
+    ("source,s", po::value<std::string>()->default_value(source), "Video file, recording (" RECORDING_EXTENSION "), or glob pattern of an image sequence (e.g. \"frames/*.png\"), to replay. "
+                                                                  "If empty, synthetic frames with a grid of markers are generated instead.")
+    ("dict,d", po::value<int>()->default_value(dict), std::format("ArUco dictionary to use. These are the possible options:\n{}", dictsString()).c_str())
+    ("length,l", po::value<double>()->default_value(markerLength), "Size of the marker in meters.")
+    ("markers,m", po::value<int>()->default_value(markerCount), "Number of markers in the synthetic frames.")
+    ("width,W", po::value<int>()->default_value(width), "Width of the synthetic frames.")
+    ("height,H", po::value<int>()->default_value(height), "Height of the synthetic frames.")
+    ("frames,n", po::value<int>()->default_value(frameCount), "Number of synthetic frames to generate, or maximum number of frames to load from the source.")
+    ("iterations", po::value<int>()->default_value(iterations), "How many times to replay all frames.")
+    ("threads,t", po::value<int>()->default_value(threadCount), "Number of threads processing frames, each with its own tracker. "
+                                                                "With more than one thread, consecutive frames go to different trackers, which matters for --roi-tracking and --filter.")
+    ("cv-threads", po::value<int>()->default_value(cvThreads), "Number of threads OpenCV may use internally (cv::setNumThreads). -1 keeps the OpenCV default.")
+    ("calibration-file,c", po::value<std::string>()->default_value(calibrationFile), "Calibration file to use. If empty, a camera matrix with a focal length of the image width is assumed.")
+    ("detection-scale", po::value<int>()->default_value(trackerConfig.detectionScale), "Detect markers on a grayscale image downscaled by this factor (1, 2 or 4).")
+    ("roi-tracking", "Only search for markers close to where they were in the previous frame.")
+    ("filter", "Filter the poses of every marker over time.")
+    ("baseline,b", po::value<std::string>()->default_value(baselineFile), std::format("JSON file of an earlier run to compare against. "
+                                                                                      "The exit code is {} if the run regressed by more than the tolerance.", BENCH_REGRESSION_EXIT_CODE).c_str())
+    ("save-baseline", po::value<std::string>()->default_value(saveBaselineFile), "Write the results of this run as JSON to this file.")
+    ("tolerance", po::value<double>()->default_value(tolerance), "Relative drop of throughput, or increase of p95 latency of any stage, that still counts as no regression.")
+    ("decode-scale", po::value<int>()->default_value(decodeScale), "Decode frames straight to grayscale at 1/scale of their resolution (1, 2, 4 or 8), like tag-tracker does with --mjpeg. "
+                                                                    "The draw stage then includes decoding a color image. 0 decodes every frame to full resolution BGR.")
+    ("verify-identification", "Instead of benchmarking, identify every marker and rejected candidate of the stock detector again with the fast "
+                              "marker identification, and time it. The exit code is 1 if any marker is identified differently.")
+    ("fast-candidates", "Find and identify markers with the fast candidate detector instead of the OpenCV detector, like tag-tracker --fast-candidates.")
+    ("tiles", po::value<int>()->default_value(trackerConfig.tileThreads), "Split every frame into tiles that this many threads search in parallel, like tag-tracker --tiles. 0 disables tiling.")
+    ("min-distance", po::value<double>()->default_value(trackerConfig.minMarkerDistance), "Closest distance in meters at which markers are expected, for --tiles.")
+    ("max-distance", po::value<double>()->default_value(trackerConfig.maxMarkerDistance), "Farthest distance in meters at which markers are expected, for --tiles.")
+    ("compare-candidates", "Instead of benchmarking, run both the OpenCV detector and the fast candidate detector on every frame, and compare their markers, "
+                           "candidates and detection time. The exit code is 1 if any marker was only found by one of them.")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  verbosity = vm["verbose"].as<int>();
+  source = vm["source"].as<std::string>();
+  dict = (cv::aruco::PredefinedDictionaryType)vm["dict"].as<int>();
+  markerLength = vm["length"].as<double>();
+  markerCount = vm["markers"].as<int>();
+  width = vm["width"].as<int>();
+  height = vm["height"].as<int>();
+  frameCount = vm["frames"].as<int>();
+  iterations = vm["iterations"].as<int>();
+  threadCount = vm["threads"].as<int>();
+  cvThreads = vm["cv-threads"].as<int>();
+  calibrationFile = vm["calibration-file"].as<std::string>();
+  baselineFile = vm["baseline"].as<std::string>();
+  saveBaselineFile = vm["save-baseline"].as<std::string>();
+  tolerance = vm["tolerance"].as<double>();
+  decodeScale = vm["decode-scale"].as<int>();
+
+  if (frameCount < 1 || iterations < 1 || threadCount < 1 || markerCount < 1) {
+    std::cout << "The number of frames, iterations, threads and markers must be at least 1." << std::endl;
+    return 1;
+  }
+
+  trackerConfig.dict = dict;
+  trackerConfig.markerLength = markerLength;
+  trackerConfig.detectionScale = vm["detection-scale"].as<int>();
+  trackerConfig.roiTracking = vm.count("roi-tracking");
+  trackerConfig.temporalFilter = vm.count("filter");
+  trackerConfig.fastCandidates = vm.count("fast-candidates");
+  trackerConfig.tileThreads = vm["tiles"].as<int>();
+  trackerConfig.minMarkerDistance = vm["min-distance"].as<double>();
+  trackerConfig.maxMarkerDistance = vm["max-distance"].as<double>();
+
+  if (trackerConfig.tileThreads < 0 || trackerConfig.minMarkerDistance <= 0 || trackerConfig.maxMarkerDistance < trackerConfig.minMarkerDistance) {
+    std::cout << "The number of tile threads must not be negative, and the marker distances must be positive, with --max-distance at least --min-distance." << std::endl;
+    return 1;
+  }
+
+  if (trackerConfig.detectionScale != 1 && trackerConfig.detectionScale != 2 && trackerConfig.detectionScale != 4) {
+    std::cout << "Detection scale must be 1, 2 or 4." << std::endl;
+    return 1;
+  }
+
+  if (decodeScale != 0 && !isValidDecodeScale(decodeScale)) {
+    std::cout << "Decode scale must be 0, 1, 2, 4 or 8." << std::endl;
+    return 1;
+  }
+
+  if (cvThreads >= 0) {
+    cv::setNumThreads(cvThreads);
+  }
+
+  cv::Size resolution;
+  std::vector<std::vector<uchar> > frames;
+
+  if (source.empty()) {
+    resolution = cv::Size(width, height);
+    frames = generateFrames(dict, markerCount, resolution, frameCount);
+
+    if (frames.empty()) {
+      return 1;
+    }
+  } else {
+    frames = loadFrames(source, frameCount, resolution);
+  }
+
+  if (frames.empty()) {
+    std::cerr << "Error: Could not read any frames from " << source << "." << std::endl;
+    return -1;
+  }
+
+  CameraCalibration calibration;
+  if (!calibrationFile.empty()) {
+    if (!loadCalibration(calibrationFile, calibration, std::cerr) || !adaptCalibrationToResolution(calibration, resolution, std::cerr)) {
+      return 1;
+    }
+  } else if (isRecording(source) && ReplaySource(source, false).getCalibration(calibration)) {
+    // Use the calibration that was active while recording.
+  } else {
+    calibration.cameraMatrix = (cv::Mat_<double>(3, 3) << resolution.width, 0, resolution.width / 2.0,
+                                                          0, resolution.width, resolution.height / 2.0,
+                                                          0, 0, 1);
+    calibration.distCoeffs = cv::Mat::zeros(1, 5, CV_64F);
+  }
+
+  if (decodeScale > 1) {
+    scaleCalibration(calibration, 1.0 / decodeScale, 1.0 / decodeScale);
+  }
+
+  trackerConfig.cameraMatrix = calibration.cameraMatrix;
+  trackerConfig.distCoeffs = calibration.distCoeffs;
+
+  std::string description = std::format("source={} dict={} markers={} resolution={}x{} frames={} iterations={} threads={} detection-scale={} decode-scale={} roi-tracking={} filter={} fast-candidates={} tiles={}",
+                                         source.empty() ? "synthetic" : source, dictName(dict), source.empty() ? markerCount : 0,
+                                         resolution.width, resolution.height, frames.size(), iterations, threadCount,
+                                         trackerConfig.detectionScale, decodeScale, trackerConfig.roiTracking, trackerConfig.temporalFilter, trackerConfig.fastCandidates, trackerConfig.tileThreads);
+
+  if (verbosity > 0) {
+    std::cout << description << std::endl;
+  }
+
+  if (vm.count("verify-identification")) {
+    return verifyIdentification(frames, trackerConfig, decodeScale, verbosity) ? 0 : 1;
+  }
+
+  if (vm.count("compare-candidates")) {
+    return compareCandidates(frames, trackerConfig, decodeScale, verbosity) ? 0 : 1;
+  }
+
+  BenchResult result = runBenchmark(frames, trackerConfig, threadCount, iterations, decodeScale);
+  printResult(result);
+
+  if (!saveBaselineFile.empty() && !saveResult(saveBaselineFile, result, description)) {
+    std::cerr << "Error: Could not write " << saveBaselineFile << "." << std::endl;
+    return -1;
+  }
+
+  if (!baselineFile.empty()) {
+    BenchResult baseline;
+    std::string baselineDescription;
+
+    if (!loadResult(baselineFile, baseline, baselineDescription)) {
+      std::cerr << "Error: Could not read baseline " << baselineFile << "." << std::endl;
+      return -1;
+    }
+
+    if (baselineDescription != description) {
+      std::cout << "Warning: The baseline was recorded with different settings:\n  " << baselineDescription << std::endl;
+    }
+
+    if (!compareResult(result, baseline, tolerance)) {
+      return BENCH_REGRESSION_EXIT_CODE;
+    }
+  }
+
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include <opencv2/highgui/highgui.hpp>
 
 #include <tag-tracker.h>
+#include <calibration_file.h>
 #include <camera_calibration_helper.h>
 
 // Change to 1 to attempt screen size detection for window arrangement.
@@ -30,6 +31,9 @@ int main(int argc, char *argv[]) {
   int screenHeight = 2160;
   int autoarrange = 0;
   std::string calibrationValuesFIle = "";
+  bool streaming = false;
+  int thumbnailWidth = 0;
+  bool cornerCache = true;
 
   po::options_description desc("Available options", HELP_LINE_LENGTH, HELP_DESCRIPTION_LENGTH);
 
@@ -44,7 +48,12 @@ int main(int argc, char *argv[]) {
     ("autoarrange,a", "Arrange windows to optimally fill the screen. This does not work on wayland.")
     ("sw", po::value<int>()->default_value(screenWidth), "Width of the screen.")
     ("sh", po::value<int>()->default_value(screenHeight), "Height of the screen.")
-    ("save-file,s", po::value<std::string>()->default_value(calibrationValuesFIle)->implicit_value("calibration.txt"), "File to save calibration values to. By default the value is empty and so nothing is saved.")
+    ("save-file,s", po::value<std::string>()->default_value(calibrationValuesFIle)->implicit_value(DEFAULT_CALIBRATION_FILE), "File to save calibration values to. By default the value is empty and so nothing is saved. "
+                                                                                                                                                   "The extension selects the format: " CALIBRATION_BINARY_EXTENSION " for binary, " CALIBRATION_LEGACY_EXTENSION " for the old two line format, "
+                                                                                                                                                   "otherwise YAML, XML or JSON as supported by cv::FileStorage.")
+    ("streaming", "Release every image as soon as its corners are found, so memory use does not grow with the number of images. Annotated images are drawn on demand.")
+    ("thumbnail-width", po::value<int>()->default_value(thumbnailWidth), "In streaming mode, keep thumbnails of this width to draw the annotated images on, instead of reading the images again. 0 disables thumbnails.")
+    ("no-corner-cache", "Do not keep the detected corners in a cache file next to the images. By default only new or changed images are processed again.")
   ;
 
   po::variables_map vm;
@@ -94,6 +103,14 @@ int main(int argc, char *argv[]) {
     calibrationValuesFIle = std::filesystem::path(vm["save-file"].as<std::string>()).lexically_normal().string();
   }
 
+  streaming = vm.count("streaming");
+
+  if (vm.count("thumbnail-width")) {
+    thumbnailWidth = vm["thumbnail-width"].as<int>();
+  }
+
+  cornerCache = !vm.count("no-corner-cache");
+
 #if SCREEN_SIZE_DETECTION
   cv::namedWindow("screen", cv::WND_PROP_FULLSCREEN);
   cv::setWindowProperty("screen", cv::WND_PROP_FULLSCREEN, cv::WINDOW_FULLSCREEN);
@@ -123,6 +140,9 @@ int main(int argc, char *argv[]) {
     std::cout << "Autoarrange windows: " << autoarrange << std::endl;
     std::cout << "Screen width: " << screenWidth << std::endl;
     std::cout << "Screen height: " << screenHeight << std::endl;
+    std::cout << "Streaming: " << streaming << std::endl;
+    std::cout << "Thumbnail width: " << thumbnailWidth << std::endl;
+    std::cout << "Corner cache: " << cornerCache << std::endl;
   }
 
   if (verbosity > 2) {
@@ -138,15 +158,20 @@ int main(int argc, char *argv[]) {
   }
 
   CameraCalibrationHelper cch(checkerboardWidth, checkerboardHeight);
-  cch.calibrateWithImages(path);
+  cch.setStreaming(streaming, thumbnailWidth);
+  cch.setCornerCache(cornerCache);
+  int processedImgCount = cch.calibrateWithImages(path);
+
+  if (verbosity > 0) {
+    std::cout << "Calibrated with " << processedImgCount << " images, " << cch.getCornerCacheHits() << " of them from the corner cache." << std::endl;
+  }
   const std::vector<cv::String>& images = cch.getProcessedImagePaths();
-  const std::vector<cv::Mat>& processedImages = cch.getProcessedImages();
 
   for (unsigned int img = 0; img < images.size(); img++) {
     cv::namedWindow(std::format("Image{}: {}", img, images[img]), cv::WINDOW_NORMAL);
     cv::resizeWindow(std::format("Image{}: {}", img, images[img]), windowWidth, windowHeight);
 
-    cv::imshow(std::format("Image{}: {}", img, images[img]), processedImages[img]);
+    cv::imshow(std::format("Image{}: {}", img, images[img]), cch.getAnnotatedImage(img));
     cv::waitKey(10);
     cv::resizeWindow(std::format("Image{}: {}", img, images[img]), windowWidth, windowHeight);
 
@@ -170,8 +195,15 @@ int main(int argc, char *argv[]) {
     std::cout << "Translation vector : " << cch.getTranslationVectors() << std::endl;
   }
 
+  if (verbosity > 0) {
+    std::cout << "RMS reprojection error : " << cch.getRmsError() << std::endl;
+  }
+
   if (calibrationValuesFIle.length() > 0) {
-    saveCalibrationFile(calibrationValuesFIle, cmStr, dmStr);
+    if (!saveCalibration(calibrationValuesFIle, cch.getCalibration())) {
+      std::cerr << "Error: Could not write calibration file " << calibrationValuesFIle << "." << std::endl;
+      return 1;
+    }
   }
 
   return 0;
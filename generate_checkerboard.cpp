@@ -3,6 +3,7 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
 
 #include <tag-tracker.h>
@@ -16,6 +17,7 @@ int main(int argc, char *argv[]) {
   int pixelsPerSquare = 400; // 400 for a 6x9 checkerboard corresponds to about 300dpi when printing on A4.
   std::string path = "./output/";
   std::string prefix = "checkerboard";
+  bool compact = false;
 
   po::options_description desc("Available options", HELP_LINE_LENGTH, HELP_DESCRIPTION_LENGTH);
   desc.add_options()
@@ -26,6 +28,7 @@ int main(int argc, char *argv[]) {
     ("pps,r", po::value<int>(), std::format("Resolution in pixels per square. (Default: {})", pixelsPerSquare).c_str())
     ("prefix,p", po::value<std::string>(), std::format("File name prefix.(Default: {})", prefix).c_str())
     ("output,o", po::value<std::string>(), std::format("Output folder. (Default: {})", path).c_str())
+    ("compact", "Write the checkerboard as a single path with integer coordinates, which is much smaller and faster to rasterize than one rect per square.")
   ;
 
   po::variables_map vm;
@@ -58,6 +61,10 @@ int main(int argc, char *argv[]) {
     prefix = vm["prefix"].as<std::string>();
   }
 
+  if (vm.count("compact")) {
+    compact = true;
+  }
+
   if (verbosity > 0) {
     std::cout << "Setting width to: " << width << std::endl;
     std::cout << "Setting height to: " << height << std::endl;
@@ -73,21 +80,47 @@ int main(int argc, char *argv[]) {
   int imgWidth = width*pixelsPerSquare;
   int imgHeight = height*pixelsPerSquare;
 
-  // Create an SVG file
-  std::ofstream svgFile(path + "/" + prefix + ".svg");
-  svgFile << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << imgWidth
-          << "\" height=\"" << imgHeight << "\">";
-
-  for (int c = 0; c < width; c++) {
-    for (int r = 0; r < height; r++) {
-      if ((r+c) % 2 == 0) {
-        svgFile << "<rect x=\"" << pixelsPerSquare * c << "\" y=\"" << pixelsPerSquare * r
-                << "\" width=\" " << pixelsPerSquare << "\" height=\" " << pixelsPerSquare
-                << "\" fill=\"black\"/>";
+  // Build the whole SVG in memory, so it is written with a single call.
+  std::string svg;
+  auto out = std::back_inserter(svg);
+
+  if (compact) {
+    // Squares are black where exactly one of "odd row" and "even column" holds, so the even-odd fill of
+    // one stripe per odd row and one per even column draws the whole board with width + height rectangles.
+    // The view box is in squares, so all coordinates are small integers.
+    std::format_to(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{}\" height=\"{}\" viewBox=\"0 0 {} {}\" shape-rendering=\"crispEdges\"><path fill-rule=\"evenodd\" d=\"",
+                   imgWidth, imgHeight, width, height);
+
+    for (int r = 1; r < height; r += 2) {
+      std::format_to(out, "M0 {}h{}v1h-{}z", r, width, width);
+    }
+
+    for (int c = 0; c < width; c += 2) {
+      std::format_to(out, "M{} 0v{}h1v-{}z", c, height, height);
+    }
+
+    svg += "\"/></svg>";
+  } else {
+    std::format_to(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{}\" height=\"{}\">", imgWidth, imgHeight);
+
+    for (int c = 0; c < width; c++) {
+      for (int r = 0; r < height; r++) {
+        if ((r+c) % 2 == 0) {
+          std::format_to(out, "<rect x=\"{}\" y=\"{}\" width=\" {}\" height=\" {}\" fill=\"black\"/>", pixelsPerSquare * c, pixelsPerSquare * r, pixelsPerSquare, pixelsPerSquare);
+        }
       }
     }
+
+    svg += "</svg>";
+  }
+
+  std::ofstream svgFile(path + "/" + prefix + ".svg", std::ios::out | std::ios::trunc | std::ios::binary);
+  svgFile.write(svg.data(), svg.size());
+
+  if (!svgFile.good()) {
+    std::cout << "Could not write " << path + "/" + prefix + ".svg" << "." << std::endl;
+    return 1;
   }
 
-  svgFile << "</svg>";
-  svgFile.close();
+  return 0;
 }
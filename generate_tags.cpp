@@ -1,10 +1,16 @@
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <opencv2/aruco.hpp>
 #include <opencv2/opencv.hpp>
 #include <string>
+#include <thread>
 #include <vector>
 #include <filesystem>
 
@@ -26,6 +32,121 @@ int sizeFromDict(cv::aruco::PredefinedDictionaryType dict) {
   return size;
 }
 
+// Parse an inclusive range like "0:999". Return false if the string is not a valid range.
+bool parseIdRange(const std::string& str, int& first, int& last) {
+  size_t colon = str.find(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+
+  try {
+    size_t end;
+    first = std::stoi(str.substr(0, colon), &end);
+    if (end != colon) {
+      return false;
+    }
+
+    std::string lastStr = str.substr(colon + 1);
+    last = std::stoi(lastStr, &end);
+    if (end != lastStr.size()) {
+      return false;
+    }
+  } catch (const std::exception&) {
+    return false;
+  }
+
+  return first >= 0 && first <= last;
+}
+
+// Write data to a file in a single call. Return false if the file could not be written.
+bool writeFile(const std::string& fileName, const std::string& data) {
+  std::ofstream file(fileName, std::ios::out | std::ios::trunc | std::ios::binary);
+  file.write(data.data(), data.size());
+
+  return file.good();
+}
+
+// How the marker SVGs are written.
+enum class SvgMode {
+  // One rect per black cell, in pixel coordinates.
+  RECTS,
+  // One path per marker with every horizontal run of black cells merged into one rectangle, in integer cell coordinates.
+  COMPACT,
+  // Like COMPACT, but all markers go onto one sheet, which shares the marker border through <defs>.
+  SHEET
+};
+
+// Append the path data of all black cells (0) of cells, leaving out border cells on each side.
+// Every horizontal run of black cells becomes one rectangle. Coordinates are integers in cells, relative to the top left cell.
+void appendRunPathData(std::string& svg, const cv::Mat& cells, int border) {
+  auto out = std::back_inserter(svg);
+
+  for (int r = border; r < cells.rows - border; r++) {
+    const uchar* row = cells.ptr<uchar>(r);
+    int c = border;
+
+    while (c < cells.cols - border) {
+      if (row[c] != 0) {
+        c++;
+        continue;
+      }
+
+      int start = c;
+      while (c < cells.cols - border && row[c] == 0) {
+        c++;
+      }
+
+      std::format_to(out, "M{} {}h{}v1h-{}z", start, r, c - start, c - start);
+    }
+  }
+}
+
+// Generate the SVG and PNG files of one marker. svg and the images are buffers of the calling thread, which are reused between markers.
+// In SvgMode::SHEET, no SVG file is written. svg then holds the group of the marker for the sheet instead, placed at (x, y) cells.
+bool generateTag(const cv::aruco::Dictionary& dictionary, int markerId, int markerSize, int imageSize, const std::string& fileBase, SvgMode mode,
+                 int x, int y, std::string& svg, cv::Mat& markerImage, cv::Mat& resizedMarkerImage) {
+  cv::aruco::generateImageMarker(dictionary, markerId, markerSize, markerImage, 1);
+
+  // Build the whole SVG in memory, so it is written with a single call.
+  svg.clear();
+  auto out = std::back_inserter(svg);
+
+  if (mode == SvgMode::RECTS) {
+    double imageScale = imageSize / markerSize;
+
+    std::format_to(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{}\" height=\"{}\">", imageSize, imageSize);
+
+    for (int i = 0; i < markerSize; ++i) {
+      for (int j = 0; j < markerSize; ++j) {
+        if (markerImage.at<uchar>(j, i) == 0) {
+          std::format_to(out, "<rect x=\"{}\" y=\"{}\" width=\" {}\" height=\" {}\" fill=\"black\"/>", imageScale * i, imageScale * j, imageScale, imageScale);
+        }
+      }
+    }
+
+    svg += "</svg>";
+  } else if (mode == SvgMode::COMPACT) {
+    // The view box is in cells, so all coordinates are small integers. crispEdges avoids hairline gaps between the rows.
+    std::format_to(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"{}\" height=\"{}\" viewBox=\"0 0 {} {}\" shape-rendering=\"crispEdges\"><path d=\"",
+                   imageSize, imageSize, markerSize, markerSize);
+    appendRunPathData(svg, markerImage, 0);
+    svg += "\"/></svg>";
+  } else {
+    // The border is the same for every marker and comes from the <defs> of the sheet, so only the inner cells are written.
+    std::format_to(out, "<g transform=\"translate({} {})\"><use xlink:href=\"#border\"/><path d=\"", x, y);
+    appendRunPathData(svg, markerImage, 1);
+    std::format_to(out, "\"/><text x=\"0\" y=\"{}.8\" font-size=\"0.8\" font-family=\"sans-serif\">{}</text></g>", markerSize, markerId);
+  }
+
+  if (mode != SvgMode::SHEET && !writeFile(fileBase + ".svg", svg)) {
+    return false;
+  }
+
+  cv::resize(markerImage, resizedMarkerImage, cv::Size(imageSize, imageSize), 0, 0, cv::INTER_NEAREST);
+
+  return cv::imwrite(fileBase + ".png", resizedMarkerImage);
+}
+
 int main(int argc, char *argv[]) {
   int verbosity = 0;
 
@@ -35,6 +156,9 @@ int main(int argc, char *argv[]) {
   std::string prefix = "marker";
   std::vector<int> markerIds = {0};
   std::string path = "./output/";
+  int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  SvgMode svgMode = SvgMode::RECTS;
+  int sheetColumns = 0;
 
   po::options_description desc("Available options", HELP_LINE_LENGTH, HELP_DESCRIPTION_LENGTH);
   desc.add_options()
@@ -45,6 +169,12 @@ int main(int argc, char *argv[]) {
     ("resolution,r", po::value<int>()->default_value(imageSize), "Size of the generated image in pixels per side.")
     ("prefix,p", po::value<std::string>()->default_value(prefix), "File name prefix.")
     ("output,o", po::value<std::string>()->default_value(path), "Output folder for the generated tags.")
+    ("id-range", po::value<std::string>(), "Inclusive range of IDs to generate, e.g. 0:999. Replaces the default of --id, and is added to the IDs given with --id.")
+    ("threads,t", po::value<int>()->default_value(threadCount), "Number of threads generating markers in parallel.")
+    ("compact", "Write every marker as a single path, with horizontal runs of black cells merged and integer coordinates. "
+                "The files are much smaller and faster to rasterize than with one rect per cell.")
+    ("sheet", po::value<int>(), "Put all markers onto one compact SVG sheet with this many markers per row, labeled with their ID and sorted by it, instead of one SVG per marker. "
+                                "The marker border is shared through <defs>. PNGs are still written per marker.")
   ;
 
   po::variables_map vm;
@@ -62,6 +192,40 @@ int main(int argc, char *argv[]) {
     markerIds = vm["id"].as<std::vector<int>>();
   }
 
+  if (vm.count("id-range")) {
+    int first, last;
+    if (!parseIdRange(vm["id-range"].as<std::string>(), first, last)) {
+      std::cout << "Expected an ID range like 0:999, but got " << vm["id-range"].as<std::string>() << "." << std::endl;
+      return 1;
+    }
+
+    if (vm["id"].defaulted()) {
+      markerIds.clear();
+    }
+
+    for (int id = first; id <= last; id++) {
+      markerIds.push_back(id);
+    }
+  }
+
+  if (vm.count("threads")) {
+    threadCount = std::max(1, vm["threads"].as<int>());
+  }
+
+  if (vm.count("compact")) {
+    svgMode = SvgMode::COMPACT;
+  }
+
+  if (vm.count("sheet")) {
+    svgMode = SvgMode::SHEET;
+    sheetColumns = vm["sheet"].as<int>();
+
+    if (sheetColumns < 1) {
+      std::cout << "Expected at least 1 marker per row on the sheet, but got " << sheetColumns << "." << std::endl;
+      return 1;
+    }
+  }
+
   if (vm.count("dict")) {
     dict = (cv::aruco::PredefinedDictionaryType)vm["dict"].as<int>();
   }
@@ -94,41 +258,93 @@ int main(int argc, char *argv[]) {
     assert(std::filesystem::create_directory(path));
   }
 
-  double imageScale = imageSize / markerSize;
-
-  cv::Mat markerImage;
   cv::aruco::Dictionary dictionary =
       cv::aruco::getPredefinedDictionary(dict);
 
-  for (unsigned int id = 0; id < markerIds.size(); id++) {
-    cv::aruco::generateImageMarker(dictionary, markerIds[id], markerSize,
-                                  markerImage, 1);
+  for (int id : markerIds) {
+    if (id < 0 || id >= dictionary.bytesList.rows) {
+      std::cout << "ID " << id << " is not part of " << dictName(dict) << ", which has IDs 0 to " << dictionary.bytesList.rows - 1 << "." << std::endl;
+      return 1;
+    }
+  }
 
-    // Create an SVG file
-    std::ofstream svgFile(path + "/" + prefix + std::to_string(markerIds[id]) + ".svg");
-    svgFile << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << imageSize
-            << "\" height=\"" << imageSize << "\">";
+  // Every ID is generated once. The same ID twice would have two threads write the same files at the same time.
+  std::sort(markerIds.begin(), markerIds.end());
+  markerIds.erase(std::unique(markerIds.begin(), markerIds.end()), markerIds.end());
 
-    // Convert the marker to SVG
-    for (int i = 0; i < markerSize; ++i) {
-      for (int j = 0; j < markerSize; ++j) {
-        if (markerImage.at<uchar>(j, i) == 0) {
-          svgFile << "<rect x=\"" << imageScale * i << "\" y=\"" << imageScale * j
-                  << "\" width=\" " << imageScale << "\" height=\" " << imageScale
-                  << "\" fill=\"black\"/>";
-        }
+  // OpenCV would parallelize the small resizes itself, on top of the worker threads.
+  cv::setNumThreads(1);
+
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<size_t> nextIndex = 0;
+  std::atomic<int> failed = 0;
+  std::mutex errorMutex;
+
+  // On a sheet, every marker gets one cell of space on each side, so neighbors are two cells apart and the ID fits below.
+  int sheetPitch = markerSize + 2;
+  std::vector<std::string> sheetGroups(svgMode == SvgMode::SHEET ? markerIds.size() : 0);
+
+  // Every thread takes the next ID until all are done, so the threads stay busy even if some markers take longer to encode.
+  auto worker = [&]() {
+    std::string svg;
+    cv::Mat markerImage;
+    cv::Mat resizedMarkerImage;
+
+    for (size_t index = nextIndex++; index < markerIds.size(); index = nextIndex++) {
+      std::string fileBase = path + "/" + prefix + std::to_string(markerIds[index]);
+
+      int x = (index % std::max(sheetColumns, 1)) * sheetPitch + 1;
+      int y = (index / std::max(sheetColumns, 1)) * sheetPitch + 1;
+
+      if (!generateTag(dictionary, markerIds[index], markerSize, imageSize, fileBase, svgMode, x, y, svg, markerImage, resizedMarkerImage)) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::cout << "Could not write " << fileBase << ".svg or " << fileBase << ".png." << std::endl;
+        failed++;
+      }
+
+      if (svgMode == SvgMode::SHEET) {
+        sheetGroups[index] = svg;
       }
     }
+  };
 
-    svgFile << "</svg>";
-    svgFile.close();
+  std::vector<std::thread> threads;
+  for (int i = 1; i < std::min<int>(threadCount, markerIds.size()); i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
 
-    cv::Mat resizedMarkerImage;
-    cv::resize(markerImage, resizedMarkerImage, cv::Size(imageSize, imageSize), 0,
-              0, cv::INTER_NEAREST);
-    cv::imwrite(path + "/" + prefix + std::to_string(markerIds[id]) + ".png",
-                resizedMarkerImage);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (svgMode == SvgMode::SHEET) {
+    int sheetRows = (markerIds.size() + sheetColumns - 1) / sheetColumns;
+    int n = markerSize;
+    std::string sheet;
+    auto out = std::back_inserter(sheet);
+
+    // Same scale as the single markers: imageSize pixels per marker.
+    std::format_to(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"{}\" height=\"{}\" viewBox=\"0 0 {} {}\" shape-rendering=\"crispEdges\">",
+                   (long)sheetColumns * sheetPitch * imageSize / n, (long)sheetRows * sheetPitch * imageSize / n, sheetColumns * sheetPitch, sheetRows * sheetPitch);
+    std::format_to(out, "<defs><path id=\"border\" fill-rule=\"evenodd\" d=\"M0 0h{}v{}h-{}zM1 1v{}h{}v-{}z\"/></defs>", n, n, n, n - 2, n - 2, n - 2);
+
+    for (const std::string& group : sheetGroups) {
+      sheet += group;
+    }
+    sheet += "</svg>";
+
+    std::string sheetFile = path + "/" + prefix + "_sheet.svg";
+    if (!writeFile(sheetFile, sheet)) {
+      std::cout << "Could not write " << sheetFile << "." << std::endl;
+      failed++;
+    }
+  }
+
+  if (verbosity > 0) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Generated " << markerIds.size() - failed << " markers in " << seconds << "s with " << threads.size() + 1 << " threads." << std::endl;
   }
 
-  return 0;
+  return failed > 0 ? 1 : 0;
 }
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+// Change to 1 (or configure with -DALLOCATION_COUNTING=ON) to count the heap allocations of every thread.
+// malloc and friends are then replaced with counting wrappers around the glibc allocator, which also catches
+// the image buffers of cv::Mat. When disabled, IGNORE_ALLOCATIONS expands to nothing and no counts are kept.
+#ifndef ALLOCATION_COUNTING
+#define ALLOCATION_COUNTING 0
+#endif
+
+// Frames tracked before --check-allocations starts counting, so all buffers had the chance to grow to their final size.
+#define DEFAULT_ALLOCATION_CHECK_WARMUP 100
+
+// Number of heap allocations the calling thread made so far, outside of IGNORE_ALLOCATIONS scopes.
+// Always 0 without ALLOCATION_COUNTING.
+uint64_t threadAllocationCount();
+
+// While an instance is alive, allocations of the calling thread are not counted.
+// Used around library calls that allocate internally (e.g. the ArUco detector), which the frame loop has no control over.
+class ScopedAllocationExemption {
+public:
+  ScopedAllocationExemption();
+  ~ScopedAllocationExemption();
+
+  ScopedAllocationExemption(const ScopedAllocationExemption&) = delete;
+  ScopedAllocationExemption& operator=(const ScopedAllocationExemption&) = delete;
+};
+
+#if ALLOCATION_COUNTING
+#define ALLOCATION_COUNTER_CONCAT_(a, b) a##b
+#define ALLOCATION_COUNTER_CONCAT(a, b) ALLOCATION_COUNTER_CONCAT_(a, b)
+// Do not count allocations for the rest of the enclosing scope.
+#define IGNORE_ALLOCATIONS() ScopedAllocationExemption ALLOCATION_COUNTER_CONCAT(allocationExemption, __LINE__)
+#else
+#define IGNORE_ALLOCATIONS()
+#endif // ALLOCATION_COUNTING
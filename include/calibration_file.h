@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+#define CALIBRATION_FILE_VERSION 1
+#define DEFAULT_CALIBRATION_FILE "calibration.bin"
+// Calibration files with this extension are written in the binary format, all others with cv::FileStorage (YAML, XML or JSON,
+// depending on the extension). The format is detected from the content when loading, so the extension does not matter there.
+#define CALIBRATION_BINARY_EXTENSION ".bin"
+#define CALIBRATION_LEGACY_EXTENSION ".txt"
+#define CALIBRATION_MODEL_PINHOLE "pinhole"
+
+// Everything known about a camera calibration.
+// imageSize, boardSize and rmsError are unknown (empty or negative) for calibrations given on the command line
+// or loaded from the old two line text format.
+struct CameraCalibration {
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+  cv::Size imageSize;
+  // Inner corners of the checkerboard that was used for the calibration.
+  cv::Size boardSize;
+  double rmsError = -1;
+  std::string model = CALIBRATION_MODEL_PINHOLE;
+};
+
+// Write the calibration to path. The format is chosen by the extension:
+// CALIBRATION_BINARY_EXTENSION for the binary format, CALIBRATION_LEGACY_EXTENSION for the old two line format
+// (camera matrix and distortion coefficients only), and cv::FileStorage for everything else.
+// Return false if the file could not be written.
+bool saveCalibration(const std::filesystem::path& path, const CameraCalibration& calibration);
+
+// Read a calibration written by saveCalibration(), in any of the formats. Errors are printed to err.
+// Return false if the file could not be read or is invalid, in which case calibration is left unchanged.
+bool loadCalibration(const std::filesystem::path& path, CameraCalibration& calibration, std::ostream& err = std::cout);
+
+// Write or read a calibration in the binary format to or from a stream, e.g. to embed it into another file.
+bool writeCalibration(std::ostream& out, const CameraCalibration& calibration);
+bool readCalibration(std::istream& in, CameraCalibration& calibration, std::ostream& err = std::cout);
+
+// Scale the camera matrix (and the resolution, if it is known) for images that were resized by these factors.
+void scaleCalibration(CameraCalibration& calibration, double scaleX, double scaleY);
+
+// Compare the resolution the calibration was made at with the one of the video source.
+// If they have the same aspect ratio, the camera matrix is scaled to the new resolution and a warning is printed.
+// Return false if the aspect ratio differs, because the calibration cannot be valid for the source then.
+// Always succeeds if the calibration resolution is unknown, and with a warning if the one of the source is.
+bool adaptCalibrationToResolution(CameraCalibration& calibration, cv::Size frameSize, std::ostream& err = std::cout);
@@ -8,11 +8,20 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <tag-tracker.h>
+#include <corner_cache.h>
+#include <calibration_file.h>
 
 class CameraCalibrationHelper {
 private:
   const int checkerboardWidth = 0;
   const int checkerboardHeight = 0;
+  bool annotateImages = true;
+  bool streaming = false;
+  int thumbnailWidth = 0;
+  bool useCornerCache = false;
+  std::filesystem::path cornerCachePath;
+  int cornerCacheHits = 0;
+  double rmsError = -1;
 
   cv::Mat cameraMatrix;
   cv::Mat distCoeffs;
@@ -22,11 +31,15 @@ private:
   std::vector<cv::Mat> processedImages;
   std::vector<cv::String> inputImagePaths;
   std::vector<cv::String> processedImagePaths;
+  // Corners of every successfully processed image, in the same order as processedImagePaths.
+  std::vector<std::vector<cv::Point2f> > detectedCorners;
+  std::vector<cv::Mat> thumbnails;
+  cv::Size imageSize;
 
   void resetResults() {
-    // inputImages is the first thing to be filled during calibration,
+    // inputImages (or detectedCorners in streaming mode) is the first thing to be filled during calibration,
     // so checking that to see if deleting anything is necessary.
-    if (inputImages.size() == 0) {
+    if (inputImages.size() == 0 && detectedCorners.size() == 0) {
       return;
     }
 
@@ -34,12 +47,33 @@ private:
     distCoeffs = cv::Mat();
     rotationVectors = cv::Mat();
     translationVectors = cv::Mat();
+    rmsError = -1;
     inputImages = std::vector<cv::Mat>();
     processedImages = std::vector<cv::Mat>();
     inputImagePaths = std::vector<cv::String>();
     processedImagePaths = std::vector<cv::String>();
+    detectedCorners = std::vector<std::vector<cv::Point2f> >();
+    thumbnails = std::vector<cv::Mat>();
+    imageSize = cv::Size();
   }
 
+  // Find and refine the checkerboard corners in a color or grayscale image.
+  bool detectCorners(const cv::Mat& image, std::vector<cv::Point2f>& corners) const;
+
+  cv::Mat makeThumbnail(const cv::Mat& image) const;
+
+  // Decode, detect and release the images in inputImagePaths one after another (on every available thread),
+  // keeping only the corners and thumbnails.
+  // Images found in the cache (if not nullptr) are neither decoded nor detected again.
+  void detectCornersStreaming(CornerCache* cache = nullptr);
+
+  // Detect the corners of all images (on every available thread) and calibrate with them.
+  // With a cache, keys holds the content hash of every image, and images found in the cache are not detected again.
+  int calibrateWithImages(const std::vector<cv::Mat>& images, CornerCache* cache, const std::vector<uint64_t>& keys);
+
+  // Run the calibration on detectedCorners. Return the number of corner sets used.
+  int calibrateWithDetectedCorners();
+
 public:
   // Width and height measured in the number of inner corners of the checkerboard pattern.
   // In other words, the number of squares in the respective direction minus 1.
@@ -76,6 +110,47 @@ public:
     return processedImgCount;
   }
 
+  // If disabled, processedImages stays empty, and images loaded from disk are decoded directly to grayscale,
+  // which is considerably faster. Enabled by default.
+  void setAnnotateImages(bool annotate) {
+    annotateImages = annotate;
+  }
+
+  // In streaming mode, every image is released as soon as its corners are extracted, so memory use does not grow with the number of images.
+  // Only the corners and, if thumbnailWidth is positive, a thumbnail of that width are kept.
+  // inputImages and processedImages stay empty; use getAnnotatedImage() to draw the detected corners on demand instead.
+  void setStreaming(bool enable, int thumbnailWidth = 0) {
+    streaming = enable;
+    this->thumbnailWidth = thumbnailWidth;
+  }
+
+  // Keep the detected corners of images loaded from disk in a cache file, so that only new or changed images are processed
+  // the next time. If path is empty, CORNER_CACHE_FILENAME in the image folder is used.
+  // In streaming mode, images taken from the cache are not decoded at all and get no thumbnail. Otherwise they are still
+  // decoded, because the images are kept, but their corners are not detected again.
+  void setCornerCache(bool enable, std::filesystem::path path = "") {
+    useCornerCache = enable;
+    cornerCachePath = path;
+  }
+
+  // Number of images of the last calibrateWithImages(std::filesystem::path) call that were taken from the corner cache.
+  int getCornerCacheHits() const {
+    return cornerCacheHits;
+  }
+
+  // Return the processed image with index i (in the order of processedImagePaths) with the detected corners drawn on it.
+  // In streaming mode the image is drawn on the thumbnail if there is one, otherwise it is read again from disk.
+  // Return an empty image if neither is available.
+  cv::Mat getAnnotatedImage(size_t i) const;
+
+  size_t getProcessedImageCount() const {
+    return detectedCorners.size();
+  }
+
+  const std::vector<std::vector<cv::Point2f> >& getDetectedCorners() {
+    return detectedCorners;
+  }
+
   const cv::Mat& getCameraMatrix() {
     return cameraMatrix;
   }
@@ -84,6 +159,27 @@ public:
     return distCoeffs;
   }
 
+  // RMS reprojection error of the last calibration in pixels, or -1 if there was none.
+  double getRmsError() const {
+    return rmsError;
+  }
+
+  cv::Size getImageSize() const {
+    return imageSize;
+  }
+
+  // The results of the last calibration, for saveCalibration().
+  CameraCalibration getCalibration() const {
+    CameraCalibration calibration;
+    calibration.cameraMatrix = cameraMatrix;
+    calibration.distCoeffs = distCoeffs;
+    calibration.imageSize = imageSize;
+    calibration.boardSize = cv::Size(checkerboardWidth, checkerboardHeight);
+    calibration.rmsError = rmsError;
+
+    return calibration;
+  }
+
   const cv::Mat& getRotationVectors() {
     return rotationVectors;
   }
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <marker_identifier.h>
+
+// A square found in one of the thresholded images, before it is identified.
+struct MarkerCandidate {
+  // Clockwise, like the candidates of the stock detector.
+  std::array<cv::Point2f, 4> corners;
+  // Number of pixels of the contour the square was approximated from.
+  int perimeter;
+};
+
+// Replacement for the candidate search of cv::aruco::ArucoDetector, which is most of the detection time on large frames.
+//
+// The stock detector runs a full adaptive threshold (a box filter over the whole image) for every window size, and finds
+// all contours of every thresholded image. Here the integral image is computed once per frame, and every window size
+// is thresholded from it with a kernel of four lookups and one comparison per pixel, which the compiler vectorizes.
+// Contours are traced directly in the thresholded image, one window size per thread, into point buffers that keep their
+// capacity across frames. The squares among them are identified with MarkerIdentifier, so the results are close to but
+// not exactly those of the stock detector. Parameters are taken from cv::aruco::DetectorParameters, as far as they apply.
+// Every thread needs its own instance.
+class CandidateDetector {
+private:
+  // Everything needed to search one threshold window size.
+  struct ScaleBuffers {
+    // Thresholded image with one pixel of background around it, so tracing needs no bounds checks.
+    // 0 is background, 1 foreground and 2 foreground already on a traced contour.
+    std::vector<uchar> binary;
+    std::vector<cv::Point> contour;
+    std::vector<cv::Point> polygon;
+    std::vector<MarkerCandidate> candidates;
+  };
+
+  cv::aruco::DetectorParameters params;
+  MarkerIdentifier identifier;
+
+  cv::Mat grayImage;
+  // Integral image with one more row and column than the frame. Unsigned, so sums over windows stay correct when the
+  // total overflows on very large frames.
+  std::vector<uint32_t> integral;
+  std::vector<ScaleBuffers> scales;
+  std::vector<MarkerCandidate> candidates;
+  std::vector<cv::Point2f> markerCorners;
+
+  void computeIntegral(const cv::Mat& gray);
+  void threshold(const cv::Mat& gray, int windowSize, ScaleBuffers& buffers) const;
+  void findSquares(const cv::Size& imageSize, ScaleBuffers& buffers) const;
+  // Trace the contour that starts at index start of the binary image into buffers.contour.
+  // Return the number of pixels of the contour, of which at most maxPoints are stored.
+  int traceContour(int start, int stride, int maxPoints, ScaleBuffers& buffers) const;
+  // Add candidate, unless it is too close to one already there. Of two close candidates the larger one is kept.
+  void addCandidate(const MarkerCandidate& candidate);
+
+public:
+  CandidateDetector(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params);
+
+  // Change the thresholding, contour and corner refinement parameters, e.g. from the latency budget.
+  void setDetectorParameters(const cv::aruco::DetectorParameters& params) {
+    this->params = params;
+  }
+
+  // Find the squares of the image, without identifying them. Close squares from different window sizes are merged.
+  const std::vector<MarkerCandidate>& findCandidates(const cv::Mat& image);
+
+  // Same outputs as cv::aruco::ArucoDetector::detectMarkers. The vectors are reused.
+  void detectMarkers(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                     std::vector<std::vector<cv::Point2f> >& rejected);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#define CORNER_CACHE_FILENAME ".corner_cache.yml"
+// Increase whenever the corner detection changes in a way that makes previously cached corners invalid.
+#define CORNER_CACHE_VERSION 1
+
+struct CornerCacheEntry {
+  // false if no checkerboard was found in the image. Failures are cached as well, so they are not retried.
+  bool found = false;
+  cv::Size imageSize;
+  std::vector<cv::Point2f> corners;
+};
+
+// Detected checkerboard corners of calibration images, stored in a sidecar file next to the images.
+// Entries are keyed by a hash of the file content, so renamed images still hit the cache and modified ones miss it.
+// The checkerboard size and the detection flags are stored in the file, and the whole cache is discarded if they do not match.
+class CornerCache {
+private:
+  std::filesystem::path path;
+  cv::Size boardSize;
+  int flags;
+
+  std::unordered_map<uint64_t, CornerCacheEntry> entries;
+  // Entries that were looked up or inserted since loading. Only these are saved, so entries of deleted images disappear.
+  std::unordered_set<uint64_t> used;
+  bool modified = false;
+
+  void load();
+
+public:
+  // Load the cache from path, if it exists and was created with the same checkerboard size and flags.
+  CornerCache(const std::filesystem::path& path, cv::Size boardSize, int flags);
+
+  // 64-bit FNV-1a hash of the file content.
+  static uint64_t hash(const std::vector<uchar>& data);
+
+  // Return nullptr on a miss. Safe to call from multiple threads, as long as nothing is inserted at the same time.
+  const CornerCacheEntry* find(uint64_t key) const;
+
+  // Mark an entry as still in use, so it is kept on the next save().
+  void touch(uint64_t key);
+
+  void insert(uint64_t key, const CornerCacheEntry& entry);
+
+  // Write the cache back to disk if anything changed. Return false if the file could not be written.
+  bool save();
+
+  size_t size() const {
+    return entries.size();
+  }
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include <frame_source.h>
+#include <latest_frame_queue.h>
+#include <marker_tracker.h>
+
+#define DEFAULT_PIPELINE_WORKERS 1
+#define DEFAULT_PIPELINE_QUEUE_SIZE 1
+
+struct PipelineStats {
+  // Frames read from the video source.
+  uint64_t captured = 0;
+  // Frames that were replaced by a newer one before any worker picked them up.
+  uint64_t droppedBeforeDetection = 0;
+  // Frames that went through detection and pose estimation.
+  uint64_t processed = 0;
+  // Processed frames that were replaced by a newer result before the consumer fetched them,
+  // or that finished after a newer frame had already been handed out.
+  uint64_t droppedBeforeRender = 0;
+  // Frames handed out through nextResult().
+  uint64_t delivered = 0;
+};
+
+// Runs capture, detection/pose estimation and display on separate threads.
+// One thread reads from the video source, workerCount threads detect markers and estimate their pose,
+// and the thread calling nextResult() (usually the main thread, because of the GUI) consumes the results.
+// Stages are connected by LatestFrameQueues, so stale frames are dropped instead of piling up.
+class FramePipeline {
+private:
+  FrameSource& videoSource;
+  std::vector<std::unique_ptr<MarkerTracker> > trackers;
+
+  LatestFrameQueue<TrackedFrame> captureQueue;
+  LatestFrameQueue<TrackedFrame> resultQueue;
+
+  std::thread captureThread;
+  std::vector<std::thread> workerThreads;
+
+  std::atomic<bool> running = false;
+  std::atomic<int> activeWorkers = 0;
+  std::atomic<uint64_t> capturedCount = 0;
+  std::atomic<uint64_t> processedCount = 0;
+  uint64_t deliveredCount = 0;
+  uint64_t outOfOrderCount = 0;
+  uint64_t lastDeliveredSequence = 0;
+
+  void captureLoop();
+  void workerLoop(MarkerTracker& tracker);
+
+public:
+  FramePipeline(FrameSource& videoSource, const MarkerTrackerConfig& config,
+                int workerCount = DEFAULT_PIPELINE_WORKERS, size_t queueSize = DEFAULT_PIPELINE_QUEUE_SIZE);
+  ~FramePipeline();
+
+  FramePipeline(const FramePipeline&) = delete;
+  FramePipeline& operator=(const FramePipeline&) = delete;
+
+  void start();
+
+  // Stop capturing and wait for all threads to finish.
+  void stop();
+
+  // Block until the next processed frame is available.
+  // Frames older than the last one returned are skipped.
+  // Return false once the video source ran out of frames (or stop() was called) and all results were consumed.
+  // Must only be called from one thread.
+  bool nextResult(TrackedFrame& frame);
+
+  // The tracker of a worker. The first one is useful for drawing, which only needs the configuration.
+  // Only access the state of a tracker after stop() was called.
+  MarkerTracker& getTracker(size_t worker = 0) const {
+    return *trackers.at(worker);
+  }
+
+  size_t getWorkerCount() const {
+    return trackers.size();
+  }
+
+  PipelineStats getStats() const;
+};
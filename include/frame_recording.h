@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+#include <calibration_file.h>
+#include <frame_source.h>
+
+#define RECORDING_EXTENSION ".ttrec"
+#define RECORDING_VERSION 1
+// Number of frames that may wait for the writer thread before new frames are dropped.
+#define DEFAULT_RECORDING_QUEUE_SIZE 64
+
+// Recordings consist of a RecordingFileHeader, the calibration in the binary calibration format (if hasCalibration is set),
+// and then one RecordedFrameHeader followed by dataSize bytes of raw, uncompressed pixel data per frame.
+// Everything is in host byte order. timestampNs is the capture time in nanoseconds of the steady clock, as in PoseRecord.
+struct RecordingFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t hasCalibration;
+};
+
+struct RecordedFrameHeader {
+  uint64_t sequence;
+  int64_t timestampNs;
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  uint32_t reserved;
+  uint64_t dataSize;
+};
+
+static_assert(sizeof(RecordingFileHeader) == 16, "RecordingFileHeader must not contain padding.");
+static_assert(sizeof(RecordedFrameHeader) == 40, "RecordedFrameHeader must not contain padding.");
+
+// Writes frames to a recording on a background thread, so the capture loop only pays for copying the frame.
+// If the disk cannot keep up and the queue is full, new frames are dropped (and counted) instead of blocking the caller.
+class FrameRecorder {
+private:
+  struct PendingFrame {
+    uint64_t sequence;
+    std::chrono::steady_clock::time_point captureTime;
+    cv::Mat image;
+  };
+
+  std::ofstream file;
+  std::deque<PendingFrame> queue;
+  size_t capacity;
+  bool closed = false;
+  uint64_t droppedCount = 0;
+  uint64_t writtenCount = 0;
+
+  std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::thread writerThread;
+
+  void writerLoop();
+
+public:
+  FrameRecorder(const std::string& path, const CameraCalibration* calibration = nullptr, size_t capacity = DEFAULT_RECORDING_QUEUE_SIZE);
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder&) = delete;
+  FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+  bool isOpen() const {
+    return file.is_open();
+  }
+
+  // Queue a copy of the frame for writing. Return false if it was dropped because the queue is full.
+  bool record(uint64_t sequence, std::chrono::steady_clock::time_point captureTime, const cv::Mat& image);
+
+  // Write all queued frames and close the file.
+  void close();
+
+  uint64_t dropped();
+  uint64_t written();
+};
+
+// Passes frames through from another source and records every one of them.
+class RecordingSource : public FrameSource {
+private:
+  FrameSource& source;
+  FrameRecorder& recorder;
+  uint64_t sequence = 0;
+
+public:
+  RecordingSource(FrameSource& source, FrameRecorder& recorder) : source(source), recorder(recorder) {}
+
+  bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) override;
+
+  cv::Size getFrameSize() override {
+    return source.getFrameSize();
+  }
+
+  cv::Mat getEncodedFrame() override {
+    return source.getEncodedFrame();
+  }
+};
+
+// Plays back a recording. The capture times are shifted to the time of the first read, but the intervals between them
+// are exactly the recorded ones, so everything that depends on the timing (e.g. the pose filter) behaves the same in every replay.
+// In real time mode, read() also waits until the frame is due, otherwise frames are returned as fast as possible.
+class ReplaySource : public FrameSource {
+private:
+  std::ifstream file;
+  bool realTime;
+  bool hasCalibration = false;
+  CameraCalibration calibration;
+  cv::Size frameSize;
+
+  bool started = false;
+  int64_t firstTimestampNs = 0;
+  std::chrono::steady_clock::time_point startTime;
+
+public:
+  ReplaySource(const std::string& path, bool realTime = true);
+
+  bool isOpen() const {
+    return file.is_open();
+  }
+
+  bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) override;
+
+  cv::Size getFrameSize() override {
+    return frameSize;
+  }
+
+  // The calibration that was active while recording, if it was stored.
+  bool getCalibration(CameraCalibration& calibration) const {
+    if (hasCalibration) {
+      calibration = this->calibration;
+    }
+
+    return hasCalibration;
+  }
+};
+
+// Return true if path names a recording, judging by the extension.
+inline bool isRecording(const std::string& path) {
+  return path.ends_with(RECORDING_EXTENSION);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+// Anything frames can be read from: a camera or stream through cv::VideoCapture, or a recording.
+class FrameSource {
+public:
+  virtual ~FrameSource() = default;
+
+  // Read the next frame into image and set captureTime to the time it was captured.
+  // Return false if there are no more frames, or the frame could not be read.
+  virtual bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) = 0;
+
+  // Resolution of the frames, or an empty size if it is not known before reading the first frame.
+  virtual cv::Size getFrameSize() = 0;
+
+  // Compressed data of the frame returned by the last read(), for sources that receive compressed frames
+  // and only decode what detection needs. A color image for display can then be decoded from it later, and only if it is needed.
+  // Must be called from the thread that called read(). Empty if the source has no compressed data.
+  virtual cv::Mat getEncodedFrame() {
+    return cv::Mat();
+  }
+};
+
+// A FrameSource that reads from a cv::VideoCapture owned by the caller.
+class VideoCaptureSource : public FrameSource {
+private:
+  cv::VideoCapture& capture;
+
+public:
+  VideoCaptureSource(cv::VideoCapture& capture) : capture(capture) {}
+
+  bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) override {
+    bool success = capture.read(image) && !image.empty();
+    captureTime = std::chrono::steady_clock::now();
+
+    return success;
+  }
+
+  cv::Size getFrameSize() override {
+    return cv::Size((int)capture.get(cv::CAP_PROP_FRAME_WIDTH), (int)capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+  }
+};
+
+// Wraps a source that only knows its resolution once a frame arrived, as many cv::VideoCapture backends and MJPEG streams.
+// getFrameSize() reads the first frame if needed, and the next read() returns that frame.
+class FirstFrameSource : public FrameSource {
+private:
+  std::unique_ptr<FrameSource> source;
+  cv::Mat firstImage;
+  cv::Mat firstEncoded;
+  std::chrono::steady_clock::time_point firstCaptureTime;
+  bool firstRead = false;
+  bool firstPending = false;
+  bool firstReturned = false;
+
+  void readFirst() {
+    if (!firstRead) {
+      firstRead = true;
+      firstPending = source->read(firstImage, firstCaptureTime);
+      // The source may reuse its buffer for the next frame, which would change what getEncodedFrame() returns for this one.
+      firstEncoded = source->getEncodedFrame().clone();
+    }
+  }
+
+public:
+  FirstFrameSource(std::unique_ptr<FrameSource> source) : source(std::move(source)) {}
+
+  bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) override {
+    if (firstPending) {
+      firstPending = false;
+      firstReturned = true;
+      image = firstImage;
+      captureTime = firstCaptureTime;
+      return true;
+    }
+
+    firstRead = true;
+    firstReturned = false;
+    return source->read(image, captureTime);
+  }
+
+  cv::Size getFrameSize() override {
+    cv::Size size = source->getFrameSize();
+    if (size.area() > 0) {
+      return size;
+    }
+
+    readFirst();
+    return firstImage.size();
+  }
+
+  cv::Mat getEncodedFrame() override {
+    return firstReturned ? firstEncoded : source->getEncodedFrame();
+  }
+};
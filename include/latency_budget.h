@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/aruco.hpp>
+
+// Frames to wait after changing the detection settings before judging them, so the averages reflect the new settings.
+#define LATENCY_BUDGET_SETTLE_FRAMES 10
+// Go back to a better quality level once the average processing time is below this fraction of the budget.
+#define LATENCY_BUDGET_HEADROOM 0.6
+// Weight of the newest frame in the moving averages.
+#define LATENCY_BUDGET_SMOOTHING 0.2
+// A cheaper level that finds this many markers less on average than the level before it is considered to lose markers.
+#define LATENCY_BUDGET_MARKER_LOSS 0.5
+// After a cheaper level lost markers, stay at the better level for this many frames unless the budget is exceeded by far.
+// The same number of frames is waited before stepping up again, when the last attempt to step up exceeded the budget.
+#define LATENCY_BUDGET_HOLD_FRAMES 300
+#define LATENCY_BUDGET_HARD_OVERRUN 1.5
+
+// Settings of one step on the quality ladder of LatencyBudgetController.
+struct DetectionQuality {
+  int adaptiveThreshWinSizeMin;
+  int adaptiveThreshWinSizeMax;
+  int adaptiveThreshWinSizeStep;
+  double minMarkerPerimeterRate;
+  int cornerRefinementMethod;
+  int detectionScale;
+
+  bool operator==(const DetectionQuality& other) const = default;
+};
+
+struct LatencyBudgetStats {
+  uint64_t levelChanges = 0;
+  // Number of times a cheaper level was left again because it lost markers.
+  uint64_t markerLossReverts = 0;
+  // Average detection and pose estimation time, and number of markers, at the current level.
+  double averageMs = 0;
+  double averageMarkers = 0;
+};
+
+// Picks detector settings that keep the time for detection and pose estimation of a frame within a budget.
+// The settings go from the best quality (corner refinement, all threshold window sizes) down to the cheapest
+// (a single threshold window size, only large markers, detection on a downscaled image). When the measured time goes over budget,
+// the controller steps down the ladder, and when there is enough headroom it steps back up.
+// If a cheaper level finds fewer markers than the one before it, the controller goes back up and stays there for a while.
+class LatencyBudgetController {
+private:
+  double budgetMs;
+  std::vector<DetectionQuality> levels;
+  size_t level;
+
+  int framesAtLevel = 0;
+  int holdFrames = 0;
+  // Set after stepping up because of headroom. If that level turns out to be over budget right away, stepping up is paused.
+  bool steppedUp = false;
+  int upgradeHoldFrames = 0;
+  // Average number of markers at the better level, before stepping down to the current one. Negative if the last step was up.
+  double referenceMarkers = -1;
+  LatencyBudgetStats stats;
+
+  void setLevel(size_t newLevel);
+  // Append quality to the ladder, unless it is the same as the cheapest level so far.
+  void addCheaperLevel(const DetectionQuality& quality);
+
+public:
+  // base and baseDetectionScale are the configured settings, which is where the controller starts.
+  LatencyBudgetController(double budgetMs, const cv::aruco::DetectorParameters& base, int baseDetectionScale);
+
+  // Feed the measured time and the number of detected markers of a frame. Return true if the settings changed.
+  bool update(double processingMs, size_t markerCount);
+
+  const DetectionQuality& getQuality() const {
+    return levels[level];
+  }
+
+  // Copy the settings of the current level into params.
+  void apply(cv::aruco::DetectorParameters& params) const;
+
+  // 0 is the best quality.
+  size_t getLevel() const {
+    return level;
+  }
+
+  size_t getLevelCount() const {
+    return levels.size();
+  }
+
+  const LatencyBudgetStats& getStats() const {
+    return stats;
+  }
+};
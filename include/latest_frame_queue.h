@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Bounded queue that only ever holds the newest items.
+// Pushing into a full queue discards the oldest item instead of blocking the producer,
+// so a slow consumer always gets the freshest frame rather than working through a backlog.
+template <typename T> class LatestFrameQueue {
+private:
+  std::deque<T> items;
+  size_t capacity = 1;
+  bool closed = false;
+  uint64_t droppedCount = 0;
+  uint64_t pushedCount = 0;
+
+  mutable std::mutex mutex;
+  std::condition_variable notEmpty;
+
+public:
+  LatestFrameQueue(size_t capacity = 1) : capacity(capacity > 0 ? capacity : 1) {}
+
+  // Return false if the queue was already closed and the item was not accepted.
+  bool push(T item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      if (closed) {
+        return false;
+      }
+
+      while (items.size() >= capacity) {
+        items.pop_front();
+        droppedCount++;
+      }
+
+      items.push_back(std::move(item));
+      pushedCount++;
+    }
+
+    notEmpty.notify_one();
+
+    return true;
+  }
+
+  // Block until an item is available.
+  // Return false once the queue is closed and there is nothing left to hand out.
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+
+    if (items.empty()) {
+      return false;
+    }
+
+    item = std::move(items.front());
+    items.pop_front();
+
+    return true;
+  }
+
+  // Non-blocking variant of pop(). Return false if there is no item available right now.
+  bool tryPop(T& item) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (items.empty()) {
+      return false;
+    }
+
+    item = std::move(items.front());
+    items.pop_front();
+
+    return true;
+  }
+
+  // Wake up all waiting consumers. Items that are still queued can be popped, new ones are rejected.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+
+    notEmpty.notify_all();
+  }
+
+  bool isClosed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+  }
+
+  uint64_t dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedCount;
+  }
+
+  uint64_t pushed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pushedCount;
+  }
+};
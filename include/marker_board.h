@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Several markers rigidly mounted on one object, with the positions of all their corners known.
+struct MarkerBoard {
+  std::string name;
+  // Reported in the pose outputs in place of a marker ID, so it must not be a marker ID of the dictionary.
+  int id = 0;
+  std::vector<int> markerIds;
+  // Four corners per marker in board coordinates (meters), in the order the detector reports them:
+  // top left, top right, bottom right, bottom left of the marker.
+  std::vector<std::array<cv::Point3f, 4> > markerCorners;
+  // Length of the axes drawn for the board, half of its largest extent.
+  float axisLength = 0.1f;
+};
+
+// Pose of the board coordinate system in camera coordinates.
+struct BoardPose {
+  int boardId;
+  // Number of markers of the board the pose was computed from.
+  int markerCount;
+  cv::Vec3d rvec;
+  cv::Vec3d tvec;
+  // RMS distance between the projected and the detected corners, in pixels.
+  double reprojectionError;
+};
+
+// Read the boards from a cv::FileStorage file (YAML, XML or JSON), which looks like this in YAML:
+//
+//   boards:
+//     - name: cube
+//       id: 1000
+//       markers:
+//         - { id: 3, corners: [ -0.04, 0.04, 0.05,  0.04, 0.04, 0.05,  0.04, -0.04, 0.05,  -0.04, -0.04, 0.05 ] }
+//         - ...
+//
+// A marker ID may only belong to one board. Board IDs from 0 to dictionarySize - 1 are rejected, because the outputs could not
+// tell those boards from markers. Errors are printed to err. Return false if the file could not be read or is invalid.
+bool loadBoards(const std::filesystem::path& path, int dictionarySize, std::vector<MarkerBoard>& boards, std::ostream& err = std::cout);
+
+// Computes one pose per board and frame from the corners of all of its visible markers.
+// A single solve over all corners is better conditioned than the poses of the individual markers,
+// and still works with only some of the markers in view. Buffers are kept between calls.
+class BoardPoseSolver {
+private:
+  struct BoardPoints {
+    std::vector<cv::Point3f> objectPoints;
+    std::vector<cv::Point2f> imagePoints;
+    std::vector<cv::Point2f> projectedPoints;
+    // Markers already added in the current frame, so a marker ID detected twice is only used once.
+    std::vector<char> markerUsed;
+    int markerCount = 0;
+  };
+
+  std::vector<MarkerBoard> boards;
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+
+  // Board and marker index within the board of every marker ID that belongs to a board.
+  std::unordered_map<int, std::pair<size_t, size_t> > markerLookup;
+  std::vector<BoardPoints> points;
+
+public:
+  BoardPoseSolver(const std::vector<MarkerBoard>& boards, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs);
+
+  // Fill poses with one entry for every board that has at least one detected marker.
+  void solve(const std::vector<int>& markerIds, const std::vector<std::vector<cv::Point2f> >& markerCorners, std::vector<BoardPose>& poses);
+
+  const std::vector<MarkerBoard>& getBoards() const {
+    return boards;
+  }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+// Reads the ID of a marker candidate the same way cv::aruco::ArucoDetector does, but faster.
+//
+// The cells are sampled straight from the grayscale image through the perspective transform of the candidate,
+// without warping it into an intermediate image first. The inner bits are packed into one integer, which is
+// looked up in a hash table holding the codes of all markers in all four rotations. Only codes that are not an
+// exact match are compared against the dictionary, as an XOR and popcount over a flat array of codes whose
+// integer width is picked at compile time for the marker size (16 bits for 4x4, 32 bits for 5x5, 64 bits for 6x6 to 8x8).
+//
+// Accepts and rejects the same candidates with the same ID and rotation as the stock detector with the same parameters.
+// Buffers are kept between calls, so every thread needs its own instance.
+class MarkerIdentifier {
+private:
+  typedef bool (*SearchFunction)(const void* codes, size_t markerCount, uint64_t code, int maxDistance, int& id, int& rotation);
+
+  int markerSize;
+  int markerCount;
+  // Bits of the marker that may be wrong and still get corrected, see cv::aruco::Dictionary::identify.
+  int maxCorrectionBits;
+  cv::aruco::DetectorParameters params;
+
+  // Codes of all markers, four rotations per marker, in the integer type of the marker size.
+  std::vector<uint16_t> codes16;
+  std::vector<uint32_t> codes32;
+  std::vector<uint64_t> codes64;
+  const void* codes = nullptr;
+  SearchFunction search = nullptr;
+
+  // Code of every marker in every rotation, to 4 * id + rotation.
+  std::unordered_map<uint64_t, int> exactCodes;
+
+  // Sampled pixels of the candidate and the cells including the border, reused for every candidate.
+  std::vector<uchar> samples;
+  std::vector<uchar> cells;
+
+  // Number of border cells that are white.
+  int countBorderErrors(bool inverted) const;
+
+public:
+  MarkerIdentifier(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params);
+
+  // Identify the candidate with the four corners in gray (CV_8UC1). On success, set id and rotate corners,
+  // so that the first one is the top left corner of the marker, like the stock detector does.
+  bool identify(const cv::Mat& gray, std::vector<cv::Point2f>& corners, int& id);
+
+  // Sample the cells of the candidate. Return false if too many cells of its border are not black.
+  // Otherwise code holds the inner bits row by row, with the first bit as the most significant one.
+  bool extractCode(const cv::Mat& gray, const std::vector<cv::Point2f>& corners, uint64_t& code);
+
+  // Find the first marker that is within the correctable number of bits of code in any rotation.
+  bool lookup(uint64_t code, int& id, int& rotation) const;
+
+  // Unpack code into a markerSize x markerSize CV_8U matrix of 0 and 1, as cv::aruco::Dictionary::identify takes it.
+  void unpackCode(uint64_t code, cv::Mat& bits) const;
+
+  // False for markers with more than 64 bits, which can not be identified.
+  bool isSupported() const {
+    return search != nullptr;
+  }
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <tag-tracker.h>
+#include <candidate_detector.h>
+#include <latency_budget.h>
+#include <marker_board.h>
+#include <pose_filter.h>
+#include <square_pose_solver.h>
+#include <tiled_detector.h>
+
+#define DEFAULT_ROI_MARGIN 0.5
+#define DEFAULT_FULL_SCAN_INTERVAL 10
+#define DEFAULT_DETECTION_SCALE 1
+
+// All settings needed to build a MarkerTracker.
+// Kept separate from the tracker itself so that several independent trackers
+// (e.g. one per worker thread) can be created from the same settings.
+struct MarkerTrackerConfig {
+  cv::aruco::PredefinedDictionaryType dict = cv::aruco::DICT_6X6_250;
+  double markerLength = 0.1;
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+  cv::aruco::DetectorParameters detectorParams = cv::aruco::DetectorParameters();
+
+  // Only search for markers near the positions they had in the previous frame.
+  bool roiTracking = false;
+  // Margin added around the previous marker position on each side, relative to the marker size in pixels.
+  double roiMargin = DEFAULT_ROI_MARGIN;
+  // Scan the whole frame at least every fullScanInterval frames, to pick up markers that newly appeared.
+  int fullScanInterval = DEFAULT_FULL_SCAN_INTERVAL;
+
+  // Detect markers on a grayscale image downscaled by this factor (1, 2 or 4),
+  // then refine the corners on the full resolution image.
+  // Detection cost drops roughly with the square of the factor, but markers need
+  // to be at least about detectionScale times larger in the image to still be found.
+  int detectionScale = DEFAULT_DETECTION_SCALE;
+
+  // Filter the poses of every marker ID over time, see PoseFilter.
+  bool temporalFilter = false;
+  PoseFilterConfig filterConfig;
+
+  // Time in milliseconds that detection and pose estimation of a frame may take. 0 disables the budget.
+  // Otherwise the detector settings and detectionScale are adapted at runtime to stay within it, see LatencyBudgetController.
+  double latencyBudgetMs = 0;
+
+  // Rigid groups of markers, which get one pose per board from all of their visible corners (see BoardPoseSolver).
+  std::vector<MarkerBoard> boards;
+
+  // Find and identify marker candidates with CandidateDetector instead of the stock detector.
+  bool fastCandidates = false;
+
+  // Split large frames into overlapping tiles that this many threads search in parallel (see TiledDetector). 0 disables tiling.
+  int tileThreads = 0;
+  // Closest and farthest distance in meters at which markers are expected. They determine the overlap of the tiles and the marker sizes searched for.
+  double minMarkerDistance = DEFAULT_MIN_MARKER_DISTANCE;
+  double maxMarkerDistance = DEFAULT_MAX_MARKER_DISTANCE;
+};
+
+// Everything known about a single frame as it travels from capture to display.
+struct TrackedFrame {
+  // Index of the source the frame came from, when tracking several cameras. Sequence numbers count per camera.
+  int cameraId = 0;
+  uint64_t sequence = 0;
+  std::chrono::steady_clock::time_point captureTime;
+  cv::Mat image;
+  // Compressed frame, if the source delivers one (see FrameSource::getEncodedFrame()). image may then be a grayscale decode of it.
+  cv::Mat encodedImage;
+
+  std::vector<int> markerIds;
+  std::vector<std::vector<cv::Point2f> > markerCorners;
+  std::vector<std::vector<cv::Point2f> > rejectedCandidates;
+  SquarePoseBatch poses;
+  // One pose for every board with at least one detected marker.
+  std::vector<BoardPose> boardPoses;
+};
+
+class MarkerTracker {
+private:
+  MarkerTrackerConfig config;
+  cv::aruco::ArucoDetector detector;
+  SquarePoseSolver poseSolver;
+  PoseFilter poseFilter;
+  BoardPoseSolver boardSolver;
+
+  // Buffers for coarse-to-fine detection.
+  cv::Mat grayImage;
+  cv::Mat scaledImage;
+
+  // State for ROI tracking. Corners are in the coordinates of the (possibly downscaled) search image.
+  std::vector<std::vector<cv::Point2f> > previousCorners;
+  std::vector<int> previousIds;
+  std::vector<cv::Rect> searchRegions;
+  std::vector<int> roiIds;
+  std::vector<std::vector<cv::Point2f> > roiCorners, roiRejected;
+  int framesSinceFullScan = 0;
+  uint64_t fullScanCount = 0;
+  uint64_t roiScanCount = 0;
+
+  std::unique_ptr<LatencyBudgetController> budgetController;
+  // nullptr unless fastCandidates is set.
+  std::unique_ptr<CandidateDetector> candidateDetector;
+  // nullptr unless tileThreads is set. Uses its own detectors in place of the two above.
+  std::unique_ptr<TiledDetector> tiledDetector;
+
+  // Run the stock detector, the CandidateDetector or the TiledDetector on image.
+  void detectMarkers(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                     std::vector<std::vector<cv::Point2f> >& rejected);
+
+  // Switch the detector to the settings the budget controller picked.
+  void applyDetectionQuality();
+
+  // Detect markers only inside regions around the previous marker positions.
+  // Return false if a marker from the previous frame was not found again.
+  bool detectInRegions(const cv::Mat& searchImage, TrackedFrame& frame);
+  void updateSearchRegions(const cv::Size& imageSize);
+  // Store corners at list[index], reusing the vector already there if there is one.
+  static void appendCorners(std::vector<std::vector<cv::Point2f> >& list, size_t index, const std::vector<cv::Point2f>& corners);
+
+  // Return the image markers are searched in, which is either the frame itself, or a downscaled grayscale copy.
+  const cv::Mat& prepareSearchImage(const cv::Mat& image);
+
+  // Map corners found in the downscaled image to full resolution and refine them there.
+  void refineCorners(TrackedFrame& frame);
+
+public:
+  MarkerTracker(const MarkerTrackerConfig& config);
+
+  // Fill markerIds, markerCorners and rejectedCandidates of the frame.
+  void detect(TrackedFrame& frame);
+
+  // Fill the poses of the frame for every detected marker and every board.
+  void estimatePose(TrackedFrame& frame);
+
+  // Detect markers and estimate their pose. With a latency budget, this also adapts the detector settings for the next frame.
+  void process(TrackedFrame& frame);
+
+  // Draw marker outlines, pose axes and the marker position onto canvas.
+  // canvas is expected to be the frame the markers were detected in, resized by scale (e.g. 0.5 for a half size preview).
+  void drawOverlay(cv::Mat& canvas, const TrackedFrame& frame, double scale = 1.0) const;
+
+  const MarkerTrackerConfig& getConfig() const {
+    return config;
+  }
+
+  // Number of frames that were searched completely, and number of frames where only regions around known markers were searched.
+  uint64_t getFullScanCount() const {
+    return fullScanCount;
+  }
+
+  uint64_t getRoiScanCount() const {
+    return roiScanCount;
+  }
+
+  PoseFilter& getPoseFilter() {
+    return poseFilter;
+  }
+
+  // nullptr if no latency budget is set.
+  const LatencyBudgetController* getBudgetController() const {
+    return budgetController.get();
+  }
+
+  // nullptr if frames are not split into tiles.
+  const TiledDetector* getTiledDetector() const {
+    return tiledDetector.get();
+  }
+};
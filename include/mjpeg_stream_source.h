@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include <frame_source.h>
+
+#define DEFAULT_DECODE_SCALE 1
+#define MJPEG_READ_BUFFER_SIZE 65536
+// Parts without a Content-Length header that grow beyond this are treated as a broken stream.
+#define MJPEG_MAX_FRAME_SIZE (64 * 1024 * 1024)
+
+// Decode a JPEG to grayscale or BGR at 1/scale of its resolution (scale is 1, 2, 4 or 8).
+// The reduction happens in the DCT domain inside libjpeg, so a reduced decode is much cheaper than decoding and then resizing.
+// image is reused if it already has the right size and type. Return false if the data could not be decoded.
+bool decodeJpeg(const cv::Mat& encoded, int scale, bool grayscale, cv::Mat& image);
+
+// Reads an MJPEG stream (multipart/x-mixed-replace over HTTP, as sent by most IP cameras) without cv::VideoCapture.
+// Frames are decoded straight to grayscale, optionally at a reduced resolution, which is all that detection needs.
+// The JPEG data is kept with every frame (getEncodedFrame()), so a color image is only decoded for frames that are displayed.
+// Only plain http:// URLs without authentication are supported.
+class MjpegStreamSource : public FrameSource {
+private:
+  int socketFd = -1;
+  int scale;
+  std::string boundary;
+  // The boundary line as the server writes it, once the first one was seen.
+  std::string delimiter;
+  // Set when reading a part without Content-Length already consumed the boundary line of the next part.
+  bool delimiterConsumed = false;
+  std::vector<char> partBuffer;
+
+  std::vector<char> buffer;
+  size_t bufferStart = 0;
+  size_t bufferEnd = 0;
+
+  cv::Mat encoded;
+  cv::Size frameSize;
+
+  // The first frame is read when connecting to learn the resolution, and handed out by the first read().
+  bool havePendingFrame = false;
+  cv::Mat pendingImage;
+  std::chrono::steady_clock::time_point pendingCaptureTime;
+
+  bool fillBuffer();
+  bool readLine(std::string& line);
+  bool readBytes(char* out, size_t count);
+  // Read everything up to (not including) terminator into out, and consume the terminator.
+  bool readUntil(const std::string& terminator, std::vector<char>& out);
+
+  bool connectTo(const std::string& url);
+  // Read the next JPEG of the stream into encoded.
+  bool readPart();
+  bool readFrame(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime);
+
+public:
+  // scale - decode at 1/scale of the stream resolution. Must be 1, 2, 4 or 8.
+  MjpegStreamSource(const std::string& url, int scale = DEFAULT_DECODE_SCALE);
+  ~MjpegStreamSource();
+
+  MjpegStreamSource(const MjpegStreamSource&) = delete;
+  MjpegStreamSource& operator=(const MjpegStreamSource&) = delete;
+
+  bool isOpen() const {
+    return socketFd >= 0;
+  }
+
+  bool read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) override;
+
+  // Resolution of the decoded (possibly reduced) frames.
+  cv::Size getFrameSize() override {
+    return frameSize;
+  }
+
+  cv::Mat getEncodedFrame() override {
+    return encoded;
+  }
+};
+
+// Return true if scale is a factor the JPEG decoder can reduce by.
+inline bool isValidDecodeScale(int scale) {
+  return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <frame_pipeline.h>
+#include <frame_source.h>
+#include <marker_tracker.h>
+
+// Tracks markers in several video streams with one process.
+// Every camera has its own capture thread, tracker and small queue of pending frames (the oldest frame is dropped when it is full),
+// and a single pool of workerCount detection threads serves all cameras.
+// Workers take frames from the cameras round robin, and every camera has at most one frame in detection at a time,
+// so a busy camera can not starve the others, and the trackers see the frames of their camera in order.
+// Every camera also keeps its own latest results (the oldest result of the same camera is dropped when they are full),
+// which the consumer takes round robin as one stream tagged with TrackedFrame::cameraId,
+// so a fast camera can not push out the results of a slow one.
+class MultiCameraPipeline {
+private:
+  struct Camera {
+    std::unique_ptr<FrameSource> source;
+    std::unique_ptr<MarkerTracker> tracker;
+    std::thread captureThread;
+
+    // Guarded by the scheduler mutex.
+    std::deque<TrackedFrame> pending;
+    std::deque<TrackedFrame> results;
+    bool busy = false;
+    bool finished = false;
+    uint64_t captured = 0;
+    uint64_t dropped = 0;
+    uint64_t processed = 0;
+    uint64_t delivered = 0;
+  };
+
+  std::vector<std::unique_ptr<Camera> > cameras;
+  size_t queueSize;
+  int workerCount;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable resultAvailable;
+  size_t nextCamera = 0;
+  size_t nextResultCamera = 0;
+  // Set until start(), and again once all workers are done, so nextResult() does not wait for results that never come.
+  bool resultsClosed = true;
+
+  std::vector<std::thread> workerThreads;
+  std::atomic<bool> running = false;
+  std::atomic<int> activeWorkers = 0;
+
+  void captureLoop(int cameraId);
+  void workerLoop();
+
+  // Index of the next camera with a pending frame and no frame in detection, or -1. Must be called with the mutex held.
+  int findWork();
+  // Index of the next camera with a result waiting, or -1. Must be called with the mutex held.
+  int findResult();
+  // True once all cameras stopped capturing and all their frames were taken. Must be called with the mutex held.
+  bool allFinished() const;
+
+public:
+  MultiCameraPipeline(int workerCount, size_t queueSize = DEFAULT_PIPELINE_QUEUE_SIZE);
+  ~MultiCameraPipeline();
+
+  MultiCameraPipeline(const MultiCameraPipeline&) = delete;
+  MultiCameraPipeline& operator=(const MultiCameraPipeline&) = delete;
+
+  // Add a camera before start(). Return its ID, which is the index in the order the cameras were added.
+  int addCamera(std::unique_ptr<FrameSource> source, const MarkerTrackerConfig& config);
+
+  void start();
+
+  // Stop capturing and wait for all threads to finish.
+  void stop();
+
+  // Block until the next processed frame of any camera is available.
+  // Return false once all sources ran out of frames (or stop() was called) and all results were consumed.
+  // Must only be called from one thread.
+  bool nextResult(TrackedFrame& frame);
+
+  // The tracker of a camera. Only access its state after stop() was called.
+  MarkerTracker& getTracker(int cameraId) const {
+    return *cameras.at(cameraId)->tracker;
+  }
+
+  size_t getCameraCount() const {
+    return cameras.size();
+  }
+
+  // droppedBeforeRender also counts results that are still waiting for the consumer, so it is only exact after stop().
+  PipelineStats getStats(int cameraId);
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+#include <opencv2/opencv.hpp>
+
+#include <marker_tracker.h>
+
+// Frames per second at which the overlay is drawn and displayed. 0 draws every frame.
+#define DEFAULT_DISPLAY_RATE 30.0
+#define DEFAULT_PREVIEW_SCALE 1.0
+
+// Draws the overlay for display, independently of how fast frames are detected.
+// Only frames that are due at the display rate are drawn at all, and they are drawn into buffers that are reused
+// from frame to frame, optionally into a downscaled preview, so the cost of drawing does not grow with the camera frame rate.
+class OverlayRenderer {
+private:
+  std::chrono::steady_clock::duration interval;
+  std::chrono::steady_clock::time_point lastRender;
+  bool hasRendered = false;
+  double previewScale;
+  int decodeScale;
+
+  // Intermediate images, only used for compressed and grayscale frames.
+  cv::Mat colorImage;
+  cv::Mat grayPreview;
+  cv::Mat canvas;
+
+public:
+  // displayRate - maximum number of frames drawn per second, 0 for every frame.
+  // previewScale - size of the drawn image relative to the frame (at most 1).
+  // decodeScale - the scale compressed frames were decoded at for detection (see MjpegStreamSource), so the color image matches.
+  OverlayRenderer(double displayRate = DEFAULT_DISPLAY_RATE, double previewScale = DEFAULT_PREVIEW_SCALE, int decodeScale = 1);
+
+  // Return true if enough time passed since the last rendered frame that the next one should be drawn.
+  bool isDue(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+
+  // Draw frame and its overlay into the reused buffer and return it. The buffer is valid until the next call.
+  const cv::Mat& render(const MarkerTracker& tracker, const TrackedFrame& frame);
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <opencv2/opencv.hpp>
+
+#include <square_pose_solver.h>
+
+#define DEFAULT_TRACK_EXPIRY 5
+#define DEFAULT_REFINE_ITERATIONS 5
+#define DEFAULT_WARM_REFINE_ITERATIONS 2
+// Standard deviations used to set up the Kalman filters.
+// Acceleration noise in rad/s^2 and m/s^2, measurement noise in rad and m.
+#define DEFAULT_ROTATION_ACCELERATION_NOISE 10.0
+#define DEFAULT_TRANSLATION_ACCELERATION_NOISE 2.0
+#define DEFAULT_ROTATION_MEASUREMENT_NOISE 0.02
+#define DEFAULT_TRANSLATION_MEASUREMENT_NOISE 0.002
+
+struct PoseFilterConfig {
+  // Number of frames a marker may be missing before its track is dropped.
+  int trackExpiry = DEFAULT_TRACK_EXPIRY;
+  // Maximum number of Levenberg-Marquardt iterations when refining the closed-form pose of a new track.
+  // 0 disables the refinement, so only the closed-form solution is filtered.
+  int refineIterations = DEFAULT_REFINE_ITERATIONS;
+  // Maximum number of iterations when refining the pose of an existing track, starting from the prediction.
+  // 0 filters the closed-form solution instead.
+  int warmRefineIterations = DEFAULT_WARM_REFINE_ITERATIONS;
+  double rotationAccelerationNoise = DEFAULT_ROTATION_ACCELERATION_NOISE;
+  double translationAccelerationNoise = DEFAULT_TRANSLATION_ACCELERATION_NOISE;
+  double rotationMeasurementNoise = DEFAULT_ROTATION_MEASUREMENT_NOISE;
+  double translationMeasurementNoise = DEFAULT_TRANSLATION_MEASUREMENT_NOISE;
+};
+
+struct PoseFilterStats {
+  // Markers whose pose was refined starting from the prediction of an existing track,
+  // and markers that started a new track, and so had to start from the closed-form solution.
+  uint64_t warmStartedSolves = 0;
+  uint64_t coldSolves = 0;
+  // Total time spent refining poses.
+  double warmSolveSeconds = 0;
+  double coldSolveSeconds = 0;
+  // Number of times the prediction picked the other one of the two ambiguous closed-form solutions.
+  uint64_t ambiguityFlipsAvoided = 0;
+  // Warm-started refinements that ended up too far from the corners, and were refined from the closed-form solution again.
+  uint64_t warmStartFallbacks = 0;
+  // RMS of the second difference of the translation between consecutive frames (in meters), of the closed-form solution and after filtering.
+  // For markers moving at constant velocity this is pure jitter.
+  double rawJitter = 0;
+  double filteredJitter = 0;
+};
+
+// Keeps one constant velocity Kalman filter over the 6-DoF pose per marker ID.
+// The predicted pose is used to pick the right one of the two ambiguous square solutions
+// and as starting point for the iterative refinement, and the filtered pose replaces the measured one.
+class PoseFilter {
+private:
+  struct Track {
+    cv::KalmanFilter kalman;
+    std::chrono::steady_clock::time_point lastUpdate;
+    int missedFrames = 0;
+    bool updated = false;
+
+    // Last two raw and filtered translations, for the jitter statistics.
+    int history = 0;
+    cv::Vec3d raw[2];
+    cv::Vec3d filtered[2];
+  };
+
+  PoseFilterConfig config;
+  double markerLength;
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+  cv::Mat objPoints;
+  std::vector<cv::Point2f> projectedPoints;
+
+  std::map<int, Track> tracks;
+
+  PoseFilterStats stats;
+  uint64_t jitterSamples = 0;
+  double rawJitterSum = 0;
+  double filteredJitterSum = 0;
+
+  void initTrack(Track& track, const cv::Vec3d& rvec, const cv::Vec3d& tvec, std::chrono::steady_clock::time_point time);
+  void predictTrack(Track& track, double dt, cv::Vec3d& rvec, cv::Vec3d& tvec);
+  // noiseScale multiplies the measurement noise variances for this update.
+  void correctTrack(Track& track, const cv::Vec3d& rvec, const cv::Vec3d& tvec, double noiseScale, cv::Vec3d& filteredRvec, cv::Vec3d& filteredTvec);
+  // RMS distance in pixels between the corners and the projection of the marker at the pose.
+  double reprojectionError(const std::vector<cv::Point2f>& corners, const cv::Vec3d& rvec, const cv::Vec3d& tvec);
+  void recordJitter(Track& track, const cv::Vec3d& rawTvec, const cv::Vec3d& filteredTvec);
+
+public:
+  PoseFilter(double markerLength, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, const PoseFilterConfig& config = PoseFilterConfig());
+
+  // Update the tracks with the closed-form poses of one frame, and replace the best pose of every marker with the filtered one.
+  void update(const std::vector<int>& markerIds, const std::vector<std::vector<cv::Point2f> >& markerCorners,
+              std::chrono::steady_clock::time_point captureTime, SquarePoseBatch& poses);
+
+  size_t getTrackCount() const {
+    return tracks.size();
+  }
+
+  const PoseFilterStats& getStats();
+};
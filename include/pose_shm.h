@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Layout of the shared memory ring that tag-tracker publishes poses into (see pose_shm_publisher.h), and a reader for it.
+// This header does not depend on OpenCV, so consumers only need it and src/pose_shm_reader.cpp.
+//
+// The shared memory object starts with a PoseShmHeader, followed by slotCount PoseShmSlots.
+// Frame n (counting from 0) is written into slot n % slotCount. Every slot is guarded by a sequence lock:
+// its sequence is 2n+1 while frame n is written and 2n+2 once it is complete, so readers can copy a slot without any lock
+// and detect afterwards whether the publisher overwrote it in the meantime. Nothing ever blocks the publisher,
+// and a reader that falls more than slotCount frames behind loses the oldest frames instead.
+
+#define POSE_SHM_MAGIC 0x4d48535254474154ull // "TAGTRSHM"
+#define POSE_SHM_VERSION 1
+#define POSE_SHM_MAX_MARKERS 64
+#define DEFAULT_POSE_SHM_SLOTS 64
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The shared memory ring needs lock free 64 bit atomics.");
+
+struct PoseShmMarker {
+  int32_t id;
+  uint32_t reserved;
+  // Image coordinates of the four corners in pixels, x and y interleaved, in the order ArUco returns them.
+  float corners[8];
+  double rvec[3];
+  double tvec[3];
+};
+
+struct PoseShmFrame {
+  uint64_t sequence;
+  // Capture time in nanoseconds of the steady clock (CLOCK_MONOTONIC on Linux), as in PoseRecord.
+  int64_t timestampNs;
+  uint32_t cameraId;
+  // Number of valid entries in markers. Markers beyond POSE_SHM_MAX_MARKERS are not published.
+  uint32_t markerCount;
+  PoseShmMarker markers[POSE_SHM_MAX_MARKERS];
+};
+
+struct alignas(64) PoseShmSlot {
+  std::atomic<uint64_t> sequence;
+  PoseShmFrame frame;
+};
+
+struct alignas(64) PoseShmHeader {
+  // Written last when the publisher sets up the ring, so a reader never sees a half initialized header.
+  std::atomic<uint64_t> magic;
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t slotSize;
+  // Set when the publisher exits. The ring stays readable until the last reader unmaps it.
+  std::atomic<uint32_t> closed;
+  // Number of frames published so far.
+  alignas(64) std::atomic<uint64_t> writeIndex;
+};
+
+static_assert(sizeof(PoseShmMarker) == 88, "PoseShmMarker must not contain padding.");
+static_assert(sizeof(PoseShmFrame) == 24 + POSE_SHM_MAX_MARKERS * sizeof(PoseShmMarker), "PoseShmFrame must not contain padding.");
+
+inline size_t poseShmSize(uint32_t slotCount) {
+  return sizeof(PoseShmHeader) + (size_t)slotCount * sizeof(PoseShmSlot);
+}
+
+// Reads frames from the ring of a running publisher. Reading does not involve any system call,
+// it only copies the frame out of the mapped memory. Every reader keeps its own position, so any number of them can read at the same time.
+class PoseShmReader {
+private:
+  void* mapping = nullptr;
+  size_t mappingSize = 0;
+  const PoseShmHeader* header = nullptr;
+  const PoseShmSlot* slots = nullptr;
+
+  uint64_t nextIndex = 0;
+  uint64_t lostCount = 0;
+
+public:
+  // name - name of the shared memory object, as passed to the publisher (e.g. "/tag-tracker").
+  PoseShmReader(const std::string& name);
+  ~PoseShmReader();
+
+  PoseShmReader(const PoseShmReader&) = delete;
+  PoseShmReader& operator=(const PoseShmReader&) = delete;
+
+  bool isOpen() const {
+    return header != nullptr;
+  }
+
+  // True once the publisher exited. Frames that were already published can still be read.
+  bool isClosed() const {
+    return header->closed.load(std::memory_order_acquire) != 0;
+  }
+
+  // Copy the next frame into frame. Return false if no new frame has been published yet.
+  // If the reader fell so far behind that frames were overwritten, it skips to the oldest frame still in the ring.
+  bool tryRead(PoseShmFrame& frame);
+
+  // Wait until the next frame is published and copy it into frame. pollInterval 0 busy-waits, which has the lowest latency
+  // but keeps a core busy, otherwise the reader sleeps for pollInterval between checks.
+  // Return false if the publisher exited and all frames were read.
+  bool read(PoseShmFrame& frame, std::chrono::microseconds pollInterval = std::chrono::microseconds(0));
+
+  // Skip all frames that were published so far, so the next read returns the next new frame.
+  void skipToLatest();
+
+  // Number of frames that were overwritten before this reader got to them.
+  uint64_t lost() const {
+    return lostCount;
+  }
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <marker_tracker.h>
+#include <pose_shm.h>
+
+// Publishes the detections of every processed frame into a ring in POSIX shared memory (see pose_shm.h for the layout),
+// where any number of local processes can read them with PoseShmReader without any copy through the kernel.
+// Publishing never waits for the readers. Must only be used from one thread.
+class PoseShmPublisher {
+private:
+  std::string name;
+  void* mapping = nullptr;
+  size_t mappingSize = 0;
+  PoseShmHeader* header = nullptr;
+  PoseShmSlot* slots = nullptr;
+  uint64_t writeIndex = 0;
+
+public:
+  // name - name of the shared memory object, starting with a slash (e.g. "/tag-tracker"). An existing object of that name is replaced.
+  // slotCount - number of frames a reader may fall behind before it loses frames.
+  PoseShmPublisher(const std::string& name, uint32_t slotCount = DEFAULT_POSE_SHM_SLOTS);
+  // Mark the ring as closed and remove its name. Readers that still have it mapped can read the remaining frames.
+  ~PoseShmPublisher();
+
+  PoseShmPublisher(const PoseShmPublisher&) = delete;
+  PoseShmPublisher& operator=(const PoseShmPublisher&) = delete;
+
+  bool isOpen() const {
+    return header != nullptr;
+  }
+
+  void publish(const TrackedFrame& frame);
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+
+#include <marker_tracker.h>
+
+#define POSE_OUTPUT_STDOUT "-"
+
+enum class PoseOutputFormat {
+  CSV,
+  BINARY
+};
+
+// One record of the binary pose stream. Records are written back to back in host byte order,
+// one per detected marker and then one per board (with the board ID as markerId), without any header, so a consumer can simply read sizeof(PoseRecord) bytes at a time.
+// timestampNs is the capture time in nanoseconds of the steady clock (CLOCK_MONOTONIC on Linux).
+struct PoseRecord {
+  uint64_t sequence;
+  int64_t timestampNs;
+  int32_t markerId;
+  uint16_t cameraId; // Index of the source, 0 unless several cameras are tracked.
+  uint16_t markerCount; // Number of records of the same frame, markers and boards.
+  double rvec[3];
+  double tvec[3];
+};
+
+static_assert(sizeof(PoseRecord) == 72, "PoseRecord must not contain padding.");
+
+// Write the poses of every processed frame as CSV or binary records to a file or stdout.
+class PoseWriter {
+private:
+  PoseOutputFormat format;
+  std::ofstream file;
+  std::ostream* out = nullptr;
+
+  void writeCsv(const TrackedFrame& frame);
+  void writeCsvLine(const TrackedFrame& frame, int64_t timestampNs, int id, const cv::Vec3d& rvec, const cv::Vec3d& tvec);
+  void writeBinary(const TrackedFrame& frame);
+
+public:
+  // path - file to write to, or POSE_OUTPUT_STDOUT for the standard output.
+  PoseWriter(const std::string& path, PoseOutputFormat format = PoseOutputFormat::CSV);
+
+  bool isOpen() const {
+    return out != nullptr && out->good();
+  }
+
+  // Write one line (CSV) or record (binary) for every marker and every board of the frame, and flush once per frame.
+  void write(const TrackedFrame& frame);
+};
+
+// Parse "csv" or "binary". Return false if the string is neither.
+bool parsePoseOutputFormat(const std::string& str, PoseOutputFormat& format);
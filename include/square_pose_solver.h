@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Poses of all markers of one frame, stored as one array per quantity.
+// A planar square seen by a camera has up to two plausible poses (the marker can appear tilted towards or away from the camera),
+// so both are kept. The first solution is always the one with the lower reprojection error.
+struct SquarePoseBatch {
+  std::vector<cv::Vec3d> rvecs;
+  std::vector<cv::Vec3d> tvecs;
+  std::vector<double> reprojectionErrors;
+
+  std::vector<cv::Vec3d> altRvecs;
+  std::vector<cv::Vec3d> altTvecs;
+  std::vector<double> altReprojectionErrors;
+
+  void resize(size_t n) {
+    rvecs.resize(n);
+    tvecs.resize(n);
+    reprojectionErrors.resize(n);
+    altRvecs.resize(n);
+    altTvecs.resize(n);
+    altReprojectionErrors.resize(n);
+  }
+
+  size_t size() const {
+    return rvecs.size();
+  }
+};
+
+// Closed-form pose estimation for square markers (IPPE, Collins & Bartoli 2014).
+// All corners of a frame are undistorted in one call, then every marker is solved from its
+// homography without any iterations. Buffers are kept between calls, so once they have grown
+// to the number of markers in view, solving does not allocate anymore.
+class SquarePoseSolver {
+private:
+  double markerLength = 0.1;
+  cv::Mat cameraMatrix;
+  cv::Mat distCoeffs;
+  double focalLength = 1.0;
+
+  std::vector<cv::Point2f> imagePoints;
+  std::vector<cv::Point2f> normalizedPoints;
+
+public:
+  SquarePoseSolver(double markerLength, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs);
+
+  // corners - four corners per marker in the order used by the ArUco detector
+  //           (top left, top right, bottom right, bottom left of the marker).
+  // Return the number of markers for which a pose could be computed.
+  // Markers without a solution (e.g. degenerate corners) get a zero pose and an infinite reprojection error.
+  size_t solve(const std::vector<std::vector<cv::Point2f> >& corners, SquarePoseBatch& poses);
+};
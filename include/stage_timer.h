@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Change to 1 (or configure with -DSTAGE_TIMING=ON) to time every stage of the frame loop.
+// When disabled, the TIME_STAGE and STAGE_TIMING_* macros expand to nothing.
+#ifndef STAGE_TIMING
+#define STAGE_TIMING 0
+#endif
+
+// 4 buckets per power of two of microseconds, up to about 2 hours.
+#define LATENCY_HISTOGRAM_BUCKETS 128
+
+enum class TimedStage {
+  CAPTURE,
+  DETECT,
+  POSE,
+  DRAW,
+  DISPLAY,
+  OUTPUT,
+  COUNT
+};
+
+const char* timedStageName(TimedStage stage);
+
+// Plain copy of a LatencyHistogram, which can be merged and queried.
+struct LatencyHistogramSnapshot {
+  std::array<uint64_t, LATENCY_HISTOGRAM_BUCKETS> buckets = {};
+  uint64_t count = 0;
+  uint64_t totalMicroseconds = 0;
+  uint64_t maxMicroseconds = 0;
+
+  void merge(const LatencyHistogramSnapshot& other);
+
+  // Upper bound of the bucket containing the p-th percentile (0-100), in microseconds.
+  // Accurate to within 25% because of the bucket size.
+  uint64_t percentile(double p) const;
+
+  double mean() const {
+    return count > 0 ? (double)totalMicroseconds / count : 0;
+  }
+};
+
+// Latency histogram with fixed, logarithmically spaced buckets.
+// Only the owning thread may call record(), which needs neither locks nor atomic read-modify-write operations.
+// Other threads can take a snapshot() at any time.
+class LatencyHistogram {
+private:
+  std::array<std::atomic<uint64_t>, LATENCY_HISTOGRAM_BUCKETS> buckets = {};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> totalMicroseconds = 0;
+  std::atomic<uint64_t> maxMicroseconds = 0;
+
+  static void increment(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+public:
+  static int bucketIndex(uint64_t microseconds);
+  static uint64_t bucketUpperBound(int index);
+
+  void record(uint64_t microseconds) {
+    increment(buckets[bucketIndex(microseconds)], 1);
+    increment(count, 1);
+    increment(totalMicroseconds, microseconds);
+    if (microseconds > maxMicroseconds.load(std::memory_order_relaxed)) {
+      maxMicroseconds.store(microseconds, std::memory_order_relaxed);
+    }
+  }
+
+  LatencyHistogramSnapshot snapshot() const;
+};
+
+// Collects the histograms of all threads. Every thread gets its own set of histograms on first use,
+// which stays alive after the thread exits, so nothing recorded is lost.
+class StageTimingRegistry {
+private:
+  typedef std::array<LatencyHistogram, (size_t)TimedStage::COUNT> StageHistograms;
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<StageHistograms> > threads;
+  std::chrono::steady_clock::time_point lastSummary = std::chrono::steady_clock::now();
+
+  StageTimingRegistry() = default;
+
+public:
+  static StageTimingRegistry& instance();
+
+  // The histogram of the calling thread for the stage.
+  LatencyHistogram& local(TimedStage stage);
+
+  // Merged histograms of all threads.
+  std::array<LatencyHistogramSnapshot, (size_t)TimedStage::COUNT> snapshot();
+
+  // One line with the median and p99 of every stage that was recorded so far.
+  void printSummary(std::ostream& out);
+
+  // Like printSummary(), but only if at least interval passed since the last summary.
+  void printPeriodicSummary(std::ostream& out, std::chrono::steady_clock::duration interval);
+
+  // Count, mean, percentiles, maximum and the non-empty buckets of every stage.
+  void dump(std::ostream& out);
+};
+
+// Records the time from construction to destruction into the histogram of the calling thread.
+class ScopedStageTimer {
+private:
+  LatencyHistogram& histogram;
+  std::chrono::steady_clock::time_point start;
+
+public:
+  ScopedStageTimer(TimedStage stage) :
+    histogram(StageTimingRegistry::instance().local(stage)), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedStageTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    histogram.record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  }
+
+  ScopedStageTimer(const ScopedStageTimer&) = delete;
+  ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+};
+
+#if STAGE_TIMING
+#define STAGE_TIMER_CONCAT_(a, b) a##b
+#define STAGE_TIMER_CONCAT(a, b) STAGE_TIMER_CONCAT_(a, b)
+// Time the rest of the enclosing scope as the given TimedStage.
+#define TIME_STAGE(stage) ScopedStageTimer STAGE_TIMER_CONCAT(stageTimer, __LINE__)(TimedStage::stage)
+#define STAGE_TIMING_PERIODIC_SUMMARY(out, interval) StageTimingRegistry::instance().printPeriodicSummary(out, interval)
+#define STAGE_TIMING_DUMP(out) StageTimingRegistry::instance().dump(out)
+#else
+#define TIME_STAGE(stage)
+#define STAGE_TIMING_PERIODIC_SUMMARY(out, interval)
+#define STAGE_TIMING_DUMP(out)
+#endif // STAGE_TIMING
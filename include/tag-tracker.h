@@ -123,15 +123,3 @@ inline std::string dmat2str(cv::Mat m) {
 
   return str += "}";
 }
-
-inline bool saveCalibrationFile(std::filesystem::path cfName, std::string calibrationMatrixStr, std::string distortionCoefficientsStr) {
-  std::ofstream calFile(cfName);
-  calFile << calibrationMatrixStr << "\n" << distortionCoefficientsStr << std::endl;
-  calFile.close();
-
-  return true;
-}
-
-inline bool saveCalibrationFile(std::filesystem::path cfName, cv::Mat calibrationMatrix, cv::Mat distortionCoefficients) {
-  return saveCalibrationFile(cfName, dmat2str(calibrationMatrix), dmat2str(distortionCoefficients));
-}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/aruco.hpp>
+#include <opencv2/opencv.hpp>
+
+#include <candidate_detector.h>
+
+#define DEFAULT_MIN_MARKER_DISTANCE 0.5
+#define DEFAULT_MAX_MARKER_DISTANCE 10.0
+
+// Detects markers in large frames by splitting them into overlapping tiles, which are searched in parallel.
+//
+// The overlap is the size of the largest marker expected (at minDistance), so every marker lies completely inside at least one tile.
+// Tiles are at least twice as large as the overlap, and otherwise as small as needed for about two tiles per thread.
+// Within a tile, only markers between the smallest (at maxDistance) and the largest expected size are searched for.
+// Every thread starts with its own block of neighboring tiles and steals tiles from the end of the other blocks when it runs out.
+// A marker found in several tiles is only reported once, from the tile where it is farthest away from the tile edges.
+// Frames that fit into a single tile are searched on the calling thread as they are.
+class TiledDetector {
+private:
+  // Detectors of one thread. Thread 0 is the one calling detectMarkers().
+  struct Worker {
+    std::unique_ptr<cv::aruco::ArucoDetector> detector;
+    std::unique_ptr<CandidateDetector> candidateDetector;
+    // Tiles left for this thread, with the first one in the low and the end in the high 32 bits.
+    std::atomic<uint64_t> tiles = 0;
+
+    void detect(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                std::vector<std::vector<cv::Point2f> >& rejected);
+  };
+
+  struct TileResult {
+    std::vector<int> ids;
+    std::vector<std::vector<cv::Point2f> > corners;
+    std::vector<std::vector<cv::Point2f> > rejected;
+  };
+
+  cv::aruco::DetectorParameters params;
+  double markerLength;
+  double minDistance;
+  double maxDistance;
+
+  std::vector<std::unique_ptr<Worker> > workers;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+  uint64_t generation = 0;
+  int pendingThreads = 0;
+  bool stopping = false;
+
+  // Layout for the last image size and focal length.
+  cv::Size tiledSize;
+  double tiledFocalLength = 0;
+  std::vector<cv::Rect> tiles;
+  std::vector<TileResult> results;
+  const cv::Mat* currentImage = nullptr;
+  // Distance to the tile edges of every merged marker.
+  std::vector<double> edgeDistances;
+
+  void threadLoop(int workerIndex);
+  // Detect in tiles until there are none left, first the worker's own, then those of the others.
+  void runTiles(int workerIndex);
+  bool takeTile(int workerIndex, int& tile);
+  void updateTiles(const cv::Size& imageSize, double focalLength);
+  void mergeResults(const cv::Size& imageSize, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                    std::vector<std::vector<cv::Point2f> >& rejected);
+
+public:
+  // threadCount includes the thread calling detectMarkers(). fastCandidates uses CandidateDetector in the tiles instead of the stock detector.
+  TiledDetector(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params, bool fastCandidates,
+                double markerLength, double minDistance, double maxDistance, int threadCount);
+  ~TiledDetector();
+
+  TiledDetector(const TiledDetector&) = delete;
+  TiledDetector& operator=(const TiledDetector&) = delete;
+
+  void setDetectorParameters(const cv::aruco::DetectorParameters& params);
+
+  // Same outputs as cv::aruco::ArucoDetector::detectMarkers. focalLength is that of image, in pixels.
+  void detectMarkers(const cv::Mat& image, double focalLength, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                     std::vector<std::vector<cv::Point2f> >& rejected);
+
+  // Number of tiles the last frame was split into.
+  size_t getTileCount() const {
+    return tiles.size();
+  }
+};
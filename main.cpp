@@ -1,6 +1,9 @@
 #include <boost/program_options.hpp>
+#include <csignal>
 #include <iostream>
+#include <memory>
 #include <format>
+#include <thread>
 #include <string>
 #include <filesystem>
 #include <fstream>
@@ -9,20 +12,285 @@
 #include <opencv2/aruco.hpp>
 
 #include <tag-tracker.h>
+#include <allocation_counter.h>
+#include <calibration_file.h>
 #include <camera_calibration_helper.h>
+#include <frame_pipeline.h>
+#include <frame_recording.h>
+#include <frame_source.h>
+#include <marker_board.h>
+#include <marker_tracker.h>
+#include <mjpeg_stream_source.h>
+#include <multi_camera_pipeline.h>
+#include <overlay_renderer.h>
+#include <pose_shm_publisher.h>
+#include <pose_writer.h>
+#include <stage_timer.h>
+
+// Default calibration file names before the binary and before the versioned format. Still read if the default one does not exist.
+#define YAML_CALIBRATION_FILE "calibration.yml"
+#define LEGACY_CALIBRATION_FILE "calibration.txt"
 
 namespace po = boost::program_options;
 
+// Set from the signal handler in headless mode, where there is no window to catch a key press.
+volatile std::sig_atomic_t stopRequested = 0;
+
+void handleStopSignal(int) {
+  stopRequested = 1;
+}
+
+void printPipelineStats(const PipelineStats& stats, std::ostream& out) {
+  out << "Frames captured: " << stats.captured
+      << ", dropped before detection: " << stats.droppedBeforeDetection
+      << ", processed: " << stats.processed
+      << ", dropped before display: " << stats.droppedBeforeRender
+      << ", displayed: " << stats.delivered << std::endl;
+}
+
+void printTrackerStats(MarkerTracker& tracker, std::ostream& out) {
+  const MarkerTrackerConfig& config = tracker.getConfig();
+
+  if (config.roiTracking) {
+    out << "Full frame scans: " << tracker.getFullScanCount() << ", ROI scans: " << tracker.getRoiScanCount() << std::endl;
+  }
+
+  if (config.temporalFilter) {
+    const PoseFilterStats& stats = tracker.getPoseFilter().getStats();
+
+    out << "Pose refinements started from the prediction: " << stats.warmStartedSolves;
+    if (stats.warmStartedSolves > 0) {
+      out << " (" << 1e6 * stats.warmSolveSeconds / stats.warmStartedSolves << "us each)";
+    }
+    out << ", from the closed-form solution: " << stats.coldSolves;
+    if (stats.coldSolves > 0) {
+      out << " (" << 1e6 * stats.coldSolveSeconds / stats.coldSolves << "us each)";
+    }
+    out << ", ambiguous solutions corrected: " << stats.ambiguityFlipsAvoided << ", predictions too far off: " << stats.warmStartFallbacks << std::endl;
+
+    out << "Position jitter: " << 1000 * stats.rawJitter << "mm raw, " << 1000 * stats.filteredJitter << "mm filtered" << std::endl;
+  }
+
+  const LatencyBudgetController* budgetController = tracker.getBudgetController();
+  if (budgetController != nullptr) {
+    const LatencyBudgetStats& stats = budgetController->getStats();
+
+    out << "Latency budget level: " << budgetController->getLevel() << " of " << budgetController->getLevelCount() - 1
+        << " (detection scale " << config.detectionScale << ", " << stats.averageMs << "ms per frame)"
+        << ", level changes: " << stats.levelChanges << ", reverted for lost markers: " << stats.markerLossReverts << std::endl;
+  }
+
+  const TiledDetector* tiledDetector = tracker.getTiledDetector();
+  if (tiledDetector != nullptr) {
+    out << "Detection tiles: " << tiledDetector->getTileCount() << " on " << config.tileThreads << " threads" << std::endl;
+  }
+}
+
+// Written straight to std::cout, without building any strings, since this runs for every frame.
+void printFrameInfo(const TrackedFrame& frame, int verbosity) {
+  for (unsigned int i = 0; i < frame.markerCorners.size() && verbosity > 2; i++) {
+    std::cout << "Corners for marker id=" << frame.markerIds.at(i) << ":";
+    for (const cv::Point2f& corner : frame.markerCorners.at(i)) {
+      std::cout << " " << corner;
+    }
+    std::cout << std::endl;
+  }
+
+  if (verbosity > 0) {
+    char coordinates[128];
+
+    for (unsigned int i = 0; i < frame.poses.tvecs.size(); i++) {
+      const cv::Vec3d& tvec = frame.poses.tvecs.at(i);
+      auto end = std::format_to_n(coordinates, sizeof(coordinates), "{{{:f},{:f},{:f}}}", tvec[0], tvec[1], tvec[2]).out;
+
+      std::cout << "Coordinates {x,y,z} of marker id=" << frame.markerIds.at(i) << ": ";
+      std::cout.write(coordinates, end - coordinates);
+    }
+    for (const BoardPose& pose : frame.boardPoses) {
+      auto end = std::format_to_n(coordinates, sizeof(coordinates), "{{{:f},{:f},{:f}}}", pose.tvec[0], pose.tvec[1], pose.tvec[2]).out;
+
+      std::cout << "Coordinates {x,y,z} of board id=" << pose.boardId << " from " << pose.markerCount << " markers: ";
+      std::cout.write(coordinates, end - coordinates);
+    }
+    if (frame.poses.tvecs.size() > 0 || !frame.boardPoses.empty()) {
+      std::cout << std::endl;
+    }
+  }
+}
+
+// Whether a source is read with MjpegStreamSource when --mjpeg is set. Other sources still go through cv::VideoCapture.
+bool isMjpegSource(const std::string& source, bool mjpeg) {
+  return mjpeg && source.starts_with("http://");
+}
+
+// Track markers in several sources at once, with one capture thread per source and a shared pool of detection workers.
+// Every source uses the calibration from the file of the same index in calibrationFiles, the one stored in it if it is a recording,
+// or defaultCalibration otherwise. Return the exit code of the program.
+int runMultiCamera(const std::vector<std::string>& sources, const std::vector<std::string>& calibrationFiles,
+                   const CameraCalibration& defaultCalibration, const MarkerTrackerConfig& baseConfig,
+                   int workers, int queueSize, bool replayFast, bool mjpeg, int decodeScale, PoseWriter* poseWriter, PoseShmPublisher* shmPublisher, const OverlayRenderer& overlay, bool headless,
+                   int windowWidth, int windowHeight, int verbosity, std::ostream& infoStream) {
+  // The captures have to outlive the pipeline, which reads from them until it is stopped.
+  std::vector<std::unique_ptr<cv::VideoCapture> > captures;
+  MultiCameraPipeline pipeline(workers, queueSize);
+
+  for (size_t i = 0; i < sources.size(); i++) {
+    std::unique_ptr<FrameSource> frameSource;
+    CameraCalibration cameraCalibration = defaultCalibration;
+    bool calibrationFromFile = false;
+
+    if (i < calibrationFiles.size()) {
+      if (!loadCalibration(calibrationFiles[i], cameraCalibration)) {
+        return 1;
+      }
+      calibrationFromFile = true;
+    }
+
+    if (isRecording(sources[i])) {
+      auto replay = std::make_unique<ReplaySource>(sources[i], !replayFast);
+      if (!replay->isOpen()) {
+        std::cerr << "Error: Could not open recording " << sources[i] << "." << std::endl;
+        return -1;
+      }
+
+      if (!calibrationFromFile) {
+        replay->getCalibration(cameraCalibration);
+      }
+
+      frameSource = std::move(replay);
+    } else if (isMjpegSource(sources[i], mjpeg)) {
+      auto stream = std::make_unique<MjpegStreamSource>(sources[i], decodeScale);
+      if (!stream->isOpen()) {
+        return -1;
+      }
+
+      // The frames are decoded at a reduced resolution, which the calibration has to match.
+      scaleCalibration(cameraCalibration, 1.0 / decodeScale, 1.0 / decodeScale);
+      frameSource = std::move(stream);
+    } else {
+      auto cap = std::make_unique<cv::VideoCapture>(sources[i]);
+
+      if (!cap->isOpened()) {
+        std::cerr << "Error: Could not open IP camera at " << sources[i] << "." << std::endl;
+        return -1;
+      }
+
+      frameSource = std::make_unique<VideoCaptureSource>(*cap);
+      captures.push_back(std::move(cap));
+    }
+
+    // Many sources only know their resolution once the first frame arrived, which is then read here.
+    if (frameSource->getFrameSize().area() <= 0) {
+      frameSource = std::make_unique<FirstFrameSource>(std::move(frameSource));
+    }
+
+    if (!adaptCalibrationToResolution(cameraCalibration, frameSource->getFrameSize(), std::cerr)) {
+      return 1;
+    }
+
+    if (verbosity > 1) {
+      std::cout << "Camera " << i << " (" << sources[i] << ") camera matrix: " << dmat2str(cameraCalibration.cameraMatrix) << std::endl;
+      std::cout << "Camera " << i << " (" << sources[i] << ") distortion coefficients: " << dmat2str(cameraCalibration.distCoeffs) << std::endl;
+    }
+
+    MarkerTrackerConfig config = baseConfig;
+    config.cameraMatrix = cameraCalibration.cameraMatrix;
+    config.distCoeffs = cameraCalibration.distCoeffs;
+
+    pipeline.addCamera(std::move(frameSource), config);
+  }
+
+  std::vector<std::string> windowNames;
+  for (size_t i = 0; i < sources.size() && !headless; i++) {
+    windowNames.push_back(std::format("Marker Detect {}", i));
+    cv::namedWindow(windowNames.back(), cv::WINDOW_NORMAL);
+    cv::waitKey(100);
+    cv::resizeWindow(windowNames.back(), windowWidth, windowHeight);
+  }
+
+  // Every window is drawn at the display rate on its own.
+  std::vector<OverlayRenderer> overlays(sources.size(), overlay);
+  TrackedFrame frame;
+  auto lastStatsTime = std::chrono::steady_clock::now();
+
+  pipeline.start();
+
+  while (pipeline.nextResult(frame)) {
+    STAGE_TIMING_PERIODIC_SUMMARY(std::cerr, std::chrono::seconds(1));
+
+    if (verbosity > 1 && frame.captureTime - lastStatsTime >= std::chrono::seconds(1)) {
+      for (size_t i = 0; i < pipeline.getCameraCount(); i++) {
+        infoStream << "Camera " << i << ": ";
+        printPipelineStats(pipeline.getStats(i), infoStream);
+      }
+      lastStatsTime = frame.captureTime;
+    }
+
+    if (poseWriter) {
+      TIME_STAGE(OUTPUT);
+      poseWriter->write(frame);
+    }
+
+    if (shmPublisher) {
+      TIME_STAGE(OUTPUT);
+      shmPublisher->publish(frame);
+    }
+
+    if (headless) {
+      if (stopRequested) {
+        break;
+      }
+      continue;
+    }
+
+    printFrameInfo(frame, verbosity);
+
+    OverlayRenderer& cameraOverlay = overlays.at(frame.cameraId);
+    if (!cameraOverlay.isDue()) {
+      continue;
+    }
+
+    const cv::Mat* frameMarkers;
+    {
+      TIME_STAGE(DRAW);
+      frameMarkers = &cameraOverlay.render(pipeline.getTracker(frame.cameraId), frame);
+    }
+
+    TIME_STAGE(DISPLAY);
+    cv::imshow(windowNames.at(frame.cameraId), *frameMarkers);
+
+    // Wait for X milliseconds. If a key is pressed, break from the loop.
+    if (cv::waitKey(1) >= 0) {
+      break;
+    }
+  }
+
+  pipeline.stop();
+
+  for (size_t i = 0; i < pipeline.getCameraCount(); i++) {
+    infoStream << "Camera " << i << ": ";
+    printPipelineStats(pipeline.getStats(i), infoStream);
+
+    if (verbosity > 0) {
+      printTrackerStats(pipeline.getTracker(i), infoStream);
+    }
+  }
+
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   int verbosity = 0;
-  std::string videoSource = DEFAULT_VIDEO_SOURCE;
+  std::vector<std::string> videoSources = {DEFAULT_VIDEO_SOURCE};
+  std::vector<std::string> cameraCalibrationFiles;
   int windowWidth = 1920;
   int windowHeight = 1080;
   cv::aruco::PredefinedDictionaryType dict = cv::aruco::DICT_6X6_250;
   double markerLength = 0.1;
   std::vector<double> camMatrixArray = {3529.184800454334, 0, 2040.965768074567, 0, 3514.936017987171, 1126.105514215219, 0, 0, 1};
   std::vector<double> distCoeffsArray = {0.1111941981103543, -1.233444736852835, 0.0004572563505563506, 0.0004007139313956278, 5.054536061947804};
-  std::string calibrationFile = "calibration.txt";
+  std::string calibrationFile = DEFAULT_CALIBRATION_FILE;
+  cv::Size calibrationImageSize;
   bool useCalFileCamMat = true;
   bool useCalFileDistCoeffs = true;
 
@@ -33,12 +301,44 @@ int main(int argc, char *argv[]) {
   bool calibration = false;
   bool saveCalFile = false;
 
+  bool pipelined = false;
+  int pipelineWorkers = DEFAULT_PIPELINE_WORKERS;
+  int pipelineQueueSize = DEFAULT_PIPELINE_QUEUE_SIZE;
+
+  bool headless = false;
+  bool cornerCache = true;
+  std::string recordPath = "";
+  std::string shmOutput = "";
+  bool mjpeg = false;
+  int decodeScale = DEFAULT_DECODE_SCALE;
+  double displayRate = DEFAULT_DISPLAY_RATE;
+  double previewScale = DEFAULT_PREVIEW_SCALE;
+  double latencyBudget = 0;
+  int allocationCheckWarmup = -1;
+  std::vector<MarkerBoard> boards;
+  bool fastCandidates = false;
+  int tileThreads = 0;
+  double minMarkerDistance = DEFAULT_MIN_MARKER_DISTANCE;
+  double maxMarkerDistance = DEFAULT_MAX_MARKER_DISTANCE;
+  bool replayFast = false;
+  std::string poseOutput = POSE_OUTPUT_STDOUT;
+  PoseOutputFormat poseOutputFormat = PoseOutputFormat::CSV;
+
+  bool roiTracking = false;
+  double roiMargin = DEFAULT_ROI_MARGIN;
+  int fullScanInterval = DEFAULT_FULL_SCAN_INTERVAL;
+  int detectionScale = DEFAULT_DETECTION_SCALE;
+
+  bool temporalFilter = false;
+  PoseFilterConfig filterConfig;
+
   po::options_description desc("Available options", HELP_LINE_LENGTH, HELP_DESCRIPTION_LENGTH);
 
   desc.add_options()
     ("help,h", "Show this message.")
     ("verbose,v", po::value<int>()->default_value(0)->implicit_value(1), "Display additional information. Higher value gives additional output.")
-    ("source,s", po::value<std::string>()->default_value(videoSource), "Video stream source.")
+    ("source,s", po::value<std::vector<std::string> >()->multitoken()->default_value(videoSources, DEFAULT_VIDEO_SOURCE), "Video stream source. "
+                                                                                                                   "Several sources can be given to track markers in all of them with one shared pool of detection threads.")
     ("ww", po::value<int>()->default_value(windowWidth), "Width of the image display windows.")
     ("wh", po::value<int>()->default_value(windowHeight), "Height of the image display windows.")
     ("dict,d", po::value<int>()->default_value(dict), std::format("ArUco dictionary to expect. These are the possible options:\n{}", dictsString()).c_str())
@@ -57,6 +357,56 @@ int main(int argc, char *argv[]) {
     ("width,W", po::value<int>()->default_value(checkerboardWidth), "Number of inner corners horizontally (i.e. columns-1).")
     ("height,H", po::value<int>()->default_value(checkerboardHeight), "Number of inner corners vertically (i.e. rows-1).")
     ("ic", "Does interactive calibration before starting to track the markers. You will have to point the camera at the chessboard pattern from different positions. This overrides the cm and dc options.")
+    ("pipeline", "Run capture, detection and display on separate threads. Stale frames are dropped so that the newest frame is always processed.")
+    ("workers", po::value<int>()->default_value(pipelineWorkers), "Number of detection threads in pipeline mode.")
+    ("queue-size", po::value<int>()->default_value(pipelineQueueSize), "Number of frames buffered between the pipeline stages before old frames are dropped.")
+    ("headless", "Do not open a window and do not draw anything. Poses are written to the pose output instead, and the program stops on SIGINT/SIGTERM.")
+    ("output,o", po::value<std::string>()->default_value(poseOutput), "File to write the marker poses to. \"" POSE_OUTPUT_STDOUT "\" means stdout. Poses are always written in headless mode, otherwise only if this is set explicitly.")
+    ("output-format,f", po::value<std::string>()->default_value("csv"), "Format of the pose output. Either csv (one line per marker) or binary (one fixed size PoseRecord per marker, see pose_writer.h).")
+    ("roi-tracking", "Only search for markers close to where they were in the previous frame. The whole frame is still searched periodically and whenever a marker is lost.")
+    ("roi-margin", po::value<double>()->default_value(roiMargin), "Margin around the previous marker position that is searched in ROI tracking mode, relative to the size of the marker in the image.")
+    ("full-scan-interval", po::value<int>()->default_value(fullScanInterval), "In ROI tracking mode, search the whole frame every this many frames to find markers that newly came into view.")
+    ("detection-scale", po::value<int>()->default_value(detectionScale), "Detect markers on a grayscale image downscaled by this factor (1, 2 or 4) and refine the corners on the full resolution image. "
+                                                                            "Much faster on high resolution streams, as long as the markers are large enough in the image.")
+    ("filter", "Smooth the pose of every marker over time with a Kalman filter. The prediction is also used to resolve the pose ambiguity of square markers and as starting point for refining the pose. "
+               "Works best without --pipeline or with a single worker, because every worker keeps its own tracks.")
+    ("track-expiry", po::value<int>()->default_value(filterConfig.trackExpiry), "Number of frames a marker may be missing before its filter is reset.")
+    ("refine-iterations", po::value<int>()->default_value(filterConfig.refineIterations), "Maximum number of iterations when refining the pose of a new marker with the filter enabled. 0 disables the refinement.")
+    ("warm-refine-iterations", po::value<int>()->default_value(filterConfig.warmRefineIterations), "Maximum number of iterations when refining the pose of a tracked marker, starting from the predicted pose. "
+                                                                                                  "0 filters the closed-form pose instead.")
+    ("record", po::value<std::string>()->default_value(recordPath), "Record every captured frame, its capture time and the active calibration to this file (uncompressed). "
+                                                                    "Use a file name ending in " RECORDING_EXTENSION " to be able to replay it with --source.")
+    ("replay-fast", "When replaying a recording (a --source ending in " RECORDING_EXTENSION "), return frames as fast as possible instead of with the recorded timing. "
+                    "The recorded capture times are still used for everything that depends on them.")
+    ("no-corner-cache", "Do not keep the detected checkerboard corners in a cache file next to the calibration images. By default only new or changed images are processed again.")
+    ("camera-calibration", po::value<std::vector<std::string> >()->multitoken(), "Calibration file of every source, in the same order as the sources. "
+                                                                                  "Sources without one use the calibration stored in the recording, or the one from the calibration-file, cm and dc options.")
+    ("shm-output", po::value<std::string>()->default_value(shmOutput)->implicit_value("/tag-tracker"), "Publish the detections of every frame into a ring buffer in POSIX shared memory with this name, "
+                                                                                                    "where local processes can read them without any system call (see pose_shm.h and tag-tracker-shm-consumer). "
+                                                                                                    "In headless mode the poses are then only written to the output if it is set explicitly.")
+    ("mjpeg", "Read http:// sources as MJPEG streams directly instead of through OpenCV's video capture. Frames are decoded straight to grayscale for detection, "
+              "and a color image is only decoded for the frames that are displayed.")
+    ("decode-scale", po::value<int>()->default_value(decodeScale), "With --mjpeg, decode frames at 1/scale of the stream resolution (1, 2, 4 or 8). "
+                                                                    "The JPEG decoder skips most of the work for reduced sizes, so this is much faster than --detection-scale, but the corners are also only found at the reduced resolution.")
+    ("display-rate", po::value<double>()->default_value(displayRate), "Maximum number of frames per second that are drawn and displayed. Frames in between are still tracked and written to the outputs. 0 displays every frame.")
+    ("preview-scale", po::value<double>()->default_value(previewScale), "Draw and display the frames downscaled by this factor (e.g. 0.5), which makes drawing cheaper for high resolution sources.")
+    ("latency-budget", po::value<double>(), "Time in milliseconds that detection and pose estimation of a frame may take. "
+                                            "The detector settings (corner refinement, threshold window sizes, minimum marker size and --detection-scale) are adapted at runtime to stay within it, "
+                                            "going back to better settings when there is headroom or when the cheaper ones lose markers.")
+    ("check-allocations", po::value<int>()->implicit_value(DEFAULT_ALLOCATION_CHECK_WARMUP), "Count the heap allocations of every frame after this many warm-up frames, and exit with an error if any frame allocated. "
+                                                                                              "Allocations inside OpenCV (capture, detection, drawing) are not counted. Expects a scene where the same markers stay in view. "
+                                                                                              "Only works with a single source without --pipeline, in builds configured with -DALLOCATION_COUNTING=ON.")
+    ("boards", po::value<std::string>(), "File with boards of rigidly mounted markers (board ID, marker IDs and the 3D positions of their corners, see marker_board.h). "
+                                         "Every board gets one pose per frame from all of its visible corners, which is written to the outputs with the board ID in place of a marker ID.")
+    ("fast-candidates", "Find marker candidates with thresholds computed from one integral image and a custom contour search, and identify them with a hash table, "
+                        "instead of with the OpenCV detector. Much faster on large frames, but may find slightly different markers. "
+                        "Compare both on your own frames with tag-tracker-bench --compare-candidates.")
+    ("tiles", po::value<int>()->implicit_value(std::max(1u, std::thread::hardware_concurrency())),
+              "Split large frames into overlapping tiles that this many threads (all cores by default) search for markers in parallel. "
+              "With several sources or --pipeline, the threads are divided among the trackers that run at the same time. "
+              "The tile overlap and the marker sizes searched for follow from --length, --min-distance and --max-distance.")
+    ("min-distance", po::value<double>(), std::format("Closest distance in meters at which markers are expected, for --tiles. (Default: {})", minMarkerDistance).c_str())
+    ("max-distance", po::value<double>(), std::format("Farthest distance in meters at which markers are expected, for --tiles. (Default: {})", maxMarkerDistance).c_str())
   ;
 
   po::variables_map vm;
@@ -72,6 +422,22 @@ int main(int argc, char *argv[]) {
     verbosity = vm["verbose"].as<int>();
   }
 
+  if (vm.count("source")) {
+    videoSources = vm["source"].as<std::vector<std::string> >();
+  }
+
+  std::string videoSource = videoSources.front();
+  bool multiCamera = videoSources.size() > 1;
+
+  if (vm.count("camera-calibration")) {
+    cameraCalibrationFiles = vm["camera-calibration"].as<std::vector<std::string> >();
+
+    if (cameraCalibrationFiles.size() > videoSources.size()) {
+      std::cout << "Got " << cameraCalibrationFiles.size() << " camera calibration files for " << videoSources.size() << " sources." << std::endl;
+      return 1;
+    }
+  }
+
   if (vm.count("ww")) {
     windowWidth = vm["ww"].as<int>();
   }
@@ -123,54 +489,40 @@ int main(int argc, char *argv[]) {
 
   // Attempt to read calibration file if it exists and either of the values from it are not set explicitly.
   std::filesystem::path cfp = std::filesystem::path(calibrationFile);
+  if (!multiCamera && !cameraCalibrationFiles.empty()) {
+    // With a single source, its own calibration file takes the place of the global one.
+    cfp = cameraCalibrationFiles.front();
+  } else if (vm["calibration-file"].defaulted() && !std::filesystem::exists(cfp)) {
+    // Fall back to the file names used before the binary format became the default.
+    for (const char* fallback : {YAML_CALIBRATION_FILE, LEGACY_CALIBRATION_FILE}) {
+      if (std::filesystem::exists(fallback)) {
+        cfp = fallback;
+        break;
+      }
+    }
+  }
+
   if (std::filesystem::exists(cfp) && (useCalFileCamMat || useCalFileDistCoeffs)) {
-    bool dataValid = true;
+    CameraCalibration fileCalibration;
 
-    std::ifstream cfs(cfp);
-    if (!cfs.is_open()) {
-      std::cout << "Could not open calibration file. Using default values for parameters not explicitly set." << std::endl;
+    if (!loadCalibration(cfp, fileCalibration)) {
+      std::cout << "Using default values for parameters not explicitly set." << std::endl;
     } else {
-      std::vector<double> calVals[2];
-
-      std::string line;
-      for (int i = 0; i < 2 && dataValid; i++) {
-        if (!std::getline(cfs, line)) {
-          std::cout << "Incorrect file format for the calibration file. Using default values for parameters not explicitly set." << std::endl;
-          dataValid = false;
-          break;
-        }
-
-        // Remove the {} brackets.
-        line = line.substr(1, line.length()-2);
-        // Read all values of a line as doubles.
-        std::istringstream lineStream(line);
-        std::string stringNum;
-        while (std::getline(lineStream, stringNum, ',')) {
-          double num;
-
-          try {
-            num = std::stod(stringNum);
-          } catch(const std::exception&) {
-            std::cout << "Incorrect number format in the calibration file. Using default values for parameters not explicitly set." << std::endl;
-            dataValid = false;
-            break;
-          }
-
-          calVals[i].push_back(num);
-        }
+      if (useCalFileCamMat) {
+        camMatrixArray.assign(fileCalibration.cameraMatrix.begin<double>(), fileCalibration.cameraMatrix.end<double>());
+        // The resolution only tells something about the camera matrix.
+        calibrationImageSize = fileCalibration.imageSize;
       }
 
-      if (dataValid) {
-        camMatrixArray = calVals[0];
-        distCoeffsArray = calVals[1];
-
-        if (verbosity > 2) {
-          std::cout << "Camera matrix from file: " << vec2str(camMatrixArray) << std::endl;
-          std::cout << "Distortion coefficients from file: " << vec2str(distCoeffsArray) << std::endl;
-        }
+      if (useCalFileDistCoeffs) {
+        distCoeffsArray.assign(fileCalibration.distCoeffs.begin<double>(), fileCalibration.distCoeffs.end<double>());
       }
 
-      cfs.close();
+      if (verbosity > 2) {
+        std::cout << "Camera matrix from file: " << vec2str(camMatrixArray) << std::endl;
+        std::cout << "Distortion coefficients from file: " << vec2str(distCoeffsArray) << std::endl;
+        std::cout << "Calibration resolution from file: " << fileCalibration.imageSize.width << "x" << fileCalibration.imageSize.height << std::endl;
+      }
     }
   }
 
@@ -194,125 +546,504 @@ int main(int argc, char *argv[]) {
     interactiveCalibration = true;
   }
 
-  cv::VideoCapture cap(videoSource);
+  if (vm.count("pipeline")) {
+    pipelined = true;
+  }
+
+  if (vm.count("workers")) {
+    pipelineWorkers = vm["workers"].as<int>();
+  }
+
+  if (vm.count("queue-size")) {
+    pipelineQueueSize = vm["queue-size"].as<int>();
+  }
+
+  if (vm.count("headless")) {
+    headless = true;
+  }
+
+  if (vm.count("output")) {
+    poseOutput = vm["output"].as<std::string>();
+  }
+
+  if (vm.count("output-format") && !parsePoseOutputFormat(vm["output-format"].as<std::string>(), poseOutputFormat)) {
+    std::cout << "Unknown output format " << vm["output-format"].as<std::string>() << ". Expected csv or binary." << std::endl;
+    return 1;
+  }
+
+  if (vm.count("roi-tracking")) {
+    roiTracking = true;
+  }
+
+  if (vm.count("roi-margin")) {
+    roiMargin = vm["roi-margin"].as<double>();
+  }
+
+  if (vm.count("full-scan-interval")) {
+    fullScanInterval = vm["full-scan-interval"].as<int>();
+  }
+
+  if (vm.count("detection-scale")) {
+    detectionScale = vm["detection-scale"].as<int>();
+
+    if (detectionScale != 1 && detectionScale != 2 && detectionScale != 4) {
+      std::cout << "Expected 1, 2 or 4 for the detection scale, but got " << detectionScale << "." << std::endl;
+      return 1;
+    }
+  }
 
-  if (!cap.isOpened()) {
-    std::cerr << "Error: Could not open IP camera at " << videoSource << "."
-              << std::endl;
-    return -1;
+  if (vm.count("filter")) {
+    temporalFilter = true;
+  }
+
+  if (vm.count("track-expiry")) {
+    filterConfig.trackExpiry = vm["track-expiry"].as<int>();
+  }
+
+  if (vm.count("refine-iterations")) {
+    filterConfig.refineIterations = vm["refine-iterations"].as<int>();
+  }
+
+  if (vm.count("warm-refine-iterations")) {
+    filterConfig.warmRefineIterations = vm["warm-refine-iterations"].as<int>();
+  }
+
+  if (vm.count("no-corner-cache")) {
+    cornerCache = false;
+  }
+
+  if (vm.count("record")) {
+    recordPath = vm["record"].as<std::string>();
+  }
+
+  if (vm.count("replay-fast")) {
+    replayFast = true;
+  }
+
+  if (vm.count("shm-output")) {
+    shmOutput = vm["shm-output"].as<std::string>();
+  }
+
+  if (vm.count("mjpeg")) {
+    mjpeg = true;
+  }
+
+  if (vm.count("display-rate")) {
+    displayRate = vm["display-rate"].as<double>();
+  }
+
+  if (vm.count("preview-scale")) {
+    previewScale = vm["preview-scale"].as<double>();
+
+    if (previewScale <= 0 || previewScale > 1) {
+      std::cout << "Expected a preview scale greater than 0 and at most 1, but got " << previewScale << "." << std::endl;
+      return 1;
+    }
+  }
+
+  if (vm.count("latency-budget")) {
+    latencyBudget = vm["latency-budget"].as<double>();
+
+    if (latencyBudget <= 0) {
+      std::cout << "Expected a latency budget greater than 0, but got " << latencyBudget << "." << std::endl;
+      return 1;
+    }
+  }
+
+  if (vm.count("check-allocations")) {
+    allocationCheckWarmup = vm["check-allocations"].as<int>();
+
+    if (!ALLOCATION_COUNTING) {
+      std::cout << "Counting allocations needs a build configured with -DALLOCATION_COUNTING=ON." << std::endl;
+      return 1;
+    }
+  }
+
+  if (vm.count("boards")) {
+    int dictionarySize = cv::aruco::getPredefinedDictionary(dict).bytesList.rows;
+    if (!loadBoards(vm["boards"].as<std::string>(), dictionarySize, boards)) {
+      return 1;
+    }
+  }
+
+  if (vm.count("fast-candidates")) {
+    fastCandidates = true;
+  }
+
+  if (vm.count("tiles")) {
+    tileThreads = vm["tiles"].as<int>();
+
+    if (tileThreads < 1) {
+      std::cout << "Expected at least 1 thread for the tiles, but got " << tileThreads << "." << std::endl;
+      return 1;
+    }
+  }
+
+  if (vm.count("min-distance")) {
+    minMarkerDistance = vm["min-distance"].as<double>();
+  }
+
+  if (vm.count("max-distance")) {
+    maxMarkerDistance = vm["max-distance"].as<double>();
+  }
+
+  if (minMarkerDistance <= 0 || maxMarkerDistance < minMarkerDistance) {
+    std::cout << "The marker distances must be positive, with --max-distance at least --min-distance." << std::endl;
+    return 1;
+  }
+
+  if (vm.count("decode-scale")) {
+    decodeScale = vm["decode-scale"].as<int>();
+
+    if (!isValidDecodeScale(decodeScale)) {
+      std::cout << "Expected 1, 2, 4 or 8 for the decode scale, but got " << decodeScale << "." << std::endl;
+      return 1;
+    }
+  }
+
+  if (multiCamera && (calibration || !recordPath.empty())) {
+    std::cout << "Calibration and recording only work with a single source." << std::endl;
+    return 1;
+  }
+
+  if (allocationCheckWarmup >= 0 && (multiCamera || pipelined)) {
+    std::cout << "Allocations can only be checked for a single source without --pipeline." << std::endl;
+    return 1;
+  }
+
+  // Several sources always run on a worker pool, which by default gets all cores.
+  if (multiCamera && vm["workers"].defaulted()) {
+    pipelineWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  if (headless && interactiveCalibration) {
+    std::cout << "Interactive calibration needs a display and can not be used in headless mode." << std::endl;
+    return 1;
+  }
+
+  cv::VideoCapture cap;
+  std::unique_ptr<FrameSource> frameSource;
+  ReplaySource* replaySource = nullptr;
+
+  if (multiCamera) {
+    // The sources are opened by runMultiCamera().
+  } else if (isRecording(videoSource)) {
+    if (interactiveCalibration) {
+      std::cout << "Interactive calibration needs a live camera and can not be used with a recording." << std::endl;
+      return 1;
+    }
+
+    auto replay = std::make_unique<ReplaySource>(videoSource, !replayFast);
+    if (!replay->isOpen()) {
+      std::cerr << "Error: Could not open recording " << videoSource << "." << std::endl;
+      return -1;
+    }
+
+    replaySource = replay.get();
+    frameSource = std::move(replay);
+  } else if (isMjpegSource(videoSource, mjpeg)) {
+    if (interactiveCalibration) {
+      std::cout << "Interactive calibration reads the camera through OpenCV and can not be used with --mjpeg." << std::endl;
+      return 1;
+    }
+
+    auto stream = std::make_unique<MjpegStreamSource>(videoSource, decodeScale);
+    if (!stream->isOpen()) {
+      return -1;
+    }
+
+    frameSource = std::move(stream);
+  } else {
+    cap.open(videoSource);
+
+    if (!cap.isOpened()) {
+      std::cerr << "Error: Could not open IP camera at " << videoSource << "."
+                << std::endl;
+      return -1;
+    }
+
+    frameSource = std::make_unique<VideoCaptureSource>(cap);
   }
 
   // Setting the camera calibration values to the values read from the file, or the parameters.
-  cv::Mat camMatrix = cv::Mat(3, 3, CV_64F, camMatrixArray.data());
-  cv::Mat distCoeffs = cv::Mat(1, 5, CV_64F, distCoeffsArray.data());
+  CameraCalibration cameraCalibration;
+  cameraCalibration.cameraMatrix = cv::Mat(3, 3, CV_64F, camMatrixArray.data()).clone();
+  cameraCalibration.distCoeffs = cv::Mat(1, distCoeffsArray.size(), CV_64F, distCoeffsArray.data()).clone();
+  cameraCalibration.imageSize = calibrationImageSize;
 
   if (calibration) {
     CameraCalibrationHelper cch(checkerboardWidth, checkerboardHeight);
+    // Only the calibration results are used here, so there is no need to keep the images around.
+    cch.setStreaming(true);
+    cch.setCornerCache(cornerCache);
 
     if (interactiveCalibration) {
-      cch.calibrateInteractively(cap, path);
+      if (cch.calibrateInteractively(cap, path) < 0) {
+        return 1;
+      }
     } else {
-      cch.calibrateWithImages(path);
+      int processedImgCount = cch.calibrateWithImages(path);
+
+      if (verbosity > 0) {
+        std::cout << "Calibrated with " << processedImgCount << " images, " << cch.getCornerCacheHits() << " of them from the corner cache." << std::endl;
+      }
     }
 
     // Setting camera calibration values to the ones just determined, overwriting the ones from the config file or program options.
-    camMatrix = cch.getCameraMatrix();
-    distCoeffs = cch.getDistortionCoefficients();
+    cameraCalibration = cch.getCalibration();
 
-    if (saveCalFile) {
-      saveCalibrationFile(calibrationFile, camMatrix, distCoeffs);
+    if (saveCalFile && !saveCalibration(calibrationFile, cameraCalibration)) {
+      std::cerr << "Error: Could not write calibration file " << calibrationFile << "." << std::endl;
+    }
+  } else if (replaySource && useCalFileCamMat && useCalFileDistCoeffs && replaySource->getCalibration(cameraCalibration)) {
+    // Replay with the calibration that was active while recording, unless another one was given explicitly.
+    if (verbosity > 0) {
+      std::cout << "Using the calibration stored in the recording." << std::endl;
     }
   }
 
+  // The frames are decoded at a reduced resolution, which the calibration has to match.
+  if (!multiCamera && isMjpegSource(videoSource, mjpeg)) {
+    scaleCalibration(cameraCalibration, 1.0 / decodeScale, 1.0 / decodeScale);
+  }
+
+  // Many sources only know their resolution once the first frame arrived, which is then read here.
+  if (!multiCamera && frameSource->getFrameSize().area() <= 0) {
+    frameSource = std::make_unique<FirstFrameSource>(std::move(frameSource));
+  }
+
+  // A calibration made at a different resolution gives wrong poses, so adapt it or stop.
+  if (!multiCamera && !adaptCalibrationToResolution(cameraCalibration, frameSource->getFrameSize(), std::cerr)) {
+    return 1;
+  }
+
+  std::unique_ptr<FrameRecorder> recorder;
+  std::unique_ptr<FrameSource> recordingSource;
+  FrameSource* source = frameSource.get();
+
+  if (!recordPath.empty()) {
+    recorder = std::make_unique<FrameRecorder>(recordPath, &cameraCalibration);
+
+    if (!recorder->isOpen()) {
+      std::cerr << "Error: Could not open recording output " << recordPath << "." << std::endl;
+      return -1;
+    }
+
+    recordingSource = std::make_unique<RecordingSource>(*source, *recorder);
+    source = recordingSource.get();
+  }
+
+  cv::Mat camMatrix = cameraCalibration.cameraMatrix;
+  cv::Mat distCoeffs = cameraCalibration.distCoeffs;
+
   if (verbosity > 1) {
-    std::cout << "Final camera matrix: " << vec2str(camMatrixArray) << std::endl;
-    std::cout << "Final distortion coefficients: " << vec2str(distCoeffsArray) << std::endl;
+    std::cout << "Final camera matrix: " << dmat2str(camMatrix) << std::endl;
+    std::cout << "Final distortion coefficients: " << dmat2str(distCoeffs) << std::endl;
   }
 
-  cv::namedWindow("Marker Detect", cv::WINDOW_NORMAL);
-  cv::waitKey(100);
-  cv::resizeWindow("Marker Detect", windowWidth, windowHeight);
+  if (!headless && !multiCamera) {
+    cv::namedWindow("Marker Detect", cv::WINDOW_NORMAL);
+    cv::waitKey(100);
+    cv::resizeWindow("Marker Detect", windowWidth, windowHeight);
+  } else if (headless) {
+    std::signal(SIGINT, handleStopSignal);
+    std::signal(SIGTERM, handleStopSignal);
+  }
+
+  std::unique_ptr<PoseWriter> poseWriter;
+  if ((headless && shmOutput.empty()) || !vm["output"].defaulted()) {
+    poseWriter = std::make_unique<PoseWriter>(poseOutput, poseOutputFormat);
+
+    if (!poseWriter->isOpen()) {
+      std::cerr << "Error: Could not open pose output " << poseOutput << "." << std::endl;
+      return -1;
+    }
+  }
 
-  cv::Mat frameRaw, frameMarkers;
+  std::unique_ptr<PoseShmPublisher> shmPublisher;
+  if (!shmOutput.empty()) {
+    shmPublisher = std::make_unique<PoseShmPublisher>(shmOutput);
 
-  // Vars for detection.
-  std::vector<int> markerIds = {};
-  std::vector<std::vector<cv::Point2f> > markerCorners, rejectedCandidates;
-  cv::aruco::DetectorParameters detectorParams = cv::aruco::DetectorParameters();
-  cv::aruco::Dictionary dictionary = cv::aruco::getPredefinedDictionary(dict);
-  cv::aruco::ArucoDetector detector(dictionary, detectorParams);
+    if (!shmPublisher->isOpen()) {
+      return -1;
+    }
+  }
 
-  cv::Mat objPoints(4, 1, CV_32FC3);
-  objPoints.ptr<cv::Vec3f>(0)[0] = cv::Vec3f(-markerLength/2.f, markerLength/2.f, 0);
-  objPoints.ptr<cv::Vec3f>(0)[1] = cv::Vec3f(markerLength/2.f, markerLength/2.f, 0);
-  objPoints.ptr<cv::Vec3f>(0)[2] = cv::Vec3f(markerLength/2.f, -markerLength/2.f, 0);
-  objPoints.ptr<cv::Vec3f>(0)[3] = cv::Vec3f(-markerLength/2.f, -markerLength/2.f, 0);
+  // Stats go to stderr when the poses are streamed to stdout, so they do not corrupt the stream.
+  std::ostream& infoStream = (poseWriter && poseOutput == POSE_OUTPUT_STDOUT) ? std::cerr : std::cout;
 
-  while (true) {
-    cap >> frameRaw;
+  MarkerTrackerConfig trackerConfig;
+  trackerConfig.dict = dict;
+  trackerConfig.markerLength = markerLength;
+  trackerConfig.cameraMatrix = camMatrix;
+  trackerConfig.distCoeffs = distCoeffs;
+  trackerConfig.roiTracking = roiTracking;
+  trackerConfig.roiMargin = roiMargin;
+  trackerConfig.fullScanInterval = fullScanInterval;
+  trackerConfig.detectionScale = detectionScale;
+  trackerConfig.temporalFilter = temporalFilter;
+  trackerConfig.latencyBudgetMs = latencyBudget;
+  trackerConfig.boards = boards;
+  trackerConfig.fastCandidates = fastCandidates;
+  // Every tracker that detects at the same time as others gets its share of the tile threads, so together they do not oversubscribe the cores.
+  int concurrentTrackers = multiCamera ? std::min<int>(pipelineWorkers, videoSources.size()) : pipelined ? pipelineWorkers : 1;
+  trackerConfig.tileThreads = tileThreads > 0 ? std::max(1, tileThreads / std::max(1, concurrentTrackers)) : 0;
+  trackerConfig.minMarkerDistance = minMarkerDistance;
+  trackerConfig.maxMarkerDistance = maxMarkerDistance;
+  trackerConfig.filterConfig = filterConfig;
 
-    if (frameRaw.empty()) {
-      std::cerr << "Error: Could not read frame." << std::endl;
-      break;
+  if (multiCamera) {
+    // All workers share the cores, so OpenCV's own threads would only oversubscribe them.
+    cv::setNumThreads(1);
+
+    int result = runMultiCamera(videoSources, cameraCalibrationFiles, cameraCalibration, trackerConfig, pipelineWorkers, pipelineQueueSize,
+                                replayFast, mjpeg, decodeScale, poseWriter.get(), shmPublisher.get(), OverlayRenderer(displayRate, previewScale, decodeScale), headless, windowWidth, windowHeight, verbosity, infoStream);
+
+    STAGE_TIMING_DUMP(std::cerr);
+
+    if (!headless) {
+      cv::destroyAllWindows();
     }
 
-    // Detect markers and draw them on the output frame.
-    detector.detectMarkers(frameRaw, markerCorners, markerIds, rejectedCandidates);
-    frameMarkers = frameRaw.clone();
-    cv::aruco::drawDetectedMarkers(frameMarkers, markerCorners, markerIds);
+    return result;
+  }
+
+  OverlayRenderer overlay(displayRate, previewScale, decodeScale);
+  TrackedFrame frame;
 
-    for (unsigned int i = 0; i < markerCorners.size() && verbosity > 2; i++) {
-      std::cout << "Corners for marker id=" << markerIds.at(i) << ":\n" << markerCorners.at(i) << std::endl;
+  // Output a processed frame. Return false if the user asked to stop.
+  auto consumeFrame = [&](const MarkerTracker& tracker) {
+    STAGE_TIMING_PERIODIC_SUMMARY(std::cerr, std::chrono::seconds(1));
+
+    if (poseWriter) {
+      TIME_STAGE(OUTPUT);
+      poseWriter->write(frame);
     }
 
-    // Estimate pose.
-    size_t nMarkers = markerCorners.size();
-    std::vector<cv::Vec3d> rvecs(nMarkers), tvecs(nMarkers);
-    if(!markerIds.empty()) {
-      for (size_t i = 0; i < nMarkers; i++) {
-        solvePnP(objPoints, markerCorners.at(i), camMatrix, distCoeffs, rvecs.at(i), tvecs.at(i));
-      }
+    if (shmPublisher) {
+      TIME_STAGE(OUTPUT);
+      shmPublisher->publish(frame);
     }
 
-    // Draw pose estimation axes to the frame.
-    for(unsigned int i = 0; i < nMarkers; i++) {
-      cv::drawFrameAxes(frameMarkers, camMatrix, distCoeffs, rvecs[i], tvecs[i], markerLength * 0.7f, 2);
+    if (headless) {
+      return !stopRequested;
     }
 
-    // Write marker position under the marker.
-    for (unsigned int i = 0; i < nMarkers; i++) {
-      // Bottom left corner of the marker.
-      cv::Point2f textStart = markerCorners.at(i).at(3);
-      // Text reference point is bottom left, and we want it to be top left, so offset origin by font height.
-      textStart.y += TEXT_SCALE * FONT_HEIGHT;
+    printFrameInfo(frame, verbosity);
 
-      cv::putText(frameMarkers, "X: " + std::to_string(tvecs.at(i)[0]), textStart, cv::FONT_HERSHEY_SIMPLEX, TEXT_SCALE, RED, TEXT_LINE_THICKNESS, cv::LINE_AA);
-      textStart.y += TEXT_SCALE * FONT_HEIGHT;
-      cv::putText(frameMarkers, "Y: " + std::to_string(tvecs.at(i)[1]), textStart, cv::FONT_HERSHEY_SIMPLEX, TEXT_SCALE, GREEN, TEXT_LINE_THICKNESS, cv::LINE_AA);
-      textStart.y += TEXT_SCALE * FONT_HEIGHT;
-      cv::putText(frameMarkers, "Z: " + std::to_string(tvecs.at(i)[2]), textStart, cv::FONT_HERSHEY_SIMPLEX, TEXT_SCALE, BLUE, TEXT_LINE_THICKNESS, cv::LINE_AA);
+    // Frames in between are only detected and written to the outputs.
+    if (!overlay.isDue()) {
+      return true;
     }
 
-    if (verbosity > 0) {
-      for(unsigned int i = 0; i < nMarkers; i++) {
-        std::cout << "Coordinates {x,y,z} of marker id=" << markerIds.at(i) << ": " << vec2str(tvecs.at(i));
+    // Drawing and the GUI allocate inside OpenCV, but only run at the display rate.
+    IGNORE_ALLOCATIONS();
+
+    const cv::Mat* frameMarkers;
+    {
+      TIME_STAGE(DRAW);
+      frameMarkers = &overlay.render(tracker, frame);
+    }
+
+    TIME_STAGE(DISPLAY);
+    cv::imshow("Marker Detect", *frameMarkers);
+
+    // Wait for X milliseconds. If a key is pressed, break from the loop.
+    return cv::waitKey(1) < 0;
+  };
+
+  int exitCode = 0;
+
+  if (pipelined) {
+    FramePipeline pipeline(*source, trackerConfig, pipelineWorkers, pipelineQueueSize);
+    pipeline.start();
+
+    auto lastStatsTime = std::chrono::steady_clock::now();
+
+    while (pipeline.nextResult(frame)) {
+      if (verbosity > 1 && frame.captureTime - lastStatsTime >= std::chrono::seconds(1)) {
+        printPipelineStats(pipeline.getStats(), infoStream);
+        lastStatsTime = frame.captureTime;
       }
-      if (nMarkers > 0) {
-        std::cout << std::endl;
+
+      if (!consumeFrame(pipeline.getTracker())) {
+        break;
       }
     }
 
-    cv::imshow("Marker Detect", frameMarkers);
+    pipeline.stop();
 
-    // Wait for X milliseconds. If a key is pressed, break from the loop.
-    if (cv::waitKey(1) >= 0) {
-      break;
+    printPipelineStats(pipeline.getStats(), infoStream);
+
+    for (size_t i = 0; i < pipeline.getWorkerCount() && verbosity > 0; i++) {
+      printTrackerStats(pipeline.getTracker(i), infoStream);
+    }
+  } else {
+    MarkerTracker tracker(trackerConfig);
+    // The same frame, and with it all of its buffers, is reused for the whole run.
+    uint64_t allocatingFrames = 0;
+
+    while (!stopRequested) {
+      uint64_t allocationsBefore = threadAllocationCount();
+      bool success;
+
+      {
+        TIME_STAGE(CAPTURE);
+        IGNORE_ALLOCATIONS();
+        success = source->read(frame.image, frame.captureTime);
+        frame.encodedImage = source->getEncodedFrame();
+      }
+
+      if (!success) {
+        std::cerr << "Error: Could not read frame." << std::endl;
+        break;
+      }
+
+      frame.sequence++;
+
+      // Detect markers and estimate their pose.
+      tracker.process(frame);
+
+      bool keepRunning = consumeFrame(tracker);
+
+      uint64_t allocations = threadAllocationCount() - allocationsBefore;
+      if (allocationCheckWarmup >= 0 && frame.sequence > (uint64_t)allocationCheckWarmup && allocations > 0) {
+        if (allocatingFrames == 0) {
+          std::cerr << "Error: Frame " << frame.sequence << " made " << allocations << " heap allocations after the warm-up." << std::endl;
+        }
+        allocatingFrames++;
+      }
+
+      if (!keepRunning) {
+        break;
+      }
+    }
+
+    if (verbosity > 0) {
+      printTrackerStats(tracker, infoStream);
+    }
+
+    if (allocationCheckWarmup >= 0) {
+      infoStream << "Frames that allocated after the warm-up: " << allocatingFrames << std::endl;
+
+      if (allocatingFrames > 0) {
+        exitCode = 1;
+      }
     }
   }
 
+  STAGE_TIMING_DUMP(std::cerr);
+
+  if (recorder) {
+    recorder->close();
+    infoStream << "Frames recorded: " << recorder->written() << ", dropped because the disk could not keep up: " << recorder->dropped() << std::endl;
+  }
+
   // Release the VideoCapture object and close all windows
   cap.release();
-  cv::destroyAllWindows();
+  if (!headless) {
+    cv::destroyAllWindows();
+  }
 
-  return 0;
+  return exitCode;
 }
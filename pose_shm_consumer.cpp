@@ -0,0 +1,88 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include <pose_shm.h>
+
+// Example consumer of the shared memory pose ring. It only needs pose_shm.h and src/pose_shm_reader.cpp, not OpenCV.
+
+namespace po = boost::program_options;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void handleStopSignal(int) {
+  stopRequested = 1;
+}
+
+int main(int argc, char *argv[]) {
+  std::string name = "/tag-tracker";
+  int pollInterval = 0;
+
+  po::options_description desc("Available options");
+  desc.add_options()
+    ("help,h", "Show this message.")
+    ("name,n", po::value<std::string>()->default_value(name), "Name of the shared memory object tag-tracker publishes to (its --shm-output option).")
+    ("poll-interval", po::value<int>()->default_value(pollInterval), "Microseconds to sleep between checks for a new frame. 0 busy-waits for the lowest latency.")
+    ("quiet,q", "Only print the latency statistics at exit instead of every pose.")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  name = vm["name"].as<std::string>();
+  pollInterval = vm["poll-interval"].as<int>();
+  bool quiet = vm.count("quiet") > 0;
+
+  PoseShmReader reader(name);
+  if (!reader.isOpen()) {
+    return -1;
+  }
+
+  std::signal(SIGINT, handleStopSignal);
+  std::signal(SIGTERM, handleStopSignal);
+
+  PoseShmFrame frame;
+  uint64_t frameCount = 0;
+  double totalLatencyUs = 0;
+  double maxLatencyUs = 0;
+
+  while (!stopRequested && reader.read(frame, std::chrono::microseconds(pollInterval))) {
+    // The capture time is taken from the steady clock, which is the same for all processes on the host.
+    int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    double latencyUs = (nowNs - frame.timestampNs) / 1000.0;
+
+    frameCount++;
+    totalLatencyUs += latencyUs;
+    maxLatencyUs = std::max(maxLatencyUs, latencyUs);
+
+    if (quiet) {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < frame.markerCount; i++) {
+      const PoseShmMarker& marker = frame.markers[i];
+
+      std::cout << "camera=" << frame.cameraId << " frame=" << frame.sequence << " id=" << marker.id
+                << " t={" << marker.tvec[0] << ", " << marker.tvec[1] << ", " << marker.tvec[2] << "}"
+                << " r={" << marker.rvec[0] << ", " << marker.rvec[1] << ", " << marker.rvec[2] << "}"
+                << " latency=" << latencyUs << "us\n";
+    }
+  }
+
+  std::cout << "Frames read: " << frameCount << ", lost: " << reader.lost();
+  if (frameCount > 0) {
+    std::cout << ", mean latency since capture: " << totalLatencyUs / frameCount << "us, max: " << maxLatencyUs << "us";
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
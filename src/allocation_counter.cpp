@@ -0,0 +1,97 @@
+#include <allocation_counter.h>
+
+#if ALLOCATION_COUNTING
+
+#include <cerrno>
+#include <cstddef>
+
+// The allocator functions of glibc, which the replacements below forward to.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace {
+
+// Initial-exec TLS is resolved at load time, so touching it from inside malloc cannot recurse into malloc.
+__attribute__((tls_model("initial-exec"))) thread_local uint64_t allocationCount = 0;
+__attribute__((tls_model("initial-exec"))) thread_local int exemptionDepth = 0;
+
+inline void countAllocation() {
+  if (exemptionDepth == 0) {
+    allocationCount++;
+  }
+}
+
+} // namespace
+
+// operator new and cv::fastMalloc both end up here, so this sees every heap allocation of the program.
+extern "C" {
+
+void* malloc(size_t size) {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  countAllocation();
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+  countAllocation();
+  return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+  if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+
+  countAllocation();
+  void* result = __libc_memalign(alignment, size);
+  if (result == nullptr) {
+    return ENOMEM;
+  }
+
+  *pointer = result;
+  return 0;
+}
+
+} // extern "C"
+
+uint64_t threadAllocationCount() {
+  return allocationCount;
+}
+
+ScopedAllocationExemption::ScopedAllocationExemption() {
+  exemptionDepth++;
+}
+
+ScopedAllocationExemption::~ScopedAllocationExemption() {
+  exemptionDepth--;
+}
+
+#else
+
+uint64_t threadAllocationCount() {
+  return 0;
+}
+
+ScopedAllocationExemption::ScopedAllocationExemption() {}
+
+ScopedAllocationExemption::~ScopedAllocationExemption() {}
+
+#endif // ALLOCATION_COUNTING
@@ -0,0 +1,310 @@
+#include <calibration_file.h>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <tag-tracker.h>
+
+#define CALIBRATION_BINARY_MAGIC "TTCALIB"
+#define CALIBRATION_MODEL_LENGTH 16
+// Relative difference of the aspect ratios up to which a calibration is still scaled to a different resolution.
+#define ASPECT_RATIO_TOLERANCE 1e-3
+
+namespace {
+
+// Header of the binary format, in host byte order. It is followed by distCoeffCount doubles.
+struct CalibrationBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t distCoeffCount;
+  int32_t imageWidth;
+  int32_t imageHeight;
+  int32_t boardWidth;
+  int32_t boardHeight;
+  uint32_t reserved[2];
+  char model[CALIBRATION_MODEL_LENGTH];
+  double rmsError;
+  double cameraMatrix[9];
+};
+
+static_assert(sizeof(CalibrationBinaryHeader) == 136, "CalibrationBinaryHeader must not contain padding.");
+
+bool validDistCoeffCount(int count) {
+  return count == 4 || count == 5 || count == 8 || count == 12 || count == 14;
+}
+
+// Check the shape of the matrices and convert them to CV_64F.
+bool normalize(CameraCalibration& calibration, const std::filesystem::path& path, std::ostream& err) {
+  if (calibration.cameraMatrix.total() != 9 || !validDistCoeffCount(calibration.distCoeffs.total())) {
+    err << "Invalid camera matrix or distortion coefficients in calibration file " << path << "." << std::endl;
+    return false;
+  }
+
+  calibration.cameraMatrix.convertTo(calibration.cameraMatrix, CV_64F);
+  calibration.cameraMatrix = calibration.cameraMatrix.reshape(1, 3);
+  calibration.distCoeffs.convertTo(calibration.distCoeffs, CV_64F);
+  calibration.distCoeffs = calibration.distCoeffs.reshape(1, 1);
+
+  return true;
+}
+
+bool saveLegacy(const std::filesystem::path& path, const CameraCalibration& calibration) {
+  std::ofstream file(path);
+  file << dmat2str(calibration.cameraMatrix) << "\n" << dmat2str(calibration.distCoeffs) << std::endl;
+
+  return file.good();
+}
+
+bool loadLegacy(std::ifstream& file, const std::filesystem::path& path, CameraCalibration& calibration, std::ostream& err) {
+  std::vector<double> values[2];
+
+  std::string line;
+  for (int i = 0; i < 2; i++) {
+    if (!std::getline(file, line) || line.length() < 2) {
+      err << "Incorrect file format for the calibration file " << path << "." << std::endl;
+      return false;
+    }
+
+    // Remove the {} brackets.
+    line = line.substr(1, line.length()-2);
+    // Read all values of a line as doubles.
+    std::istringstream lineStream(line);
+    std::string stringNum;
+    while (std::getline(lineStream, stringNum, ',')) {
+      try {
+        values[i].push_back(std::stod(stringNum));
+      } catch(const std::exception&) {
+        err << "Incorrect number format in the calibration file " << path << "." << std::endl;
+        return false;
+      }
+    }
+  }
+
+  calibration.cameraMatrix = cv::Mat(values[0], true);
+  calibration.distCoeffs = cv::Mat(values[1], true);
+
+  return true;
+}
+
+bool saveBinary(std::ostream& file, const CameraCalibration& calibration) {
+  CalibrationBinaryHeader header = {};
+  std::memcpy(header.magic, CALIBRATION_BINARY_MAGIC, sizeof(CALIBRATION_BINARY_MAGIC));
+  std::strncpy(header.model, calibration.model.c_str(), CALIBRATION_MODEL_LENGTH - 1);
+  header.version = CALIBRATION_FILE_VERSION;
+  header.distCoeffCount = calibration.distCoeffs.total();
+  header.imageWidth = calibration.imageSize.width;
+  header.imageHeight = calibration.imageSize.height;
+  header.boardWidth = calibration.boardSize.width;
+  header.boardHeight = calibration.boardSize.height;
+  header.rmsError = calibration.rmsError;
+
+  cv::Mat cameraMatrix = calibration.cameraMatrix.reshape(1, 1);
+  for (int i = 0; i < 9; i++) {
+    header.cameraMatrix[i] = cameraMatrix.at<double>(i);
+  }
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  cv::Mat distCoeffs = calibration.distCoeffs.isContinuous() ? calibration.distCoeffs : calibration.distCoeffs.clone();
+  file.write(reinterpret_cast<const char*>(distCoeffs.ptr<double>()), header.distCoeffCount * sizeof(double));
+
+  return file.good();
+}
+
+bool loadBinary(std::istream& file, const std::filesystem::path& path, CameraCalibration& calibration, std::ostream& err) {
+  CalibrationBinaryHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    err << "Calibration file " << path << " is truncated." << std::endl;
+    return false;
+  }
+
+  if (std::memcmp(header.magic, CALIBRATION_BINARY_MAGIC, sizeof(CALIBRATION_BINARY_MAGIC)) != 0) {
+    err << "Calibration file " << path << " is not a binary calibration file." << std::endl;
+    return false;
+  }
+
+  if (header.version > CALIBRATION_FILE_VERSION) {
+    err << "Calibration file " << path << " has version " << header.version << ", but only up to " << CALIBRATION_FILE_VERSION << " is supported." << std::endl;
+    return false;
+  }
+
+  if (!validDistCoeffCount(header.distCoeffCount)) {
+    err << "Invalid number of distortion coefficients in calibration file " << path << "." << std::endl;
+    return false;
+  }
+
+  header.model[CALIBRATION_MODEL_LENGTH - 1] = '\0';
+  calibration.model = header.model;
+  calibration.imageSize = cv::Size(header.imageWidth, header.imageHeight);
+  calibration.boardSize = cv::Size(header.boardWidth, header.boardHeight);
+  calibration.rmsError = header.rmsError;
+  calibration.cameraMatrix = cv::Mat(3, 3, CV_64F, header.cameraMatrix).clone();
+
+  calibration.distCoeffs = cv::Mat(1, header.distCoeffCount, CV_64F);
+  file.read(reinterpret_cast<char*>(calibration.distCoeffs.ptr<double>()), header.distCoeffCount * sizeof(double));
+
+  if (!file) {
+    err << "Calibration file " << path << " is truncated." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool saveFileStorage(const std::filesystem::path& path, const CameraCalibration& calibration) {
+  cv::FileStorage fs(path.string(), cv::FileStorage::WRITE);
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  fs << "version" << CALIBRATION_FILE_VERSION;
+  fs << "model" << calibration.model;
+  fs << "image_width" << calibration.imageSize.width;
+  fs << "image_height" << calibration.imageSize.height;
+  fs << "board_width" << calibration.boardSize.width;
+  fs << "board_height" << calibration.boardSize.height;
+  fs << "rms_error" << calibration.rmsError;
+  fs << "camera_matrix" << calibration.cameraMatrix;
+  fs << "distortion_coefficients" << calibration.distCoeffs;
+
+  return true;
+}
+
+bool loadFileStorage(const std::filesystem::path& path, CameraCalibration& calibration, std::ostream& err) {
+  cv::FileStorage fs;
+
+  try {
+    fs.open(path.string(), cv::FileStorage::READ);
+  } catch (const cv::Exception&) {
+  }
+
+  if (!fs.isOpened()) {
+    err << "Could not parse calibration file " << path << "." << std::endl;
+    return false;
+  }
+
+  int version = (int)fs["version"];
+  if (version < 1 || version > CALIBRATION_FILE_VERSION) {
+    err << "Calibration file " << path << " has unsupported version " << version << "." << std::endl;
+    return false;
+  }
+
+  calibration.model = fs["model"].empty() ? std::string(CALIBRATION_MODEL_PINHOLE) : fs["model"].string();
+  calibration.imageSize = cv::Size((int)fs["image_width"], (int)fs["image_height"]);
+  calibration.boardSize = cv::Size((int)fs["board_width"], (int)fs["board_height"]);
+  calibration.rmsError = fs["rms_error"].empty() ? -1 : (double)fs["rms_error"];
+  fs["camera_matrix"] >> calibration.cameraMatrix;
+  fs["distortion_coefficients"] >> calibration.distCoeffs;
+
+  return true;
+}
+
+} // namespace
+
+bool saveCalibration(const std::filesystem::path& path, const CameraCalibration& calibration) {
+  if (path.extension() == CALIBRATION_BINARY_EXTENSION) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    return saveBinary(file, calibration);
+  }
+
+  if (path.extension() == CALIBRATION_LEGACY_EXTENSION) {
+    return saveLegacy(path, calibration);
+  }
+
+  return saveFileStorage(path, calibration);
+}
+
+bool loadCalibration(const std::filesystem::path& path, CameraCalibration& calibration, std::ostream& err) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    err << "Could not open calibration file " << path << "." << std::endl;
+    return false;
+  }
+
+  char magic[8] = {};
+  file.read(magic, sizeof(magic));
+  file.clear();
+  file.seekg(0);
+
+  CameraCalibration loaded;
+  bool success;
+
+  if (std::memcmp(magic, CALIBRATION_BINARY_MAGIC, sizeof(CALIBRATION_BINARY_MAGIC)) == 0) {
+    success = loadBinary(file, path, loaded, err);
+  } else if (magic[0] == '{') {
+    success = loadLegacy(file, path, loaded, err);
+  } else {
+    file.close();
+    success = loadFileStorage(path, loaded, err);
+  }
+
+  if (!success || !normalize(loaded, path, err)) {
+    return false;
+  }
+
+  calibration = loaded;
+
+  return true;
+}
+
+bool writeCalibration(std::ostream& out, const CameraCalibration& calibration) {
+  return saveBinary(out, calibration);
+}
+
+bool readCalibration(std::istream& in, CameraCalibration& calibration, std::ostream& err) {
+  CameraCalibration loaded;
+
+  if (!loadBinary(in, "(embedded)", loaded, err) || !normalize(loaded, "(embedded)", err)) {
+    return false;
+  }
+
+  calibration = loaded;
+
+  return true;
+}
+
+void scaleCalibration(CameraCalibration& calibration, double scaleX, double scaleY) {
+  calibration.cameraMatrix = calibration.cameraMatrix.clone();
+  calibration.cameraMatrix.at<double>(0, 0) *= scaleX;
+  calibration.cameraMatrix.at<double>(0, 2) *= scaleX;
+  calibration.cameraMatrix.at<double>(1, 1) *= scaleY;
+  calibration.cameraMatrix.at<double>(1, 2) *= scaleY;
+
+  if (calibration.imageSize.area() > 0) {
+    calibration.imageSize = cv::Size(cvRound(calibration.imageSize.width * scaleX), cvRound(calibration.imageSize.height * scaleY));
+  }
+}
+
+bool adaptCalibrationToResolution(CameraCalibration& calibration, cv::Size frameSize, std::ostream& err) {
+  if (calibration.imageSize.area() > 0 && frameSize.area() <= 0) {
+    err << "Warning: The resolution of the video source is unknown, so it can not be checked against the calibration." << std::endl;
+    return true;
+  }
+
+  if (calibration.imageSize.area() <= 0 || calibration.imageSize == frameSize) {
+    return true;
+  }
+
+  double scaleX = (double)frameSize.width / calibration.imageSize.width;
+  double scaleY = (double)frameSize.height / calibration.imageSize.height;
+
+  if (std::abs(scaleX - scaleY) > ASPECT_RATIO_TOLERANCE * std::max(scaleX, scaleY)) {
+    err << "Error: The camera was calibrated at " << calibration.imageSize.width << "x" << calibration.imageSize.height
+        << ", but the video source delivers " << frameSize.width << "x" << frameSize.height
+        << ". The aspect ratio differs, so the calibration is not valid for this source. Recalibrate at this resolution." << std::endl;
+    return false;
+  }
+
+  err << "Warning: The camera was calibrated at " << calibration.imageSize.width << "x" << calibration.imageSize.height
+      << ", but the video source delivers " << frameSize.width << "x" << frameSize.height
+      << ". Scaling the camera matrix accordingly, which is only correct if the camera does not crop the image." << std::endl;
+
+  scaleCalibration(calibration, scaleX, scaleY);
+  calibration.imageSize = frameSize;
+
+  return true;
+}
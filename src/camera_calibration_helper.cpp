@@ -1,40 +1,132 @@
 #include <camera_calibration_helper.h>
 
+#include <fstream>
 #include <iostream>
+#include <memory>
 
 #define DEFAULT_CALIBRATION_IMAGE_COUNT 9
+#define CHESSBOARD_DETECTION_FLAGS (cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE)
 #define PROCESSED_IMAGE_FILENAME_PREFIX "processed_"
 #define PROCESSED_IMAGE_SUBFOLDER "processed"
 
-int CameraCalibrationHelper::calibrateWithImages(std::filesystem::path path) {
-  resetResults();
+namespace {
 
-  cv::glob(path.string(), inputImagePaths);
+std::vector<uchar> readFile(const cv::String& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return std::vector<uchar>();
+  }
 
-  cv::Mat frame;
+  std::vector<uchar> data(file.tellg());
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), data.size());
 
-  for (unsigned int img = 0; img < inputImagePaths.size(); img++) {
-    frame = cv::imread(inputImagePaths[img]);
+  return data;
+}
 
-    inputImages.push_back(frame);
+} // namespace
+
+bool CameraCalibrationHelper::detectCorners(const cv::Mat& image, std::vector<cv::Point2f>& corners) const {
+  if (image.empty()) {
+    return false;
   }
 
-  return calibrateWithImages(inputImages);
-}
+  cv::Mat gray;
+  if (image.channels() == 1) {
+    gray = image;
+  } else {
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+  }
 
-int CameraCalibrationHelper::calibrateWithImages(const std::vector<cv::Mat>& images) {
-  bool calledInternally = false;
-  if (&images == &inputImages) {
-    calledInternally = true;
+  bool success = cv::findChessboardCorners(gray, cv::Size(checkerboardHeight, checkerboardWidth), corners, CHESSBOARD_DETECTION_FLAGS);
+
+  if (success) {
+    cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.001);
+    cv::cornerSubPix(gray, corners, cv::Size(11,11), cv::Size(-1,-1), criteria);
   }
 
-  if (!calledInternally) {
-    resetResults();
+  return success;
+}
+
+cv::Mat CameraCalibrationHelper::makeThumbnail(const cv::Mat& image) const {
+  cv::Mat thumbnail;
+
+  if (thumbnailWidth > 0 && !image.empty()) {
+    double scale = (double)thumbnailWidth / image.cols;
+    cv::resize(image, thumbnail, cv::Size(), scale, scale, cv::INTER_AREA);
   }
 
-  std::vector<std::vector<cv::Point3f> > objpoints;
-  std::vector<std::vector<cv::Point2f> > imgpoints;
+  return thumbnail;
+}
+
+void CameraCalibrationHelper::detectCornersStreaming(CornerCache* cache) {
+  // Thumbnails are the only thing that needs color.
+  int readFlags = thumbnailWidth > 0 ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+
+  std::vector<std::vector<cv::Point2f> > corners(inputImagePaths.size());
+  std::vector<char> success(inputImagePaths.size(), false);
+  std::vector<cv::Mat> imageThumbnails(inputImagePaths.size());
+  std::vector<cv::Size> imageSizes(inputImagePaths.size());
+  std::vector<uint64_t> keys(inputImagePaths.size());
+  std::vector<char> cached(inputImagePaths.size(), false);
+
+  // Every thread only holds the one image it is currently working on, so the peak memory use
+  // is bounded by the number of threads, not the number of images.
+  cv::parallel_for_(cv::Range(0, inputImagePaths.size()), [&](const cv::Range& range) {
+    for (int img = range.start; img < range.end; img++) {
+      cv::Mat image;
+
+      if (cache != nullptr) {
+        // The file has to be read anyway to compute the hash, so decode it from memory on a miss instead of reading it twice.
+        std::vector<uchar> data = readFile(inputImagePaths[img]);
+        keys[img] = CornerCache::hash(data);
+
+        const CornerCacheEntry* entry = cache->find(keys[img]);
+        if (entry != nullptr) {
+          cached[img] = true;
+          success[img] = entry->found;
+          corners[img] = entry->corners;
+          imageSizes[img] = entry->imageSize;
+          continue;
+        }
+
+        if (!data.empty()) {
+          image = cv::imdecode(data, readFlags);
+        }
+      } else {
+        image = cv::imread(inputImagePaths[img], readFlags);
+      }
+
+      success[img] = detectCorners(image, corners[img]);
+      imageSizes[img] = image.size();
+
+      if (success[img]) {
+        imageThumbnails[img] = makeThumbnail(image);
+      }
+    }
+  });
+
+  for (unsigned int img = 0; img < inputImagePaths.size(); img++) {
+    if (cache != nullptr && cached[img]) {
+      cache->touch(keys[img]);
+      cornerCacheHits++;
+    } else if (cache != nullptr && imageSizes[img].area() > 0) {
+      // Only cache images that could be decoded, so unreadable files are retried.
+      cache->insert(keys[img], CornerCacheEntry{(bool)success[img], imageSizes[img], corners[img]});
+    }
+
+    if (!success[img]) {
+      continue;
+    }
 
+    imageSize = imageSizes[img];
+    processedImagePaths.push_back(inputImagePaths[img]);
+    detectedCorners.push_back(std::move(corners[img]));
+    thumbnails.push_back(imageThumbnails[img]);
+  }
+}
+
+int CameraCalibrationHelper::calibrateWithDetectedCorners() {
   std::vector<cv::Point3f> objp;
   for(int c = 0; c < checkerboardWidth; c++) {
     for(int r = 0; r < checkerboardHeight; r++){
@@ -42,49 +134,171 @@ int CameraCalibrationHelper::calibrateWithImages(const std::vector<cv::Mat>& ima
     }
   }
 
-  cv::Mat frame, gray;
+  std::vector<std::vector<cv::Point3f> > objpoints(detectedCorners.size(), objp);
 
-  std::vector<cv::Point2f> corner_pts;
-  bool success;
-  int successfullyProcessedImages = 0;
+  rmsError = cv::calibrateCamera(objpoints, detectedCorners, imageSize, cameraMatrix, distCoeffs, rotationVectors, translationVectors);
 
-  for (unsigned int img = 0; img < images.size(); img++) {
-    frame = images[img];
+  return detectedCorners.size();
+}
+
+cv::Mat CameraCalibrationHelper::getAnnotatedImage(size_t i) const {
+  if (i < processedImages.size()) {
+    return processedImages[i];
+  }
+
+  if (i >= detectedCorners.size()) {
+    return cv::Mat();
+  }
+
+  cv::Mat image;
+  std::vector<cv::Point2f> corners = detectedCorners[i];
+
+  if (i < thumbnails.size() && !thumbnails[i].empty()) {
+    image = thumbnails[i].clone();
 
-    if (!calledInternally) {
-      inputImages.push_back(frame);
+    float scale = (float)image.cols / imageSize.width;
+    for (cv::Point2f& corner : corners) {
+      corner *= scale;
     }
+  } else if (i < processedImagePaths.size()) {
+    image = cv::imread(processedImagePaths[i]);
+  }
 
-    cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+  if (image.empty()) {
+    return image;
+  }
 
-    success = cv::findChessboardCorners(gray, cv::Size(checkerboardHeight, checkerboardWidth), corner_pts, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_FAST_CHECK | cv::CALIB_CB_NORMALIZE_IMAGE);
+  if (image.channels() == 1) {
+    cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+  }
 
-    if(success)
-    {
-      cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.001);
-      cv::cornerSubPix(gray,corner_pts,cv::Size(11,11), cv::Size(-1,-1),criteria);
+  cv::drawChessboardCorners(image, cv::Size(checkerboardHeight, checkerboardWidth), corners, true);
 
-      cv::Mat processedFrame = frame.clone();
-      cv::drawChessboardCorners(processedFrame, cv::Size(checkerboardHeight, checkerboardWidth), corner_pts, success);
+  return image;
+}
 
-      processedImages.push_back(processedFrame);
+int CameraCalibrationHelper::calibrateWithImages(std::filesystem::path path) {
+  resetResults();
 
-      // If function was called by calibrateWithImages(std::filesystem::path), inputImagePaths will be filled,
-      // and we can also populate the processedImagePaths.
-      if (inputImagePaths.size() > img) {
-        processedImagePaths.push_back(inputImagePaths.at(img));
-      }
+  cv::glob(path.string(), inputImagePaths);
+  cornerCacheHits = 0;
+
+  std::unique_ptr<CornerCache> cache;
+  if (useCornerCache) {
+    std::filesystem::path cachePath = cornerCachePath;
+    if (cachePath.empty()) {
+      cachePath = path.parent_path() / CORNER_CACHE_FILENAME;
+    }
 
-      objpoints.push_back(objp);
-      imgpoints.push_back(corner_pts);
+    cache = std::make_unique<CornerCache>(cachePath, cv::Size(checkerboardHeight, checkerboardWidth), CHESSBOARD_DETECTION_FLAGS);
+  }
+
+  if (streaming) {
+    detectCornersStreaming(cache.get());
 
-      successfullyProcessedImages++;
+    if (cache) {
+      cache->save();
     }
+
+    return calibrateWithDetectedCorners();
   }
 
-  cv::calibrateCamera(objpoints, imgpoints, cv::Size(gray.rows,gray.cols), cameraMatrix, distCoeffs, rotationVectors, translationVectors);
+  // Without annotated output, nothing needs the color information.
+  int readFlags = annotateImages ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+  std::vector<uint64_t> keys(cache ? inputImagePaths.size() : 0);
+
+  // Decode the images in parallel. Every image goes to the slot matching its path, so the order is preserved.
+  inputImages.resize(inputImagePaths.size());
+  cv::parallel_for_(cv::Range(0, inputImagePaths.size()), [&](const cv::Range& range) {
+    for (int img = range.start; img < range.end; img++) {
+      if (cache) {
+        // The cache needs the hash of the file content, so the file is read once and decoded from memory.
+        std::vector<uchar> data = readFile(inputImagePaths[img]);
+        keys[img] = CornerCache::hash(data);
+
+        if (!data.empty()) {
+          inputImages[img] = cv::imdecode(data, readFlags);
+        }
+      } else {
+        inputImages[img] = cv::imread(inputImagePaths[img], readFlags);
+      }
+    }
+  });
 
-  return successfullyProcessedImages;
+  int processedImgCount = calibrateWithImages(inputImages, cache.get(), keys);
+
+  if (cache) {
+    cache->save();
+  }
+
+  return processedImgCount;
+}
+
+int CameraCalibrationHelper::calibrateWithImages(const std::vector<cv::Mat>& images) {
+  // The images may be those of the last calibration, which resetResults() releases.
+  std::vector<cv::Mat> newImages = images;
+  resetResults();
+  inputImages = std::move(newImages);
+
+  return calibrateWithImages(inputImages, nullptr, std::vector<uint64_t>());
+}
+
+int CameraCalibrationHelper::calibrateWithImages(const std::vector<cv::Mat>& images, CornerCache* cache, const std::vector<uint64_t>& keys) {
+  // Detect the corners of all images in parallel, then collect the results in input order.
+  // std::vector<char> rather than std::vector<bool>, because the elements are written from different threads.
+  std::vector<std::vector<cv::Point2f> > corners(images.size());
+  std::vector<char> success(images.size(), false);
+  std::vector<char> cached(images.size(), false);
+  std::vector<cv::Mat> annotated(images.size());
+
+  cv::parallel_for_(cv::Range(0, images.size()), [&](const cv::Range& range) {
+    for (int img = range.start; img < range.end; img++) {
+      const CornerCacheEntry* entry = cache != nullptr && !images[img].empty() ? cache->find(keys[img]) : nullptr;
+
+      if (entry != nullptr && entry->imageSize == images[img].size()) {
+        cached[img] = true;
+        success[img] = entry->found;
+        corners[img] = entry->corners;
+      } else {
+        success[img] = detectCorners(images[img], corners[img]);
+      }
+
+      if (success[img] && annotateImages) {
+        annotated[img] = images[img].clone();
+        cv::drawChessboardCorners(annotated[img], cv::Size(checkerboardHeight, checkerboardWidth), corners[img], true);
+      }
+    }
+  });
+
+  for (unsigned int img = 0; img < images.size(); img++) {
+    if (cache != nullptr && cached[img]) {
+      cache->touch(keys[img]);
+      cornerCacheHits++;
+    } else if (cache != nullptr && !images[img].empty()) {
+      // Only cache images that could be decoded, so unreadable files are retried.
+      cache->insert(keys[img], CornerCacheEntry{(bool)success[img], images[img].size(), corners[img]});
+    }
+
+    if (!success[img]) {
+      continue;
+    }
+
+    imageSize = images[img].size();
+
+    if (annotateImages) {
+      processedImages.push_back(annotated[img]);
+    }
+
+    // If function was called by calibrateWithImages(std::filesystem::path), inputImagePaths will be filled,
+    // and we can also populate the processedImagePaths.
+    if (inputImagePaths.size() > img) {
+      processedImagePaths.push_back(inputImagePaths.at(img));
+    }
+
+    detectedCorners.push_back(std::move(corners[img]));
+  }
+
+  return calibrateWithDetectedCorners();
 }
 
 int CameraCalibrationHelper::calibrateInteractively(cv::VideoCapture& videoSource, std::filesystem::path path) {
@@ -100,6 +314,17 @@ int CameraCalibrationHelper::calibrateInteractively(cv::VideoCapture& videoSourc
     extension = path.extension();
   }
 
+  std::filesystem::path processedFolder = folder;
+  processedFolder /= PROCESSED_IMAGE_SUBFOLDER;
+  if (saveImages) {
+    std::error_code error;
+    std::filesystem::create_directories(processedFolder, error);
+    if (error) {
+      std::cerr << "Error: Could not create folder " << processedFolder << ": " << error.message() << std::endl;
+      return -1;
+    }
+  }
+
   cv::Mat frame;
   cv::namedWindow("Calibration Preview", cv::WINDOW_NORMAL);
 
@@ -137,26 +362,54 @@ int CameraCalibrationHelper::calibrateInteractively(cv::VideoCapture& videoSourc
     if (takePic) {
       picsTaken++;
       std::cout << CLEAR_LINE_ESCAPE_SEQUENCE << "Pictures taken: " << picsTaken << std::flush;
-      inputImages.push_back(frame.clone());
+
+      if (!streaming) {
+        inputImages.push_back(frame.clone());
+        continue;
+      }
+
+      // In streaming mode, extract the corners right away and only keep those.
+      std::vector<cv::Point2f> corners;
+      bool success = detectCorners(frame, corners);
+
+      std::filesystem::path inputImPath = folder;
+      inputImPath /= std::filesystem::path(std::to_string(picsTaken - 1) + extension.string());
+      if (saveImages) {
+        cv::imwrite(inputImPath, frame);
+        inputImagePaths.push_back(inputImPath.string());
+      }
+
+      if (success) {
+        imageSize = frame.size();
+        thumbnails.push_back(makeThumbnail(frame));
+
+        if (saveImages) {
+          cv::Mat processedFrame = frame.clone();
+          cv::drawChessboardCorners(processedFrame, cv::Size(checkerboardHeight, checkerboardWidth), corners, success);
+
+          std::filesystem::path processedImPath = processedFolder;
+          processedImPath /= std::filesystem::path(PROCESSED_IMAGE_FILENAME_PREFIX + std::to_string(detectedCorners.size()) + extension.string());
+          cv::imwrite(processedImPath, processedFrame);
+
+          processedImagePaths.push_back(inputImPath.string());
+        }
+
+        detectedCorners.push_back(corners);
+      }
     }
   }
 
   std::cout << "\n";
 
-  int processedImgCount = calibrateWithImages(inputImages);
+  int processedImgCount = streaming ? calibrateWithDetectedCorners() : calibrateWithImages(inputImages, nullptr, std::vector<uint64_t>());
 
   cv::destroyWindow("Calibration Preview");
 
-  if (!saveImages) {
+  // In streaming mode, the images were already saved while taking them.
+  if (!saveImages || streaming) {
     return processedImgCount;
   }
 
-  std::filesystem::path processedFolder = folder;
-  processedFolder /= PROCESSED_IMAGE_SUBFOLDER;
-  if (!std::filesystem::exists(processedFolder)) {
-    assert(std::filesystem::create_directories(processedFolder));
-  }
-
   for (unsigned int i = 0; i < inputImages.size(); i++) {
     std::filesystem::path inputFileName(std::to_string(i) + extension.string());
     std::filesystem::path inputImPath = folder;
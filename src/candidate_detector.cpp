@@ -0,0 +1,321 @@
+#include <candidate_detector.h>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+// Neighbors of a pixel in clockwise order (in image coordinates, with y pointing down), starting to the right.
+const int neighborX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+const int neighborY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+// Store corners at list[index], reusing the vector already there if there is one.
+void storeCorners(std::vector<std::vector<cv::Point2f> >& list, size_t index, const std::vector<cv::Point2f>& corners) {
+  if (index < list.size()) {
+    list[index].assign(corners.begin(), corners.end());
+  } else {
+    list.push_back(corners);
+  }
+}
+
+} // namespace
+
+CandidateDetector::CandidateDetector(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params) :
+  params(params),
+  identifier(dictionary, params) {
+}
+
+void CandidateDetector::computeIntegral(const cv::Mat& gray) {
+  int stride = gray.cols + 1;
+  integral.resize((size_t)(gray.rows + 1) * stride);
+  std::fill(integral.begin(), integral.begin() + stride, 0);
+
+  for (int y = 0; y < gray.rows; y++) {
+    const uchar* source = gray.ptr(y);
+    uint32_t* row = integral.data() + (size_t)(y + 1) * stride;
+    const uint32_t* above = row - stride;
+    uint32_t rowSum = 0;
+
+    row[0] = 0;
+    for (int x = 0; x < gray.cols; x++) {
+      rowSum += source[x];
+      row[x + 1] = above[x + 1] + rowSum;
+    }
+  }
+}
+
+void CandidateDetector::threshold(const cv::Mat& gray, int windowSize, ScaleBuffers& buffers) const {
+  int width = gray.cols;
+  int height = gray.rows;
+  int stride = width + 2;
+  int integralStride = width + 1;
+  int radius = windowSize / 2;
+  // Like cv::adaptiveThreshold with THRESH_BINARY_INV: a pixel is foreground if it is at least delta darker than the mean of its window.
+  int delta = cvFloor(params.adaptiveThreshConstant);
+
+  buffers.binary.resize((size_t)stride * (height + 2));
+  uchar* binary = buffers.binary.data();
+  std::fill(binary, binary + stride, 0);
+  std::fill(binary + (size_t)(height + 1) * stride, binary + (size_t)(height + 2) * stride, 0);
+
+  for (int y = 0; y < height; y++) {
+    // Windows are clipped at the image border, so the mean there is only taken over the pixels inside the image.
+    int top = std::max(0, y - radius);
+    int bottom = std::min(height, y + radius + 1);
+    int windowRows = bottom - top;
+    const uint32_t* topRow = integral.data() + (size_t)top * integralStride;
+    const uint32_t* bottomRow = integral.data() + (size_t)bottom * integralStride;
+    const uchar* source = gray.ptr(y);
+    uchar* row = binary + (size_t)(y + 1) * stride + 1;
+
+    row[-1] = 0;
+    row[width] = 0;
+
+    auto thresholdClipped = [&](int from, int to) {
+      for (int x = from; x < to; x++) {
+        int left = std::max(0, x - radius);
+        int right = std::min(width, x + radius + 1);
+        int sum = (int)(bottomRow[right] - bottomRow[left] - topRow[right] + topRow[left]);
+        row[x] = (source[x] + delta) * windowRows * (right - left) <= sum;
+      }
+    };
+
+    int interiorStart = std::min(radius, width);
+    int interiorEnd = std::max(interiorStart, width - radius);
+    thresholdClipped(0, interiorStart);
+
+    // Four lookups and a comparison per pixel, with the same window area everywhere, which vectorizes well.
+    int area = windowRows * windowSize;
+    for (int x = interiorStart; x < interiorEnd; x++) {
+      int sum = (int)(bottomRow[x + radius + 1] - bottomRow[x - radius] - topRow[x + radius + 1] + topRow[x - radius]);
+      row[x] = (source[x] + delta) * area <= sum;
+    }
+
+    thresholdClipped(interiorEnd, width);
+  }
+}
+
+int CandidateDetector::traceContour(int start, int stride, int maxPoints, ScaleBuffers& buffers) const {
+  // Border following of Suzuki and Abe, as used by cv::findContours.
+  uchar* binary = buffers.binary.data();
+  const int offsets[8] = {1, stride + 1, stride, stride - 1, -1, -stride - 1, -stride, -stride + 1};
+  int x = start % stride - 1;
+  int y = start / stride - 1;
+
+  buffers.contour.clear();
+
+  // Search clockwise around the start, beginning with the background pixel to its left.
+  int firstDirection = -1;
+  for (int k = 0; k < 8; k++) {
+    int d = (4 + k) & 7;
+    if (binary[start + offsets[d]]) {
+      firstDirection = d;
+      break;
+    }
+  }
+
+  if (firstDirection < 0) {
+    binary[start] = 2;
+    buffers.contour.emplace_back(x, y);
+    return 1;
+  }
+
+  int second = start + offsets[firstDirection];
+  int current = start;
+  int previousDirection = firstDirection;
+  int length = 0;
+
+  while (true) {
+    binary[current] = 2;
+    if (length < maxPoints) {
+      buffers.contour.emplace_back(x, y);
+    }
+    length++;
+
+    // Search counterclockwise around the current pixel, beginning after the one the contour came from.
+    int d = previousDirection;
+    for (int k = 0; k < 8; k++) {
+      d = (d + 7) & 7;
+      if (binary[current + offsets[d]]) {
+        break;
+      }
+    }
+
+    int next = current + offsets[d];
+    if (next == start && current == second) {
+      break;
+    }
+
+    x += neighborX[d];
+    y += neighborY[d];
+    previousDirection = (d + 4) & 7;
+    current = next;
+  }
+
+  return length;
+}
+
+void CandidateDetector::findSquares(const cv::Size& imageSize, ScaleBuffers& buffers) const {
+  int stride = imageSize.width + 2;
+  int maxSide = std::max(imageSize.width, imageSize.height);
+  int minPerimeter = int(params.minMarkerPerimeterRate * maxSide);
+  int maxPerimeter = int(params.maxMarkerPerimeterRate * maxSide);
+  int borderDistance = params.minDistanceToBorder;
+  const uchar* binary = buffers.binary.data();
+
+  buffers.candidates.clear();
+
+  for (int y = 1; y <= imageSize.height; y++) {
+    for (int i = y * stride + 1; i <= y * stride + imageSize.width; i++) {
+      // Every contour, outer borders as well as holes, is found at a foreground pixel to the right of a background pixel.
+      // Pixels already on a contour are skipped, so every contour is only traced once.
+      if (binary[i] != 1 || binary[i - 1] != 0) {
+        continue;
+      }
+
+      int length = traceContour(i, stride, maxPerimeter, buffers);
+      if (length < minPerimeter || length > maxPerimeter) {
+        continue;
+      }
+
+      // The contour points are not copied, the matrix header just points to them.
+      cv::Mat contour((int)buffers.contour.size(), 1, CV_32SC2, buffers.contour.data());
+      cv::approxPolyDP(contour, buffers.polygon, length * params.polygonalApproxAccuracyRate, true);
+
+      const std::vector<cv::Point>& polygon = buffers.polygon;
+      if (polygon.size() != 4 || !cv::isContourConvex(polygon)) {
+        continue;
+      }
+
+      double minSideSquared = DBL_MAX;
+      bool nearBorder = false;
+      for (int c = 0; c < 4; c++) {
+        cv::Point side = polygon[c] - polygon[(c + 1) % 4];
+        minSideSquared = std::min(minSideSquared, (double)side.dot(side));
+        nearBorder |= polygon[c].x < borderDistance || polygon[c].y < borderDistance ||
+                      polygon[c].x > imageSize.width - 1 - borderDistance || polygon[c].y > imageSize.height - 1 - borderDistance;
+      }
+
+      double minCornerDistance = length * params.minCornerDistanceRate;
+      if (minSideSquared < minCornerDistance * minCornerDistance || nearBorder) {
+        continue;
+      }
+
+      MarkerCandidate candidate;
+      for (int c = 0; c < 4; c++) {
+        candidate.corners[c] = cv::Point2f(polygon[c].x, polygon[c].y);
+      }
+      candidate.perimeter = length;
+
+      // Make the corners clockwise.
+      cv::Point2f first = candidate.corners[1] - candidate.corners[0];
+      cv::Point2f second = candidate.corners[2] - candidate.corners[0];
+      if (first.x * second.y - first.y * second.x < 0) {
+        std::swap(candidate.corners[1], candidate.corners[3]);
+      }
+
+      buffers.candidates.push_back(candidate);
+    }
+  }
+}
+
+void CandidateDetector::addCandidate(const MarkerCandidate& candidate) {
+  for (MarkerCandidate& other : candidates) {
+    double minDistance = std::min(candidate.perimeter, other.perimeter) * params.minMarkerDistanceRate;
+
+    // The two squares may start at different corners.
+    for (int shift = 0; shift < 4; shift++) {
+      double distanceSquared = 0;
+      for (int c = 0; c < 4; c++) {
+        cv::Point2f difference = candidate.corners[(c + shift) % 4] - other.corners[c];
+        distanceSquared += difference.dot(difference);
+      }
+
+      if (distanceSquared / 4 < minDistance * minDistance) {
+        // The inner and outer edge of a marker border are close, and only the outer one gives the right cells.
+        if (candidate.perimeter > other.perimeter) {
+          other = candidate;
+        }
+        return;
+      }
+    }
+  }
+
+  candidates.push_back(candidate);
+}
+
+const std::vector<MarkerCandidate>& CandidateDetector::findCandidates(const cv::Mat& image) {
+  const cv::Mat* gray = &image;
+  if (image.channels() == 3) {
+    cv::cvtColor(image, grayImage, cv::COLOR_BGR2GRAY);
+    gray = &grayImage;
+  }
+
+  computeIntegral(*gray);
+
+  int minWindow = std::max(3, params.adaptiveThreshWinSizeMin);
+  int maxWindow = std::max(minWindow, params.adaptiveThreshWinSizeMax);
+  int step = std::max(1, params.adaptiveThreshWinSizeStep);
+  int scaleCount = (maxWindow - minWindow) / step + 1;
+
+  if ((int)scales.size() < scaleCount) {
+    scales.resize(scaleCount);
+  }
+
+  // Like the stock detector, every window size is searched on its own thread.
+  cv::parallel_for_(cv::Range(0, scaleCount), [&](const cv::Range& range) {
+    for (int s = range.start; s < range.end; s++) {
+      int windowSize = minWindow + s * step;
+      // Even window sizes have no center pixel.
+      if (windowSize % 2 == 0) {
+        windowSize++;
+      }
+
+      threshold(*gray, windowSize, scales[s]);
+      findSquares(gray->size(), scales[s]);
+    }
+  });
+
+  candidates.clear();
+  for (int s = 0; s < scaleCount; s++) {
+    for (const MarkerCandidate& candidate : scales[s].candidates) {
+      addCandidate(candidate);
+    }
+  }
+
+  return candidates;
+}
+
+void CandidateDetector::detectMarkers(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                                      std::vector<std::vector<cv::Point2f> >& rejected) {
+  findCandidates(image);
+  const cv::Mat& gray = image.channels() == 3 ? grayImage : image;
+
+  size_t markerCount = 0;
+  size_t rejectedCount = 0;
+  ids.clear();
+
+  for (const MarkerCandidate& candidate : candidates) {
+    markerCorners.assign(candidate.corners.begin(), candidate.corners.end());
+    int id;
+
+    if (identifier.identify(gray, markerCorners, id)) {
+      ids.push_back(id);
+      storeCorners(corners, markerCount++, markerCorners);
+    } else {
+      storeCorners(rejected, rejectedCount++, markerCorners);
+    }
+  }
+
+  corners.resize(markerCount);
+  rejected.resize(rejectedCount);
+
+  if (params.cornerRefinementMethod == cv::aruco::CORNER_REFINE_SUBPIX) {
+    cv::TermCriteria criteria(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS, params.cornerRefinementMaxIterations, params.cornerRefinementMinAccuracy);
+    cv::Size window(params.cornerRefinementWinSize, params.cornerRefinementWinSize);
+
+    for (std::vector<cv::Point2f>& refined : corners) {
+      cv::cornerSubPix(gray, refined, window, cv::Size(-1, -1), criteria);
+    }
+  }
+}
@@ -0,0 +1,133 @@
+#include <corner_cache.h>
+
+#include <charconv>
+#include <iostream>
+#include <string>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+namespace {
+
+// cv::FileStorage has no 64-bit integers, so the keys are stored as hex strings.
+std::string keyToString(uint64_t key) {
+  char buffer[17];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), key, 16);
+  return std::string(buffer, result.ptr);
+}
+
+bool stringToKey(const std::string& str, uint64_t& key) {
+  auto result = std::from_chars(str.data(), str.data() + str.size(), key, 16);
+  return result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+} // namespace
+
+CornerCache::CornerCache(const std::filesystem::path& path, cv::Size boardSize, int flags) :
+  path(path), boardSize(boardSize), flags(flags) {
+  load();
+}
+
+void CornerCache::load() {
+  if (!std::filesystem::exists(path)) {
+    return;
+  }
+
+  cv::FileStorage fs(path.string(), cv::FileStorage::READ);
+  if (!fs.isOpened()) {
+    return;
+  }
+
+  if ((int)fs["version"] != CORNER_CACHE_VERSION ||
+      (int)fs["board_width"] != boardSize.width ||
+      (int)fs["board_height"] != boardSize.height ||
+      (int)fs["flags"] != flags) {
+    // Written by a different version or for a different checkerboard, so all entries are invalid.
+    modified = true;
+    return;
+  }
+
+  cv::FileNode nodes = fs["entries"];
+  for (size_t i = 0; i < nodes.size(); i++) {
+    cv::FileNode node = nodes[(int)i];
+    uint64_t key;
+
+    if (!stringToKey(node["hash"].string(), key)) {
+      continue;
+    }
+
+    CornerCacheEntry entry;
+    entry.found = (int)node["found"] != 0;
+    entry.imageSize = cv::Size((int)node["width"], (int)node["height"]);
+    if (entry.found) {
+      node["corners"] >> entry.corners;
+    }
+
+    entries[key] = entry;
+  }
+}
+
+uint64_t CornerCache::hash(const std::vector<uchar>& data) {
+  uint64_t h = FNV_OFFSET_BASIS;
+
+  for (uchar byte : data) {
+    h ^= byte;
+    h *= FNV_PRIME;
+  }
+
+  return h;
+}
+
+const CornerCacheEntry* CornerCache::find(uint64_t key) const {
+  auto it = entries.find(key);
+
+  return it == entries.end() ? nullptr : &it->second;
+}
+
+void CornerCache::touch(uint64_t key) {
+  used.insert(key);
+}
+
+void CornerCache::insert(uint64_t key, const CornerCacheEntry& entry) {
+  entries[key] = entry;
+  used.insert(key);
+  modified = true;
+}
+
+bool CornerCache::save() {
+  if (!modified && used.size() == entries.size()) {
+    return true;
+  }
+
+  cv::FileStorage fs(path.string(), cv::FileStorage::WRITE);
+  if (!fs.isOpened()) {
+    std::cerr << "Warning: Could not write corner cache " << path << "." << std::endl;
+    return false;
+  }
+
+  fs << "version" << CORNER_CACHE_VERSION;
+  fs << "board_width" << boardSize.width;
+  fs << "board_height" << boardSize.height;
+  fs << "flags" << flags;
+
+  fs << "entries" << "[";
+  for (uint64_t key : used) {
+    const CornerCacheEntry& entry = entries.at(key);
+
+    fs << "{";
+    fs << "hash" << keyToString(key);
+    fs << "found" << (int)entry.found;
+    fs << "width" << entry.imageSize.width;
+    fs << "height" << entry.imageSize.height;
+    if (entry.found) {
+      fs << "corners" << entry.corners;
+    }
+    fs << "}";
+  }
+  fs << "]";
+
+  std::erase_if(entries, [this](const auto& entry) { return !used.contains(entry.first); });
+  modified = false;
+
+  return true;
+}
@@ -0,0 +1,125 @@
+#include <frame_pipeline.h>
+
+#include <iostream>
+
+#include <stage_timer.h>
+
+FramePipeline::FramePipeline(FrameSource& videoSource, const MarkerTrackerConfig& config, int workerCount, size_t queueSize) :
+  videoSource(videoSource), captureQueue(queueSize), resultQueue(queueSize) {
+  if (workerCount < 1) {
+    workerCount = 1;
+  }
+
+  // Every worker gets its own tracker, so no detector state is shared between threads.
+  for (int i = 0; i < workerCount; i++) {
+    trackers.push_back(std::make_unique<MarkerTracker>(config));
+  }
+}
+
+FramePipeline::~FramePipeline() {
+  stop();
+}
+
+void FramePipeline::start() {
+  if (running) {
+    return;
+  }
+
+  running = true;
+  activeWorkers = trackers.size();
+
+  for (auto& tracker : trackers) {
+    workerThreads.emplace_back(&FramePipeline::workerLoop, this, std::ref(*tracker));
+  }
+
+  captureThread = std::thread(&FramePipeline::captureLoop, this);
+}
+
+void FramePipeline::stop() {
+  running = false;
+
+  if (captureThread.joinable()) {
+    captureThread.join();
+  }
+
+  // The capture thread closes the capture queue when it exits, so the workers will follow.
+  for (auto& worker : workerThreads) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  workerThreads.clear();
+}
+
+void FramePipeline::captureLoop() {
+  uint64_t sequence = 0;
+
+  while (running) {
+    TrackedFrame frame;
+    bool success;
+
+    {
+      TIME_STAGE(CAPTURE);
+      success = videoSource.read(frame.image, frame.captureTime);
+      frame.encodedImage = videoSource.getEncodedFrame();
+    }
+
+    if (!success) {
+      std::cerr << "Error: Could not read frame." << std::endl;
+      break;
+    }
+
+    frame.sequence = ++sequence;
+    capturedCount++;
+
+    captureQueue.push(std::move(frame));
+  }
+
+  captureQueue.close();
+}
+
+void FramePipeline::workerLoop(MarkerTracker& tracker) {
+  TrackedFrame frame;
+
+  while (captureQueue.pop(frame)) {
+    tracker.process(frame);
+    processedCount++;
+
+    resultQueue.push(std::move(frame));
+  }
+
+  // The last worker to finish tells the consumer that no more results are coming.
+  if (--activeWorkers == 0) {
+    resultQueue.close();
+  }
+}
+
+bool FramePipeline::nextResult(TrackedFrame& frame) {
+  while (resultQueue.pop(frame)) {
+    // With several workers, a frame can finish after a newer one was already handed out.
+    // Showing it would make the output jump back in time, so skip it.
+    if (frame.sequence <= lastDeliveredSequence) {
+      outOfOrderCount++;
+      continue;
+    }
+
+    lastDeliveredSequence = frame.sequence;
+    deliveredCount++;
+
+    return true;
+  }
+
+  return false;
+}
+
+PipelineStats FramePipeline::getStats() const {
+  PipelineStats stats;
+
+  stats.captured = capturedCount;
+  stats.droppedBeforeDetection = captureQueue.dropped();
+  stats.processed = processedCount;
+  stats.droppedBeforeRender = resultQueue.dropped() + outOfOrderCount;
+  stats.delivered = deliveredCount;
+
+  return stats;
+}
@@ -0,0 +1,205 @@
+#include <frame_recording.h>
+
+#include <cstring>
+#include <iostream>
+
+#define RECORDING_MAGIC "TTREC"
+// Larger frames are taken as a corrupt header rather than allocated.
+#define MAX_RECORDED_FRAME_SIDE 65536
+
+namespace {
+
+int64_t toNanoseconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// Check the header of a frame before anything is allocated for it.
+bool validFrameHeader(const RecordedFrameHeader& header) {
+  if (header.rows <= 0 || header.cols <= 0 || header.rows > MAX_RECORDED_FRAME_SIDE || header.cols > MAX_RECORDED_FRAME_SIDE ||
+      header.type != CV_MAT_TYPE(header.type) || CV_MAT_DEPTH(header.type) > CV_16F) {
+    return false;
+  }
+
+  return header.dataSize == (uint64_t)header.rows * header.cols * CV_ELEM_SIZE(header.type);
+}
+
+} // namespace
+
+FrameRecorder::FrameRecorder(const std::string& path, const CameraCalibration* calibration, size_t capacity) :
+  file(path, std::ios::out | std::ios::trunc | std::ios::binary), capacity(capacity > 0 ? capacity : 1) {
+  if (!file.is_open()) {
+    return;
+  }
+
+  RecordingFileHeader header = {};
+  std::memcpy(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+  header.version = RECORDING_VERSION;
+  header.hasCalibration = calibration != nullptr;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  if (calibration != nullptr) {
+    writeCalibration(file, *calibration);
+  }
+
+  writerThread = std::thread(&FrameRecorder::writerLoop, this);
+}
+
+FrameRecorder::~FrameRecorder() {
+  close();
+}
+
+bool FrameRecorder::record(uint64_t sequence, std::chrono::steady_clock::time_point captureTime, const cv::Mat& image) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (closed || !file.is_open()) {
+    return false;
+  }
+
+  if (queue.size() >= capacity) {
+    droppedCount++;
+    return false;
+  }
+
+  // The caller may read the next frame into the same buffer, so the frame has to be copied.
+  queue.push_back(PendingFrame{sequence, captureTime, image.clone()});
+  notEmpty.notify_one();
+
+  return true;
+}
+
+void FrameRecorder::writerLoop() {
+  while (true) {
+    PendingFrame frame;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this] { return closed || !queue.empty(); });
+
+      if (queue.empty()) {
+        return;
+      }
+
+      frame = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    cv::Mat continuous = frame.image.isContinuous() ? frame.image : frame.image.clone();
+
+    RecordedFrameHeader header = {};
+    header.sequence = frame.sequence;
+    header.timestampNs = toNanoseconds(frame.captureTime);
+    header.rows = continuous.rows;
+    header.cols = continuous.cols;
+    header.type = continuous.type();
+    header.dataSize = continuous.total() * continuous.elemSize();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(continuous.data), header.dataSize);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    writtenCount++;
+  }
+}
+
+void FrameRecorder::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+  }
+  notEmpty.notify_all();
+
+  if (writerThread.joinable()) {
+    writerThread.join();
+  }
+
+  if (file.is_open()) {
+    file.close();
+  }
+}
+
+uint64_t FrameRecorder::dropped() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return droppedCount;
+}
+
+uint64_t FrameRecorder::written() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return writtenCount;
+}
+
+bool RecordingSource::read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) {
+  if (!source.read(image, captureTime)) {
+    return false;
+  }
+
+  recorder.record(++sequence, captureTime, image);
+
+  return true;
+}
+
+ReplaySource::ReplaySource(const std::string& path, bool realTime) :
+  file(path, std::ios::binary), realTime(realTime) {
+  if (!file.is_open()) {
+    return;
+  }
+
+  RecordingFileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 || header.version > RECORDING_VERSION) {
+    std::cerr << "Error: " << path << " is not a supported recording." << std::endl;
+    file.close();
+    return;
+  }
+
+  if (header.hasCalibration) {
+    hasCalibration = readCalibration(file, calibration, std::cerr);
+
+    // The frames start after the calibration, so without knowing where it ends they can not be read either.
+    if (!hasCalibration) {
+      std::cerr << "Error: The calibration in " << path << " is corrupt." << std::endl;
+      file.close();
+      return;
+    }
+  }
+
+  // Peek at the first frame for the resolution.
+  std::streampos firstFrame = file.tellg();
+  RecordedFrameHeader frameHeader;
+  if (file.read(reinterpret_cast<char*>(&frameHeader), sizeof(frameHeader)) && validFrameHeader(frameHeader)) {
+    frameSize = cv::Size(frameHeader.cols, frameHeader.rows);
+  }
+  file.clear();
+  file.seekg(firstFrame);
+}
+
+bool ReplaySource::read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) {
+  RecordedFrameHeader header;
+  if (!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return false;
+  }
+
+  if (!validFrameHeader(header)) {
+    std::cerr << "Error: Recording is corrupt." << std::endl;
+    return false;
+  }
+
+  image.create(header.rows, header.cols, header.type);
+  if (!file.read(reinterpret_cast<char*>(image.data), header.dataSize)) {
+    std::cerr << "Error: Recording is truncated or corrupt." << std::endl;
+    return false;
+  }
+
+  if (!started) {
+    started = true;
+    firstTimestampNs = header.timestampNs;
+    startTime = std::chrono::steady_clock::now();
+  }
+
+  captureTime = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(header.timestampNs - firstTimestampNs));
+
+  if (realTime) {
+    std::this_thread::sleep_until(captureTime);
+  }
+
+  return true;
+}
@@ -0,0 +1,114 @@
+#include <latency_budget.h>
+
+#include <algorithm>
+
+LatencyBudgetController::LatencyBudgetController(double budgetMs, const cv::aruco::DetectorParameters& base, int baseDetectionScale) :
+  budgetMs(budgetMs) {
+  DetectionQuality configured = {base.adaptiveThreshWinSizeMin, base.adaptiveThreshWinSizeMax, base.adaptiveThreshWinSizeStep,
+                                 base.minMarkerPerimeterRate, base.cornerRefinementMethod, baseDetectionScale};
+
+  // Better than configured: refine the corners, if that is not done anyway.
+  if (configured.cornerRefinementMethod == cv::aruco::CORNER_REFINE_NONE) {
+    DetectionQuality refined = configured;
+    refined.cornerRefinementMethod = cv::aruco::CORNER_REFINE_SUBPIX;
+    levels.push_back(refined);
+  }
+
+  levels.push_back(configured);
+  level = levels.size() - 1;
+
+  // Fewer threshold window sizes. Every window size is a full adaptive threshold and contour search over the image.
+  DetectionQuality cheaper = configured;
+  cheaper.cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
+  cheaper.adaptiveThreshWinSizeMax = std::min(configured.adaptiveThreshWinSizeMax, configured.adaptiveThreshWinSizeMin + configured.adaptiveThreshWinSizeStep);
+  addCheaperLevel(cheaper);
+
+  cheaper.adaptiveThreshWinSizeMax = cheaper.adaptiveThreshWinSizeMin;
+  cheaper.minMarkerPerimeterRate = std::max(configured.minMarkerPerimeterRate, 0.05);
+  addCheaperLevel(cheaper);
+
+  // Detect on a downscaled image, which only finds markers that are large enough.
+  while (cheaper.detectionScale < 4) {
+    cheaper.detectionScale *= 2;
+    addCheaperLevel(cheaper);
+  }
+}
+
+void LatencyBudgetController::addCheaperLevel(const DetectionQuality& quality) {
+  // A level that changes nothing would only cost settle frames and a level change without saving any time.
+  if (quality != levels.back()) {
+    levels.push_back(quality);
+  }
+}
+
+void LatencyBudgetController::setLevel(size_t newLevel) {
+  level = newLevel;
+  framesAtLevel = 0;
+  stats.levelChanges++;
+}
+
+bool LatencyBudgetController::update(double processingMs, size_t markerCount) {
+  framesAtLevel++;
+  holdFrames = std::max(holdFrames - 1, 0);
+  upgradeHoldFrames = std::max(upgradeHoldFrames - 1, 0);
+
+  if (framesAtLevel == 1) {
+    stats.averageMs = processingMs;
+    stats.averageMarkers = markerCount;
+  } else {
+    stats.averageMs += LATENCY_BUDGET_SMOOTHING * (processingMs - stats.averageMs);
+    stats.averageMarkers += LATENCY_BUDGET_SMOOTHING * (markerCount - stats.averageMarkers);
+  }
+
+  if (framesAtLevel < LATENCY_BUDGET_SETTLE_FRAMES) {
+    return false;
+  }
+
+  bool overBudget = stats.averageMs > budgetMs * (holdFrames > 0 ? LATENCY_BUDGET_HARD_OVERRUN : 1.0);
+
+  if (overBudget && level + 1 < levels.size()) {
+    // The better level did not fit into the budget right after trying it, so do not try again too soon.
+    if (steppedUp) {
+      upgradeHoldFrames = LATENCY_BUDGET_HOLD_FRAMES;
+    }
+
+    referenceMarkers = stats.averageMarkers;
+    steppedUp = false;
+    setLevel(level + 1);
+    return true;
+  }
+
+  steppedUp = false;
+
+  if (level == 0) {
+    return false;
+  }
+
+  // The cheaper settings miss markers the better ones found.
+  if (referenceMarkers >= 0 && stats.averageMarkers < referenceMarkers - LATENCY_BUDGET_MARKER_LOSS) {
+    stats.markerLossReverts++;
+    holdFrames = LATENCY_BUDGET_HOLD_FRAMES;
+    referenceMarkers = -1;
+    setLevel(level - 1);
+    return true;
+  }
+
+  if (stats.averageMs < budgetMs * LATENCY_BUDGET_HEADROOM && upgradeHoldFrames == 0) {
+    referenceMarkers = -1;
+    steppedUp = true;
+    setLevel(level - 1);
+    return true;
+  }
+
+  return false;
+}
+
+void LatencyBudgetController::apply(cv::aruco::DetectorParameters& params) const {
+  const DetectionQuality& quality = levels[level];
+
+  params.adaptiveThreshWinSizeMin = quality.adaptiveThreshWinSizeMin;
+  params.adaptiveThreshWinSizeMax = quality.adaptiveThreshWinSizeMax;
+  params.adaptiveThreshWinSizeStep = quality.adaptiveThreshWinSizeStep;
+  params.minMarkerPerimeterRate = quality.minMarkerPerimeterRate;
+  params.cornerRefinementMethod = quality.cornerRefinementMethod;
+}
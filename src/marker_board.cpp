@@ -0,0 +1,199 @@
+#include <marker_board.h>
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#include <allocation_counter.h>
+
+namespace {
+
+bool readBoard(const cv::FileNode& node, MarkerBoard& board, std::set<int>& usedMarkerIds, const std::filesystem::path& path, std::ostream& err) {
+  board.name = node["name"].empty() ? std::string() : node["name"].string();
+
+  if (node["id"].empty()) {
+    err << "Board " << board.name << " in " << path << " has no id." << std::endl;
+    return false;
+  }
+  board.id = (int)node["id"];
+
+  cv::FileNode markers = node["markers"];
+  if (markers.empty() || markers.size() == 0) {
+    err << "Board " << board.name << " in " << path << " has no markers." << std::endl;
+    return false;
+  }
+
+  float minCoordinate[3] = {INFINITY, INFINITY, INFINITY};
+  float maxCoordinate[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+  for (size_t i = 0; i < markers.size(); i++) {
+    cv::FileNode marker = markers[(int)i];
+    std::vector<float> values;
+    marker["corners"] >> values;
+
+    if (marker["id"].empty() || values.size() != 12) {
+      err << "Marker " << i << " of board " << board.name << " in " << path << " needs an id and 12 corner coordinates (x, y, z of four corners)." << std::endl;
+      return false;
+    }
+
+    int markerId = (int)marker["id"];
+    if (!usedMarkerIds.insert(markerId).second) {
+      err << "Marker " << markerId << " is used more than once in " << path << "." << std::endl;
+      return false;
+    }
+
+    std::array<cv::Point3f, 4> corners;
+    for (int c = 0; c < 4; c++) {
+      corners[c] = cv::Point3f(values[3 * c], values[3 * c + 1], values[3 * c + 2]);
+
+      for (int k = 0; k < 3; k++) {
+        minCoordinate[k] = std::min(minCoordinate[k], values[3 * c + k]);
+        maxCoordinate[k] = std::max(maxCoordinate[k], values[3 * c + k]);
+      }
+    }
+
+    board.markerIds.push_back(markerId);
+    board.markerCorners.push_back(corners);
+  }
+
+  float extent = 0;
+  for (int k = 0; k < 3; k++) {
+    extent = std::max(extent, maxCoordinate[k] - minCoordinate[k]);
+  }
+  board.axisLength = 0.5f * extent;
+
+  return true;
+}
+
+} // namespace
+
+bool loadBoards(const std::filesystem::path& path, int dictionarySize, std::vector<MarkerBoard>& boards, std::ostream& err) {
+  cv::FileStorage fs;
+
+  try {
+    fs.open(path.string(), cv::FileStorage::READ);
+  } catch (const cv::Exception&) {
+  }
+
+  if (!fs.isOpened()) {
+    err << "Could not parse board file " << path << "." << std::endl;
+    return false;
+  }
+
+  cv::FileNode boardNodes = fs["boards"];
+  if (boardNodes.empty() || boardNodes.size() == 0) {
+    err << "Board file " << path << " does not define any boards." << std::endl;
+    return false;
+  }
+
+  std::vector<MarkerBoard> loaded;
+  std::set<int> usedMarkerIds;
+
+  for (size_t i = 0; i < boardNodes.size(); i++) {
+    MarkerBoard board;
+
+    if (!readBoard(boardNodes[(int)i], board, usedMarkerIds, path, err)) {
+      return false;
+    }
+
+    if (board.id >= 0 && board.id < dictionarySize) {
+      err << "Board id " << board.id << " in " << path << " is also a marker id of the dictionary. Use an id of at least " << dictionarySize << "." << std::endl;
+      return false;
+    }
+
+    for (const MarkerBoard& other : loaded) {
+      if (other.id == board.id) {
+        err << "Board id " << board.id << " is used more than once in " << path << "." << std::endl;
+        return false;
+      }
+    }
+
+    loaded.push_back(board);
+  }
+
+  boards = loaded;
+
+  return true;
+}
+
+BoardPoseSolver::BoardPoseSolver(const std::vector<MarkerBoard>& boards, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs) :
+  boards(boards), cameraMatrix(cameraMatrix.clone()), distCoeffs(distCoeffs.clone()), points(boards.size()) {
+  for (size_t b = 0; b < boards.size(); b++) {
+    for (size_t m = 0; m < boards[b].markerIds.size(); m++) {
+      markerLookup[boards[b].markerIds[m]] = std::make_pair(b, m);
+    }
+
+    points[b].markerUsed.resize(boards[b].markerIds.size());
+  }
+}
+
+void BoardPoseSolver::solve(const std::vector<int>& markerIds, const std::vector<std::vector<cv::Point2f> >& markerCorners, std::vector<BoardPose>& poses) {
+  poses.clear();
+
+  if (boards.empty()) {
+    return;
+  }
+
+  for (BoardPoints& board : points) {
+    board.objectPoints.clear();
+    board.imagePoints.clear();
+    std::fill(board.markerUsed.begin(), board.markerUsed.end(), 0);
+    board.markerCount = 0;
+  }
+
+  // Gather the corners of all detected markers per board.
+  for (size_t i = 0; i < markerIds.size() && i < markerCorners.size(); i++) {
+    auto it = markerLookup.find(markerIds[i]);
+    if (it == markerLookup.end()) {
+      continue;
+    }
+
+    auto [b, m] = it->second;
+    BoardPoints& board = points[b];
+
+    if (board.markerUsed[m]) {
+      continue;
+    }
+    board.markerUsed[m] = 1;
+    board.markerCount++;
+
+    for (int c = 0; c < 4; c++) {
+      board.objectPoints.push_back(boards[b].markerCorners[m][c]);
+      board.imagePoints.push_back(markerCorners[i][c]);
+    }
+  }
+
+  for (size_t b = 0; b < boards.size(); b++) {
+    BoardPoints& board = points[b];
+
+    if (board.markerCount == 0) {
+      continue;
+    }
+
+    BoardPose pose;
+    pose.boardId = boards[b].id;
+    pose.markerCount = board.markerCount;
+
+    {
+      IGNORE_ALLOCATIONS();
+
+      // SQPnP finds the global minimum without an initial guess, also for coplanar corners (boards seen with a single marker).
+      // The Levenberg-Marquardt refinement then minimizes the reprojection error itself.
+      if (!cv::solvePnP(board.objectPoints, board.imagePoints, cameraMatrix, distCoeffs, pose.rvec, pose.tvec, false, cv::SOLVEPNP_SQPNP)) {
+        continue;
+      }
+      cv::solvePnPRefineLM(board.objectPoints, board.imagePoints, cameraMatrix, distCoeffs, pose.rvec, pose.tvec);
+
+      cv::projectPoints(board.objectPoints, pose.rvec, pose.tvec, cameraMatrix, distCoeffs, board.projectedPoints);
+    }
+
+    double sum = 0;
+    for (size_t p = 0; p < board.imagePoints.size(); p++) {
+      cv::Point2f difference = board.projectedPoints[p] - board.imagePoints[p];
+      sum += difference.dot(difference);
+    }
+    pose.reprojectionError = std::sqrt(sum / board.imagePoints.size());
+
+    poses.push_back(pose);
+  }
+}
@@ -0,0 +1,328 @@
+#include <marker_identifier.h>
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+#include <allocation_counter.h>
+
+namespace {
+
+// Integer type that holds the inner bits of a marker. 6x6 to 8x8 markers all need 64 bits.
+template <int MarkerSize>
+struct MarkerCode {
+  typedef uint64_t type;
+};
+
+template <>
+struct MarkerCode<4> {
+  typedef uint16_t type;
+};
+
+template <>
+struct MarkerCode<5> {
+  typedef uint32_t type;
+};
+
+// Find the first marker with a rotation within maxDistance bits of code, and its closest rotation (the first one on ties),
+// which is what cv::aruco::Dictionary::identify returns.
+template <int MarkerSize>
+bool searchCodes(const void* table, size_t markerCount, uint64_t code, int maxDistance, int& id, int& rotation) {
+  typedef typename MarkerCode<MarkerSize>::type Code;
+  const Code* codes = static_cast<const Code*>(table);
+  const Code candidate = (Code)code;
+
+  // The distances of a whole block of markers are computed without any branches, which the compiler can vectorize,
+  // and the block is only looked at closer if any of them is small enough. Most candidates match nothing at all.
+  constexpr size_t blockSize = 64;
+  uint8_t distances[4 * blockSize];
+
+  for (size_t first = 0; first < markerCount; first += blockSize) {
+    size_t count = std::min(blockSize, markerCount - first);
+    const Code* block = codes + 4 * first;
+    uint8_t closest = 255;
+
+    for (size_t i = 0; i < 4 * count; i++) {
+      distances[i] = (uint8_t)std::popcount((Code)(block[i] ^ candidate));
+      closest = std::min(closest, distances[i]);
+    }
+
+    if (closest > maxDistance) {
+      continue;
+    }
+
+    for (size_t m = 0; m < count; m++) {
+      const uint8_t* markerDistances = distances + 4 * m;
+      int closestRotation = 0;
+
+      for (int r = 1; r < 4; r++) {
+        if (markerDistances[r] < markerDistances[closestRotation]) {
+          closestRotation = r;
+        }
+      }
+
+      if (markerDistances[closestRotation] <= maxDistance) {
+        id = first + m;
+        rotation = closestRotation;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Otsu's threshold of a histogram, computed exactly like cv::threshold does, so the same cells come out.
+int otsuThreshold(const int* histogram, int total) {
+  double scale = 1.0 / total;
+  double mu = 0;
+
+  for (int i = 0; i < 256; i++) {
+    mu += i * (double)histogram[i];
+  }
+  mu *= scale;
+
+  double mu1 = 0, q1 = 0;
+  double maxSigma = 0;
+  int threshold = 0;
+
+  for (int i = 0; i < 256; i++) {
+    double p = histogram[i] * scale;
+    mu1 *= q1;
+    q1 += p;
+    double q2 = 1.0 - q1;
+
+    if (std::min(q1, q2) < FLT_EPSILON || std::max(q1, q2) > 1.0 - FLT_EPSILON) {
+      continue;
+    }
+
+    mu1 = (mu1 + i * p) / q1;
+    double mu2 = (mu - q1 * mu1) / q2;
+    double sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+
+    if (sigma > maxSigma) {
+      maxSigma = sigma;
+      threshold = i;
+    }
+  }
+
+  return threshold;
+}
+
+} // namespace
+
+MarkerIdentifier::MarkerIdentifier(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params) :
+  markerSize(dictionary.markerSize),
+  markerCount(dictionary.bytesList.rows),
+  maxCorrectionBits(int(double(dictionary.maxCorrectionBits) * params.errorCorrectionRate)),
+  params(params) {
+  int cellCount = markerSize + 2 * params.markerBorderBits;
+  int sampleSize = cellCount * params.perspectiveRemovePixelPerCell;
+  samples.resize(sampleSize * sampleSize);
+  cells.resize(cellCount * cellCount);
+
+  int bitCount = markerSize * markerSize;
+  if (bitCount > 64) {
+    return;
+  }
+
+  // The dictionary stores every rotation as bytes of 8 bits, with the remaining bits in the low bits of the last byte.
+  int fullBytes = bitCount / 8;
+  int remainingBits = bitCount % 8;
+  int byteCount = fullBytes + (remainingBits > 0);
+  std::vector<uint64_t> allCodes(4 * markerCount);
+
+  for (int m = 0; m < markerCount; m++) {
+    for (int r = 0; r < 4; r++) {
+      const uchar* bytes = dictionary.bytesList.ptr(m) + r * byteCount;
+      uint64_t code = 0;
+
+      for (int i = 0; i < fullBytes; i++) {
+        code = (code << 8) | bytes[i];
+      }
+      if (remainingBits > 0) {
+        code = (code << remainingBits) | bytes[fullBytes];
+      }
+
+      allCodes[4 * m + r] = code;
+
+      // The codes of a predefined dictionary are further apart than twice the correctable bits, so an exact match is
+      // also the match of the linear search, as long as no more than those bits are corrected. The first marker and
+      // rotation with a code is kept, like the linear search would find it.
+      if (params.errorCorrectionRate <= 1) {
+        exactCodes.emplace(code, 4 * m + r);
+      }
+    }
+  }
+
+  switch (markerSize) {
+    case 4:
+      codes16.assign(allCodes.begin(), allCodes.end());
+      codes = codes16.data();
+      search = searchCodes<4>;
+      break;
+    case 5:
+      codes32.assign(allCodes.begin(), allCodes.end());
+      codes = codes32.data();
+      search = searchCodes<5>;
+      break;
+    default:
+      codes64 = std::move(allCodes);
+      codes = codes64.data();
+      search = markerSize == 6 ? searchCodes<6> : markerSize == 7 ? searchCodes<7> : searchCodes<8>;
+      break;
+  }
+}
+
+bool MarkerIdentifier::identify(const cv::Mat& gray, std::vector<cv::Point2f>& corners, int& id) {
+  uint64_t code;
+  int rotation;
+
+  if (!extractCode(gray, corners, code) || !lookup(code, id, rotation)) {
+    return false;
+  }
+
+  std::rotate(corners.begin(), corners.begin() + 4 - rotation, corners.end());
+  return true;
+}
+
+bool MarkerIdentifier::extractCode(const cv::Mat& gray, const std::vector<cv::Point2f>& corners, uint64_t& code) {
+  if (!isSupported() || corners.size() != 4) {
+    return false;
+  }
+
+  int border = params.markerBorderBits;
+  int cellSize = params.perspectiveRemovePixelPerCell;
+  int cellCount = markerSize + 2 * border;
+  int sampleSize = cellCount * cellSize;
+  float last = sampleSize - 1;
+  const cv::Point2f square[4] = {{0, 0}, {last, 0}, {last, last}, {0, last}};
+
+  // The stock detector warps the candidate onto a square with this transform, using nearest neighbor interpolation.
+  // Inverting it maps every pixel of that square straight to the pixel it would have been copied from.
+  cv::Matx33d transform;
+  {
+    IGNORE_ALLOCATIONS();
+    transform = cv::getPerspectiveTransform(corners.data(), square);
+  }
+  transform = transform.inv();
+
+  int histogram[256] = {};
+  // Contrast is only measured on the inner part of the square, half a cell away from its edges.
+  int innerStart = cellSize / 2;
+  int innerEnd = sampleSize - cellSize / 2;
+  uint64_t innerSum = 0, innerSquares = 0;
+
+  for (int y = 0; y < sampleSize; y++) {
+    for (int x = 0; x < sampleSize; x++) {
+      double w = transform(2, 0) * x + transform(2, 1) * y + transform(2, 2);
+      w = w ? 1.0 / w : 0;
+      int sourceX = cvRound(std::clamp((transform(0, 0) * x + transform(0, 1) * y + transform(0, 2)) * w, (double)INT_MIN, (double)INT_MAX));
+      int sourceY = cvRound(std::clamp((transform(1, 0) * x + transform(1, 1) * y + transform(1, 2)) * w, (double)INT_MIN, (double)INT_MAX));
+
+      // Outside of the image counts as black, like the constant border of cv::warpPerspective.
+      uchar value = (unsigned)sourceX < (unsigned)gray.cols && (unsigned)sourceY < (unsigned)gray.rows ? gray.ptr(sourceY)[sourceX] : 0;
+      samples[y * sampleSize + x] = value;
+      histogram[value]++;
+
+      if (x >= innerStart && x < innerEnd && y >= innerStart && y < innerEnd) {
+        innerSum += value;
+        innerSquares += value * value;
+      }
+    }
+  }
+
+  double innerCount = double(innerEnd - innerStart) * (innerEnd - innerStart);
+  double mean = innerSum / innerCount;
+  double stdDev = std::sqrt(std::max(innerSquares / innerCount - mean * mean, 0.0));
+
+  if (stdDev < params.minOtsuStdDev) {
+    // Too little contrast to tell black from white cells, so they are all taken as one or the other.
+    std::fill(cells.begin(), cells.end(), mean > 127 ? 1 : 0);
+  } else {
+    int threshold = otsuThreshold(histogram, sampleSize * sampleSize);
+    int margin = int(params.perspectiveRemoveIgnoredMarginPerCell * cellSize);
+    int cellInterior = cellSize - 2 * margin;
+
+    // A cell is white if more than half of its interior is above the threshold.
+    for (int cy = 0; cy < cellCount; cy++) {
+      for (int cx = 0; cx < cellCount; cx++) {
+        int whiteCount = 0;
+
+        for (int y = cy * cellSize + margin; y < cy * cellSize + margin + cellInterior; y++) {
+          const uchar* row = samples.data() + y * sampleSize;
+          for (int x = cx * cellSize + margin; x < cx * cellSize + margin + cellInterior; x++) {
+            whiteCount += row[x] > threshold;
+          }
+        }
+
+        cells[cy * cellCount + cx] = whiteCount > cellInterior * cellInterior / 2;
+      }
+    }
+  }
+
+  int borderErrors = countBorderErrors(false);
+  bool inverted = false;
+
+  if (params.detectInvertedMarker) {
+    int invertedErrors = countBorderErrors(true);
+    if (invertedErrors < borderErrors) {
+      borderErrors = invertedErrors;
+      inverted = true;
+    }
+  }
+
+  if (borderErrors > int(markerSize * markerSize * params.maxErroneousBitsInBorderRate)) {
+    return false;
+  }
+
+  code = 0;
+  for (int y = border; y < border + markerSize; y++) {
+    for (int x = border; x < border + markerSize; x++) {
+      code = (code << 1) | (cells[y * cellCount + x] ^ inverted);
+    }
+  }
+
+  return true;
+}
+
+int MarkerIdentifier::countBorderErrors(bool inverted) const {
+  int border = params.markerBorderBits;
+  int cellCount = markerSize + 2 * border;
+  int errors = 0;
+
+  for (int y = 0; y < cellCount; y++) {
+    for (int x = 0; x < cellCount; x++) {
+      bool isBorder = x < border || y < border || x >= cellCount - border || y >= cellCount - border;
+      errors += isBorder && (cells[y * cellCount + x] ^ inverted);
+    }
+  }
+
+  return errors;
+}
+
+bool MarkerIdentifier::lookup(uint64_t code, int& id, int& rotation) const {
+  if (!isSupported()) {
+    return false;
+  }
+
+  auto exact = exactCodes.find(code);
+  if (exact != exactCodes.end()) {
+    id = exact->second / 4;
+    rotation = exact->second % 4;
+    return true;
+  }
+
+  return search(codes, markerCount, code, maxCorrectionBits, id, rotation);
+}
+
+void MarkerIdentifier::unpackCode(uint64_t code, cv::Mat& bits) const {
+  int bitCount = markerSize * markerSize;
+  bits.create(markerSize, markerSize, CV_8U);
+
+  for (int i = 0; i < bitCount; i++) {
+    bits.at<uchar>(i / markerSize, i % markerSize) = (code >> (bitCount - 1 - i)) & 1;
+  }
+}
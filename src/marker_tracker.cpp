@@ -0,0 +1,321 @@
+#include <marker_tracker.h>
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <iterator>
+#include <string>
+
+#include <allocation_counter.h>
+#include <stage_timer.h>
+
+MarkerTracker::MarkerTracker(const MarkerTrackerConfig& config) :
+  config(config),
+  detector(cv::aruco::getPredefinedDictionary(config.dict), config.detectorParams),
+  poseSolver(config.markerLength, config.cameraMatrix, config.distCoeffs),
+  poseFilter(config.markerLength, config.cameraMatrix, config.distCoeffs, config.filterConfig),
+  boardSolver(config.boards, config.cameraMatrix, config.distCoeffs) {
+  // The matrices passed in may be views of memory owned by the caller.
+  this->config.cameraMatrix = config.cameraMatrix.clone();
+  this->config.distCoeffs = config.distCoeffs.clone();
+
+  if (config.tileThreads > 0) {
+    tiledDetector = std::make_unique<TiledDetector>(cv::aruco::getPredefinedDictionary(config.dict), config.detectorParams, config.fastCandidates,
+                                                    config.markerLength, config.minMarkerDistance, config.maxMarkerDistance, config.tileThreads);
+  } else if (config.fastCandidates) {
+    candidateDetector = std::make_unique<CandidateDetector>(cv::aruco::getPredefinedDictionary(config.dict), config.detectorParams);
+  }
+
+  if (config.latencyBudgetMs > 0) {
+    budgetController = std::make_unique<LatencyBudgetController>(config.latencyBudgetMs, config.detectorParams, config.detectionScale);
+    applyDetectionQuality();
+  }
+}
+
+void MarkerTracker::process(TrackedFrame& frame) {
+  auto start = std::chrono::steady_clock::now();
+
+  detect(frame);
+  estimatePose(frame);
+
+  if (budgetController) {
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (budgetController->update(milliseconds, frame.markerIds.size())) {
+      applyDetectionQuality();
+    }
+  }
+}
+
+void MarkerTracker::applyDetectionQuality() {
+  budgetController->apply(config.detectorParams);
+  detector.setDetectorParameters(config.detectorParams);
+  if (candidateDetector) {
+    candidateDetector->setDetectorParameters(config.detectorParams);
+  }
+  if (tiledDetector) {
+    tiledDetector->setDetectorParameters(config.detectorParams);
+  }
+
+  int detectionScale = budgetController->getQuality().detectionScale;
+  if (detectionScale != config.detectionScale) {
+    config.detectionScale = detectionScale;
+    // The previous corners are in the coordinates of the old search image, so the next frame is searched completely.
+    previousCorners.clear();
+  }
+}
+
+void MarkerTracker::detect(TrackedFrame& frame) {
+  TIME_STAGE(DETECT);
+
+  const cv::Mat& searchImage = prepareSearchImage(frame.image);
+
+  bool fullScan = !config.roiTracking || previousCorners.empty() || framesSinceFullScan + 1 >= config.fullScanInterval;
+
+  if (!fullScan) {
+    roiScanCount++;
+    framesSinceFullScan++;
+
+    // If any marker got lost, it may just have moved further than the margin allows, so look at the whole frame.
+    fullScan = !detectInRegions(searchImage, frame);
+  }
+
+  if (fullScan) {
+    IGNORE_ALLOCATIONS();
+    detectMarkers(searchImage, frame.markerCorners, frame.markerIds, frame.rejectedCandidates);
+    fullScanCount++;
+    framesSinceFullScan = 0;
+  }
+
+  if (config.roiTracking) {
+    previousCorners = frame.markerCorners;
+    previousIds = frame.markerIds;
+  }
+
+  if (config.detectionScale > 1) {
+    refineCorners(frame);
+  }
+}
+
+void MarkerTracker::detectMarkers(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                                  std::vector<std::vector<cv::Point2f> >& rejected) {
+  if (tiledDetector) {
+    // The search image is downscaled by detectionScale, and so is its focal length.
+    tiledDetector->detectMarkers(image, config.cameraMatrix.at<double>(0, 0) / config.detectionScale, corners, ids, rejected);
+  } else if (candidateDetector) {
+    candidateDetector->detectMarkers(image, corners, ids, rejected);
+  } else {
+    detector.detectMarkers(image, corners, ids, rejected);
+  }
+}
+
+const cv::Mat& MarkerTracker::prepareSearchImage(const cv::Mat& image) {
+  if (config.detectionScale <= 1) {
+    return image;
+  }
+
+  IGNORE_ALLOCATIONS();
+
+  if (image.channels() == 3) {
+    cv::cvtColor(image, grayImage, cv::COLOR_BGR2GRAY);
+  } else {
+    grayImage = image;
+  }
+
+  double factor = 1.0 / config.detectionScale;
+  cv::resize(grayImage, scaledImage, cv::Size(), factor, factor, cv::INTER_AREA);
+
+  return scaledImage;
+}
+
+void MarkerTracker::refineCorners(TrackedFrame& frame) {
+  float scale = config.detectionScale;
+  // Pixel centers of the downscaled image are not at integer multiples of the full resolution pixels.
+  float offset = 0.5f * (scale - 1.f);
+
+  // A corner in the downscaled image can be off by up to one downscaled pixel (i.e. scale pixels at full resolution),
+  // so the search window needs to be a bit larger than that.
+  int halfWindow = std::max(3, 2 * config.detectionScale);
+  cv::TermCriteria criteria(cv::TermCriteria::EPS | cv::TermCriteria::MAX_ITER, 30, 0.01);
+
+  for (auto& corners : frame.markerCorners) {
+    for (cv::Point2f& corner : corners) {
+      corner = corner * scale + cv::Point2f(offset, offset);
+    }
+
+    // Only the small windows around the corners are touched at full resolution.
+    IGNORE_ALLOCATIONS();
+    cv::cornerSubPix(grayImage, corners, cv::Size(halfWindow, halfWindow), cv::Size(-1, -1), criteria);
+  }
+
+  for (auto& candidate : frame.rejectedCandidates) {
+    for (cv::Point2f& corner : candidate) {
+      corner = corner * scale + cv::Point2f(offset, offset);
+    }
+  }
+}
+
+void MarkerTracker::updateSearchRegions(const cv::Size& imageSize) {
+  cv::Rect imageRect(cv::Point(0, 0), imageSize);
+  searchRegions.clear();
+
+  for (const auto& corners : previousCorners) {
+    cv::Rect box = cv::boundingRect(corners);
+    int margin = std::ceil(std::max(box.width, box.height) * config.roiMargin);
+
+    box.x -= margin;
+    box.y -= margin;
+    box.width += 2 * margin;
+    box.height += 2 * margin;
+    box &= imageRect;
+
+    if (!box.empty()) {
+      searchRegions.push_back(box);
+    }
+  }
+
+  // Merge overlapping regions, otherwise a marker in the overlap would be detected twice.
+  bool merged = true;
+  while (merged) {
+    merged = false;
+
+    for (size_t i = 0; i < searchRegions.size() && !merged; i++) {
+      for (size_t j = i + 1; j < searchRegions.size() && !merged; j++) {
+        if ((searchRegions[i] & searchRegions[j]).area() > 0) {
+          searchRegions[i] |= searchRegions[j];
+          searchRegions.erase(searchRegions.begin() + j);
+          merged = true;
+        }
+      }
+    }
+  }
+}
+
+void MarkerTracker::appendCorners(std::vector<std::vector<cv::Point2f> >& list, size_t index, const std::vector<cv::Point2f>& corners) {
+  if (index < list.size()) {
+    list[index].assign(corners.begin(), corners.end());
+  } else {
+    list.push_back(corners);
+  }
+}
+
+bool MarkerTracker::detectInRegions(const cv::Mat& searchImage, TrackedFrame& frame) {
+  updateSearchRegions(searchImage.size());
+
+  // The corner vectors of the frame are overwritten in place instead of cleared, so their buffers are reused from frame to frame.
+  size_t markerCount = 0;
+  size_t rejectedCount = 0;
+  frame.markerIds.clear();
+
+  for (const cv::Rect& region : searchRegions) {
+    {
+      // Detecting in a view of the frame does not copy any pixels.
+      IGNORE_ALLOCATIONS();
+      detectMarkers(searchImage(region), roiCorners, roiIds, roiRejected);
+    }
+
+    cv::Point2f offset(region.x, region.y);
+
+    for (size_t i = 0; i < roiIds.size(); i++) {
+      for (cv::Point2f& corner : roiCorners[i]) {
+        corner += offset;
+      }
+
+      frame.markerIds.push_back(roiIds[i]);
+      appendCorners(frame.markerCorners, markerCount++, roiCorners[i]);
+    }
+
+    for (auto& candidate : roiRejected) {
+      for (cv::Point2f& corner : candidate) {
+        corner += offset;
+      }
+
+      appendCorners(frame.rejectedCandidates, rejectedCount++, candidate);
+    }
+  }
+
+  frame.markerCorners.resize(markerCount);
+  frame.rejectedCandidates.resize(rejectedCount);
+
+  // Finding as many markers as before is not enough, a new marker may have moved into a region while another one got lost.
+  for (int id : previousIds) {
+    if (std::find(frame.markerIds.begin(), frame.markerIds.end(), id) == frame.markerIds.end()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void MarkerTracker::estimatePose(TrackedFrame& frame) {
+  TIME_STAGE(POSE);
+
+  poseSolver.solve(frame.markerCorners, frame.poses);
+
+  if (config.temporalFilter) {
+    poseFilter.update(frame.markerIds, frame.markerCorners, frame.captureTime, frame.poses);
+  }
+
+  boardSolver.solve(frame.markerIds, frame.markerCorners, frame.boardPoses);
+}
+
+void MarkerTracker::drawOverlay(cv::Mat& canvas, const TrackedFrame& frame, double scale) const {
+  const std::vector<std::vector<cv::Point2f> >* corners = &frame.markerCorners;
+  cv::Mat cameraMatrix = config.cameraMatrix;
+  std::vector<std::vector<cv::Point2f> > scaledCorners;
+
+  // Projecting into a resized canvas only needs the corners and the camera matrix scaled the same way.
+  if (scale != 1.0) {
+    scaledCorners = frame.markerCorners;
+    for (std::vector<cv::Point2f>& markerCorners : scaledCorners) {
+      for (cv::Point2f& corner : markerCorners) {
+        corner *= scale;
+      }
+    }
+    corners = &scaledCorners;
+
+    cameraMatrix = config.cameraMatrix.clone();
+    cameraMatrix.at<double>(0, 0) *= scale;
+    cameraMatrix.at<double>(0, 2) *= scale;
+    cameraMatrix.at<double>(1, 1) *= scale;
+    cameraMatrix.at<double>(1, 2) *= scale;
+  }
+
+  cv::aruco::drawDetectedMarkers(canvas, *corners, frame.markerIds);
+
+  size_t nMarkers = corners->size();
+
+  // Draw pose estimation axes to the frame.
+  for (size_t i = 0; i < nMarkers; i++) {
+    cv::drawFrameAxes(canvas, cameraMatrix, config.distCoeffs, frame.poses.rvecs[i], frame.poses.tvecs[i], config.markerLength * 0.7f, 2);
+  }
+
+  // Boards get thicker axes, so they stand out from those of their markers.
+  for (const BoardPose& pose : frame.boardPoses) {
+    for (const MarkerBoard& board : boardSolver.getBoards()) {
+      if (board.id == pose.boardId) {
+        cv::drawFrameAxes(canvas, cameraMatrix, config.distCoeffs, pose.rvec, pose.tvec, board.axisLength, 4);
+      }
+    }
+  }
+
+  // Write marker position under the marker.
+  static const char* axisNames[3] = {"X", "Y", "Z"};
+  const cv::Scalar axisColors[3] = {RED, GREEN, BLUE};
+  // One string is reused for all labels, instead of building new ones with to_string and concatenation.
+  std::string label;
+
+  for (size_t i = 0; i < nMarkers; i++) {
+    // Bottom left corner of the marker.
+    cv::Point2f textStart = corners->at(i).at(3);
+
+    for (int j = 0; j < 3; j++) {
+      // Text reference point is bottom left, and we want it to be top left, so offset origin by font height.
+      textStart.y += TEXT_SCALE * FONT_HEIGHT;
+
+      label.clear();
+      std::format_to(std::back_inserter(label), "{}: {:f}", axisNames[j], frame.poses.tvecs.at(i)[j]);
+      cv::putText(canvas, label, textStart, cv::FONT_HERSHEY_SIMPLEX, TEXT_SCALE, axisColors[j], TEXT_LINE_THICKNESS, cv::LINE_AA);
+    }
+  }
+}
@@ -0,0 +1,325 @@
+#include <mjpeg_stream_source.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+std::string toLower(std::string str) {
+  std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+  return str;
+}
+
+// Value of a header line like "Content-Length: 1234" if its name matches (case insensitive), otherwise an empty string.
+std::string headerValue(const std::string& line, const std::string& name) {
+  if (line.size() <= name.size() || toLower(line.substr(0, name.size())) != name || line[name.size()] != ':') {
+    return "";
+  }
+
+  size_t start = line.find_first_not_of(" \t", name.size() + 1);
+  return start == std::string::npos ? "" : line.substr(start);
+}
+
+int decodeFlags(int scale, bool grayscale) {
+  switch (scale) {
+    case 2:
+      return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+    case 4:
+      return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+    case 8:
+      return grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+    default:
+      return grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+  }
+}
+
+} // namespace
+
+bool decodeJpeg(const cv::Mat& encoded, int scale, bool grayscale, cv::Mat& image) {
+  if (encoded.empty()) {
+    return false;
+  }
+
+  // Passing the destination lets imdecode reuse its buffer.
+  cv::imdecode(encoded, decodeFlags(scale, grayscale), &image);
+
+  return !image.empty();
+}
+
+MjpegStreamSource::MjpegStreamSource(const std::string& url, int scale) :
+  scale(isValidDecodeScale(scale) ? scale : 1), buffer(MJPEG_READ_BUFFER_SIZE) {
+  if (!connectTo(url)) {
+    if (socketFd >= 0) {
+      close(socketFd);
+      socketFd = -1;
+    }
+    return;
+  }
+
+  // Read the first frame now, so the resolution is known before processing starts.
+  havePendingFrame = readFrame(pendingImage, pendingCaptureTime);
+  if (!havePendingFrame) {
+    std::cerr << "Error: Could not read a frame from " << url << "." << std::endl;
+    close(socketFd);
+    socketFd = -1;
+    return;
+  }
+
+  frameSize = pendingImage.size();
+}
+
+MjpegStreamSource::~MjpegStreamSource() {
+  if (socketFd >= 0) {
+    close(socketFd);
+  }
+}
+
+bool MjpegStreamSource::connectTo(const std::string& url) {
+  const std::string scheme = "http://";
+  if (!url.starts_with(scheme)) {
+    std::cerr << "Error: Only http:// URLs can be read as MJPEG stream, got " << url << "." << std::endl;
+    return false;
+  }
+
+  size_t pathStart = url.find('/', scheme.size());
+  std::string hostPort = url.substr(scheme.size(), pathStart == std::string::npos ? std::string::npos : pathStart - scheme.size());
+  std::string path = pathStart == std::string::npos ? "/" : url.substr(pathStart);
+
+  std::string host = hostPort;
+  std::string port = "80";
+  size_t colon = hostPort.rfind(':');
+  if (colon != std::string::npos) {
+    host = hostPort.substr(0, colon);
+    port = hostPort.substr(colon + 1);
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+
+  int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    std::cerr << "Error: Could not resolve " << host << ": " << gai_strerror(result) << std::endl;
+    return false;
+  }
+
+  for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+    socketFd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (socketFd < 0) {
+      continue;
+    }
+
+    if (connect(socketFd, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(socketFd);
+    socketFd = -1;
+  }
+  freeaddrinfo(addresses);
+
+  if (socketFd < 0) {
+    std::cerr << "Error: Could not connect to " << hostPort << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  // HTTP/1.0, so the server does not use chunked transfer encoding.
+  std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + hostPort + "\r\nConnection: close\r\n\r\n";
+  if (send(socketFd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+    std::cerr << "Error: Could not send request to " << hostPort << "." << std::endl;
+    return false;
+  }
+
+  std::string line;
+  if (!readLine(line) || line.find(" 200") == std::string::npos) {
+    std::cerr << "Error: " << url << " answered with \"" << line << "\"." << std::endl;
+    return false;
+  }
+
+  while (readLine(line) && !line.empty()) {
+    std::string contentType = headerValue(line, "content-type");
+    size_t boundaryStart = toLower(contentType).find("boundary=");
+
+    if (boundaryStart != std::string::npos) {
+      boundary = contentType.substr(boundaryStart + 9);
+      boundary = boundary.substr(0, boundary.find(';'));
+      boundary.erase(std::remove(boundary.begin(), boundary.end(), '"'), boundary.end());
+    }
+  }
+
+  // Without a boundary in the headers, the first line starting with two dashes is taken as boundary (see readPart()).
+  return true;
+}
+
+bool MjpegStreamSource::fillBuffer() {
+  // Move the unread data to the front to make room.
+  if (bufferStart > 0) {
+    std::memmove(buffer.data(), buffer.data() + bufferStart, bufferEnd - bufferStart);
+    bufferEnd -= bufferStart;
+    bufferStart = 0;
+  }
+
+  if (bufferEnd == buffer.size()) {
+    return false;
+  }
+
+  ssize_t received = recv(socketFd, buffer.data() + bufferEnd, buffer.size() - bufferEnd, 0);
+  if (received <= 0) {
+    return false;
+  }
+
+  bufferEnd += received;
+
+  return true;
+}
+
+bool MjpegStreamSource::readLine(std::string& line) {
+  while (true) {
+    char* begin = buffer.data() + bufferStart;
+    char* end = buffer.data() + bufferEnd;
+    char* newline = std::find(begin, end, '\n');
+
+    if (newline != end) {
+      line.assign(begin, newline);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+
+      bufferStart += newline - begin + 1;
+      return true;
+    }
+
+    if (!fillBuffer()) {
+      return false;
+    }
+  }
+}
+
+bool MjpegStreamSource::readBytes(char* out, size_t count) {
+  while (count > 0) {
+    if (bufferStart == bufferEnd && !fillBuffer()) {
+      return false;
+    }
+
+    size_t available = std::min(count, bufferEnd - bufferStart);
+    std::memcpy(out, buffer.data() + bufferStart, available);
+    bufferStart += available;
+    out += available;
+    count -= available;
+  }
+
+  return true;
+}
+
+bool MjpegStreamSource::readUntil(const std::string& terminator, std::vector<char>& out) {
+  out.clear();
+
+  while (true) {
+    char* begin = buffer.data() + bufferStart;
+    char* end = buffer.data() + bufferEnd;
+    char* found = std::search(begin, end, terminator.begin(), terminator.end());
+
+    if (found != end) {
+      out.insert(out.end(), begin, found);
+      bufferStart += found - begin + terminator.size();
+      return true;
+    }
+
+    // Keep the tail, which could be the start of the terminator that is not completely received yet.
+    size_t keep = std::min<size_t>(terminator.size() - 1, end - begin);
+    out.insert(out.end(), begin, end - keep);
+    bufferStart = bufferEnd - keep;
+
+    if (out.size() > MJPEG_MAX_FRAME_SIZE || !fillBuffer()) {
+      return false;
+    }
+  }
+}
+
+bool MjpegStreamSource::readPart() {
+  std::string line;
+
+  // Skip to the next boundary. Servers differ in whether the boundary parameter already includes the leading dashes.
+  while (!delimiterConsumed) {
+    if (!readLine(line)) {
+      return false;
+    }
+
+    bool isDelimiter;
+    if (!delimiter.empty()) {
+      isDelimiter = line == delimiter;
+    } else if (!boundary.empty()) {
+      isDelimiter = line == "--" + boundary || line == boundary;
+    } else {
+      isDelimiter = line.starts_with("--");
+    }
+
+    if (isDelimiter) {
+      delimiter = line;
+      break;
+    }
+  }
+  delimiterConsumed = false;
+
+  size_t contentLength = 0;
+  while (readLine(line) && !line.empty()) {
+    std::string value = headerValue(line, "content-length");
+    if (!value.empty()) {
+      contentLength = std::strtoull(value.c_str(), nullptr, 10);
+    }
+  }
+
+  if (contentLength > MJPEG_MAX_FRAME_SIZE) {
+    return false;
+  }
+
+  if (contentLength > 0) {
+    // Every frame gets its own buffer, because frames that are still queued or displayed keep referencing theirs.
+    encoded = cv::Mat(1, contentLength, CV_8U);
+    return readBytes(reinterpret_cast<char*>(encoded.data), contentLength);
+  }
+
+  // Without a length, the part ends at the next boundary. Consume the rest of the boundary line as well.
+  if (delimiter.empty() || !readUntil("\r\n" + delimiter, partBuffer) || !readLine(line)) {
+    return false;
+  }
+  delimiterConsumed = true;
+
+  encoded = cv::Mat(1, partBuffer.size(), CV_8U);
+  std::memcpy(encoded.data, partBuffer.data(), partBuffer.size());
+
+  return !encoded.empty();
+}
+
+bool MjpegStreamSource::readFrame(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) {
+  if (!readPart()) {
+    return false;
+  }
+
+  captureTime = std::chrono::steady_clock::now();
+
+  return decodeJpeg(encoded, scale, true, image);
+}
+
+bool MjpegStreamSource::read(cv::Mat& image, std::chrono::steady_clock::time_point& captureTime) {
+  if (socketFd < 0) {
+    return false;
+  }
+
+  if (havePendingFrame) {
+    havePendingFrame = false;
+    image = pendingImage;
+    captureTime = pendingCaptureTime;
+    pendingImage.release();
+    return true;
+  }
+
+  return readFrame(image, captureTime);
+}
@@ -0,0 +1,224 @@
+#include <multi_camera_pipeline.h>
+
+#include <iostream>
+
+#include <stage_timer.h>
+
+MultiCameraPipeline::MultiCameraPipeline(int workerCount, size_t queueSize) :
+  queueSize(queueSize > 0 ? queueSize : 1), workerCount(workerCount > 0 ? workerCount : 1) {}
+
+MultiCameraPipeline::~MultiCameraPipeline() {
+  stop();
+}
+
+int MultiCameraPipeline::addCamera(std::unique_ptr<FrameSource> source, const MarkerTrackerConfig& config) {
+  auto camera = std::make_unique<Camera>();
+  camera->source = std::move(source);
+  camera->tracker = std::make_unique<MarkerTracker>(config);
+  cameras.push_back(std::move(camera));
+
+  return cameras.size() - 1;
+}
+
+void MultiCameraPipeline::start() {
+  if (running) {
+    return;
+  }
+
+  running = true;
+  activeWorkers = workerCount;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    resultsClosed = false;
+  }
+
+  for (int i = 0; i < workerCount; i++) {
+    workerThreads.emplace_back(&MultiCameraPipeline::workerLoop, this);
+  }
+
+  for (size_t c = 0; c < cameras.size(); c++) {
+    cameras[c]->captureThread = std::thread(&MultiCameraPipeline::captureLoop, this, (int)c);
+  }
+}
+
+void MultiCameraPipeline::stop() {
+  running = false;
+
+  for (auto& camera : cameras) {
+    if (camera->captureThread.joinable()) {
+      camera->captureThread.join();
+    }
+  }
+
+  // Every capture thread marks its camera as finished when it exits, so the workers will follow.
+  for (auto& worker : workerThreads) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+  workerThreads.clear();
+}
+
+void MultiCameraPipeline::captureLoop(int cameraId) {
+  Camera& camera = *cameras[cameraId];
+  uint64_t sequence = 0;
+
+  while (running) {
+    TrackedFrame frame;
+    bool success;
+
+    {
+      TIME_STAGE(CAPTURE);
+      success = camera.source->read(frame.image, frame.captureTime);
+      frame.encodedImage = camera.source->getEncodedFrame();
+    }
+
+    if (!success) {
+      std::cerr << "Error: Could not read frame from camera " << cameraId << "." << std::endl;
+      break;
+    }
+
+    frame.cameraId = cameraId;
+    frame.sequence = ++sequence;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      while (camera.pending.size() >= queueSize) {
+        camera.pending.pop_front();
+        camera.dropped++;
+      }
+
+      camera.pending.push_back(std::move(frame));
+      camera.captured++;
+    }
+    workAvailable.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    camera.finished = true;
+  }
+  workAvailable.notify_all();
+}
+
+int MultiCameraPipeline::findWork() {
+  for (size_t i = 0; i < cameras.size(); i++) {
+    size_t c = (nextCamera + i) % cameras.size();
+
+    if (!cameras[c]->busy && !cameras[c]->pending.empty()) {
+      return c;
+    }
+  }
+
+  return -1;
+}
+
+int MultiCameraPipeline::findResult() {
+  for (size_t i = 0; i < cameras.size(); i++) {
+    size_t c = (nextResultCamera + i) % cameras.size();
+
+    if (!cameras[c]->results.empty()) {
+      return c;
+    }
+  }
+
+  return -1;
+}
+
+bool MultiCameraPipeline::allFinished() const {
+  for (const auto& camera : cameras) {
+    if (!camera->finished || !camera->pending.empty()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void MultiCameraPipeline::workerLoop() {
+  TrackedFrame frame;
+
+  while (true) {
+    int cameraId;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      workAvailable.wait(lock, [this] { return findWork() >= 0 || allFinished(); });
+
+      cameraId = findWork();
+      if (cameraId < 0) {
+        break;
+      }
+
+      Camera& camera = *cameras[cameraId];
+      frame = std::move(camera.pending.front());
+      camera.pending.pop_front();
+      camera.busy = true;
+
+      // Start looking at the next camera next time, so all cameras get their turn.
+      nextCamera = (cameraId + 1) % cameras.size();
+    }
+
+    cameras[cameraId]->tracker->process(frame);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Camera& camera = *cameras[cameraId];
+      camera.busy = false;
+      camera.processed++;
+
+      // Only results of the same camera are dropped, so every camera keeps its latest results.
+      while (camera.results.size() >= queueSize) {
+        camera.results.pop_front();
+      }
+      camera.results.push_back(std::move(frame));
+    }
+    // The camera may have more frames waiting, which only now can be taken.
+    workAvailable.notify_one();
+    resultAvailable.notify_one();
+  }
+
+  // The last worker to finish tells the consumer that no more results are coming.
+  if (--activeWorkers == 0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      resultsClosed = true;
+    }
+    resultAvailable.notify_all();
+  }
+}
+
+bool MultiCameraPipeline::nextResult(TrackedFrame& frame) {
+  std::unique_lock<std::mutex> lock(mutex);
+  resultAvailable.wait(lock, [this] { return findResult() >= 0 || resultsClosed; });
+
+  int cameraId = findResult();
+  if (cameraId < 0) {
+    return false;
+  }
+
+  Camera& camera = *cameras[cameraId];
+  frame = std::move(camera.results.front());
+  camera.results.pop_front();
+  camera.delivered++;
+
+  // Start looking at the next camera next time, so results of all cameras are shown in turn.
+  nextResultCamera = (cameraId + 1) % cameras.size();
+
+  return true;
+}
+
+PipelineStats MultiCameraPipeline::getStats(int cameraId) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const Camera& camera = *cameras.at(cameraId);
+
+  PipelineStats stats;
+  stats.captured = camera.captured;
+  stats.droppedBeforeDetection = camera.dropped;
+  stats.processed = camera.processed;
+  stats.droppedBeforeRender = camera.processed - camera.delivered;
+  stats.delivered = camera.delivered;
+
+  return stats;
+}
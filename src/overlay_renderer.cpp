@@ -0,0 +1,48 @@
+#include <overlay_renderer.h>
+
+#include <algorithm>
+
+#include <mjpeg_stream_source.h>
+
+OverlayRenderer::OverlayRenderer(double displayRate, double previewScale, int decodeScale) :
+  previewScale(std::clamp(previewScale, 0.01, 1.0)), decodeScale(decodeScale) {
+  if (displayRate > 0) {
+    interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / displayRate));
+  } else {
+    interval = std::chrono::steady_clock::duration::zero();
+  }
+}
+
+bool OverlayRenderer::isDue(std::chrono::steady_clock::time_point now) const {
+  return !hasRendered || now - lastRender >= interval;
+}
+
+const cv::Mat& OverlayRenderer::render(const MarkerTracker& tracker, const TrackedFrame& frame) {
+  lastRender = std::chrono::steady_clock::now();
+  hasRendered = true;
+
+  // Compressed frames are decoded again in color, which is only done for the frames that are displayed.
+  const cv::Mat* source = &frame.image;
+  if (!frame.encodedImage.empty() && decodeJpeg(frame.encodedImage, decodeScale, false, colorImage)) {
+    source = &colorImage;
+  }
+
+  // Resize before converting grayscale frames to color, so the conversion only touches the preview.
+  // All of these reuse their output buffer as long as the frame size does not change.
+  if (source->channels() == 1) {
+    const cv::Mat* gray = source;
+    if (previewScale < 1.0) {
+      cv::resize(*source, grayPreview, cv::Size(), previewScale, previewScale, cv::INTER_AREA);
+      gray = &grayPreview;
+    }
+    cv::cvtColor(*gray, canvas, cv::COLOR_GRAY2BGR);
+  } else if (previewScale < 1.0) {
+    cv::resize(*source, canvas, cv::Size(), previewScale, previewScale, cv::INTER_AREA);
+  } else {
+    source->copyTo(canvas);
+  }
+
+  tracker.drawOverlay(canvas, frame, previewScale);
+
+  return canvas;
+}
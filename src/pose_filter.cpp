@@ -0,0 +1,299 @@
+#include <pose_filter.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <allocation_counter.h>
+
+#define STATE_SIZE 12
+#define MEASUREMENT_SIZE 6
+// Initial uncertainty of the velocity of a new track, in rad/s and m/s.
+#define INITIAL_VELOCITY_STD 1.0
+// A warm-started pose whose reprojection error is this many times that of the closed-form solution is refined from the closed-form solution instead.
+#define MAX_WARM_START_ERROR_RATIO 5.0
+// Closed-form reprojection errors are taken to be at least this many pixels, so a nearly perfect fit does not make every warm-started pose look bad.
+#define MIN_REPROJECTION_ERROR 0.1
+
+namespace {
+
+// A rotation by angle theta around axis a is the same as a rotation by theta - 2*pi around a.
+// Return the representation of rvec that is closest to reference, so the filter does not see a jump of 2*pi.
+cv::Vec3d closestRotationVector(const cv::Vec3d& rvec, const cv::Vec3d& reference) {
+  double theta = cv::norm(rvec);
+  if (theta < 1e-9) {
+    return rvec;
+  }
+
+  cv::Vec3d alternative = rvec * ((theta - 2.0 * CV_PI) / theta);
+
+  return cv::norm(alternative - reference) < cv::norm(rvec - reference) ? alternative : rvec;
+}
+
+double poseDistance(const cv::Vec3d& rvec, const cv::Vec3d& tvec, const cv::Vec3d& refRvec, const cv::Vec3d& refTvec, double markerLength) {
+  return cv::norm(closestRotationVector(rvec, refRvec) - refRvec) + cv::norm(tvec - refTvec) / markerLength;
+}
+
+double secondsBetween(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+  return std::chrono::duration<double>(b - a).count();
+}
+
+} // namespace
+
+PoseFilter::PoseFilter(double markerLength, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs, const PoseFilterConfig& config) :
+  config(config), markerLength(markerLength), cameraMatrix(cameraMatrix.clone()), distCoeffs(distCoeffs.clone()) {
+  objPoints = cv::Mat(4, 1, CV_64FC3);
+  objPoints.ptr<cv::Vec3d>(0)[0] = cv::Vec3d(-markerLength/2.0, markerLength/2.0, 0);
+  objPoints.ptr<cv::Vec3d>(0)[1] = cv::Vec3d(markerLength/2.0, markerLength/2.0, 0);
+  objPoints.ptr<cv::Vec3d>(0)[2] = cv::Vec3d(markerLength/2.0, -markerLength/2.0, 0);
+  objPoints.ptr<cv::Vec3d>(0)[3] = cv::Vec3d(-markerLength/2.0, -markerLength/2.0, 0);
+}
+
+void PoseFilter::initTrack(Track& track, const cv::Vec3d& rvec, const cv::Vec3d& tvec, std::chrono::steady_clock::time_point time) {
+  track.kalman.init(STATE_SIZE, MEASUREMENT_SIZE, 0, CV_64F);
+
+  // The state is (rvec, tvec, angular velocity, velocity), and the pose is measured directly.
+  track.kalman.measurementMatrix = cv::Mat::zeros(MEASUREMENT_SIZE, STATE_SIZE, CV_64F);
+  track.kalman.measurementNoiseCov = cv::Mat::zeros(MEASUREMENT_SIZE, MEASUREMENT_SIZE, CV_64F);
+  track.kalman.errorCovPost = cv::Mat::zeros(STATE_SIZE, STATE_SIZE, CV_64F);
+  track.kalman.statePost = cv::Mat::zeros(STATE_SIZE, 1, CV_64F);
+
+  for (int i = 0; i < MEASUREMENT_SIZE; i++) {
+    double measurementNoise = i < 3 ? config.rotationMeasurementNoise : config.translationMeasurementNoise;
+
+    track.kalman.measurementMatrix.at<double>(i, i) = 1;
+    track.kalman.measurementNoiseCov.at<double>(i, i) = measurementNoise * measurementNoise;
+    track.kalman.errorCovPost.at<double>(i, i) = measurementNoise * measurementNoise;
+    track.kalman.errorCovPost.at<double>(i + 6, i + 6) = INITIAL_VELOCITY_STD * INITIAL_VELOCITY_STD;
+    track.kalman.statePost.at<double>(i) = i < 3 ? rvec[i] : tvec[i - 3];
+  }
+
+  track.lastUpdate = time;
+  track.missedFrames = 0;
+  track.history = 0;
+}
+
+void PoseFilter::predictTrack(Track& track, double dt, cv::Vec3d& rvec, cv::Vec3d& tvec) {
+  cv::Mat& F = track.kalman.transitionMatrix;
+  cv::Mat& Q = track.kalman.processNoiseCov;
+  // Both matrices already have the right size, so they are only overwritten.
+  cv::setIdentity(F);
+  Q.setTo(0);
+
+  // Constant velocity model, with white noise acceleration as process noise.
+  for (int i = 0; i < MEASUREMENT_SIZE; i++) {
+    double noise = i < 3 ? config.rotationAccelerationNoise : config.translationAccelerationNoise;
+    double var = noise * noise;
+
+    F.at<double>(i, i + 6) = dt;
+
+    Q.at<double>(i, i) = var * dt * dt * dt * dt / 4.0;
+    Q.at<double>(i, i + 6) = var * dt * dt * dt / 2.0;
+    Q.at<double>(i + 6, i) = var * dt * dt * dt / 2.0;
+    Q.at<double>(i + 6, i + 6) = var * dt * dt;
+  }
+
+  IGNORE_ALLOCATIONS();
+  const cv::Mat& prediction = track.kalman.predict();
+
+  for (int i = 0; i < 3; i++) {
+    rvec[i] = prediction.at<double>(i);
+    tvec[i] = prediction.at<double>(i + 3);
+  }
+}
+
+void PoseFilter::correctTrack(Track& track, const cv::Vec3d& rvec, const cv::Vec3d& tvec, double noiseScale, cv::Vec3d& filteredRvec, cv::Vec3d& filteredTvec) {
+  cv::Vec<double, MEASUREMENT_SIZE> values;
+  for (int i = 0; i < 3; i++) {
+    values[i] = rvec[i];
+    values[i + 3] = tvec[i];
+  }
+
+  for (int i = 0; i < MEASUREMENT_SIZE; i++) {
+    double measurementNoise = i < 3 ? config.rotationMeasurementNoise : config.translationMeasurementNoise;
+    track.kalman.measurementNoiseCov.at<double>(i, i) = noiseScale * measurementNoise * measurementNoise;
+  }
+
+  // A header around the values on the stack, which does not allocate.
+  cv::Mat measurement(values, false);
+
+  IGNORE_ALLOCATIONS();
+  const cv::Mat& state = track.kalman.correct(measurement);
+
+  for (int i = 0; i < 3; i++) {
+    filteredRvec[i] = state.at<double>(i);
+    filteredTvec[i] = state.at<double>(i + 3);
+  }
+}
+
+double PoseFilter::reprojectionError(const std::vector<cv::Point2f>& corners, const cv::Vec3d& rvec, const cv::Vec3d& tvec) {
+  {
+    IGNORE_ALLOCATIONS();
+    cv::projectPoints(objPoints, rvec, tvec, cameraMatrix, distCoeffs, projectedPoints);
+  }
+
+  double sum = 0;
+  for (int c = 0; c < 4; c++) {
+    cv::Point2f difference = projectedPoints[c] - corners[c];
+    sum += difference.dot(difference);
+  }
+
+  return std::sqrt(sum / 4);
+}
+
+void PoseFilter::recordJitter(Track& track, const cv::Vec3d& rawTvec, const cv::Vec3d& filteredTvec) {
+  if (track.history >= 2) {
+    double rawDiff = cv::norm(rawTvec - 2.0 * track.raw[1] + track.raw[0]);
+    double filteredDiff = cv::norm(filteredTvec - 2.0 * track.filtered[1] + track.filtered[0]);
+
+    rawJitterSum += rawDiff * rawDiff;
+    filteredJitterSum += filteredDiff * filteredDiff;
+    jitterSamples++;
+  }
+
+  track.raw[0] = track.raw[1];
+  track.raw[1] = rawTvec;
+  track.filtered[0] = track.filtered[1];
+  track.filtered[1] = filteredTvec;
+  track.history++;
+}
+
+void PoseFilter::update(const std::vector<int>& markerIds, const std::vector<std::vector<cv::Point2f> >& markerCorners,
+                        std::chrono::steady_clock::time_point captureTime, SquarePoseBatch& poses) {
+  for (size_t i = 0; i < poses.size() && i < markerIds.size(); i++) {
+    if (!std::isfinite(poses.reprojectionErrors[i])) {
+      continue;
+    }
+
+    auto it = tracks.find(markerIds[i]);
+    bool warmStart = it != tracks.end();
+
+    // The same ID twice in one frame. Only the first one is filtered.
+    if (warmStart && it->second.updated) {
+      continue;
+    }
+
+    cv::Vec3d rvec = poses.rvecs[i];
+    cv::Vec3d tvec = poses.tvecs[i];
+    cv::Vec3d predictedRvec, predictedTvec;
+
+    if (warmStart) {
+      Track& track = it->second;
+      double dt = std::max(1e-3, secondsBetween(track.lastUpdate, captureTime));
+
+      predictTrack(track, dt, predictedRvec, predictedTvec);
+
+      // Of the two ambiguous solutions, take the one consistent with the motion so far.
+      if (poseDistance(poses.altRvecs[i], poses.altTvecs[i], predictedRvec, predictedTvec, markerLength) <
+          poseDistance(rvec, tvec, predictedRvec, predictedTvec, markerLength) &&
+          std::isfinite(poses.altReprojectionErrors[i])) {
+        std::swap(poses.rvecs[i], poses.altRvecs[i]);
+        std::swap(poses.tvecs[i], poses.altTvecs[i]);
+        std::swap(poses.reprojectionErrors[i], poses.altReprojectionErrors[i]);
+        rvec = poses.rvecs[i];
+        tvec = poses.tvecs[i];
+        stats.ambiguityFlipsAvoided++;
+      }
+
+      stats.warmStartedSolves++;
+    } else {
+      stats.coldSolves++;
+    }
+
+    // The closed-form solution does not depend on the filter, so the raw jitter is measured on it.
+    cv::Vec3d closedFormTvec = tvec;
+    double noiseScale = 1;
+    bool refineClosedForm = !warmStart;
+
+    if (warmStart && config.warmRefineIterations > 0) {
+      // The prediction is usually close enough to converge within a few iterations.
+      auto start = std::chrono::steady_clock::now();
+
+      rvec = predictedRvec;
+      tvec = predictedTvec;
+      {
+        IGNORE_ALLOCATIONS();
+        cv::solvePnPRefineLM(objPoints, markerCorners[i], cameraMatrix, distCoeffs, rvec, tvec,
+                             cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, config.warmRefineIterations, 1e-8));
+      }
+
+      // Where the iterations stopped short of the corners, the pose still leans towards the prediction, which the filter
+      // already counts once. Such a measurement is trusted less, by the square of how much worse its reprojection error is
+      // than that of the closed-form solution. If it is far off, the prediction was wrong and the closed-form solution is used.
+      double errorRatio = reprojectionError(markerCorners[i], rvec, tvec) / std::max(poses.reprojectionErrors[i], MIN_REPROJECTION_ERROR);
+      if (errorRatio > MAX_WARM_START_ERROR_RATIO) {
+        rvec = poses.rvecs[i];
+        tvec = poses.tvecs[i];
+        refineClosedForm = true;
+        stats.warmStartFallbacks++;
+      } else {
+        noiseScale = std::max(1.0, errorRatio * errorRatio);
+      }
+
+      stats.warmSolveSeconds += secondsBetween(start, std::chrono::steady_clock::now());
+    }
+
+    if (refineClosedForm && config.refineIterations > 0) {
+      auto start = std::chrono::steady_clock::now();
+      {
+        IGNORE_ALLOCATIONS();
+        cv::solvePnPRefineLM(objPoints, markerCorners[i], cameraMatrix, distCoeffs, rvec, tvec,
+                             cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, config.refineIterations, 1e-8));
+      }
+
+      double seconds = secondsBetween(start, std::chrono::steady_clock::now());
+      if (warmStart) {
+        stats.warmSolveSeconds += seconds;
+      } else {
+        stats.coldSolveSeconds += seconds;
+      }
+    }
+
+    if (warmStart) {
+      rvec = closestRotationVector(rvec, predictedRvec);
+    } else {
+      it = tracks.emplace(markerIds[i], Track()).first;
+      initTrack(it->second, rvec, tvec, captureTime);
+    }
+
+    Track& track = it->second;
+    cv::Vec3d filteredRvec = rvec;
+    cv::Vec3d filteredTvec = tvec;
+
+    if (warmStart) {
+      correctTrack(track, rvec, tvec, noiseScale, filteredRvec, filteredTvec);
+    }
+
+    recordJitter(track, closedFormTvec, filteredTvec);
+
+    track.lastUpdate = captureTime;
+    track.updated = true;
+
+    poses.rvecs[i] = filteredRvec;
+    poses.tvecs[i] = filteredTvec;
+  }
+
+  // Drop tracks of markers that were not seen for too long.
+  for (auto it = tracks.begin(); it != tracks.end();) {
+    Track& track = it->second;
+
+    if (track.updated) {
+      track.updated = false;
+      track.missedFrames = 0;
+    } else if (++track.missedFrames > config.trackExpiry) {
+      it = tracks.erase(it);
+      continue;
+    }
+
+    ++it;
+  }
+}
+
+const PoseFilterStats& PoseFilter::getStats() {
+  if (jitterSamples > 0) {
+    stats.rawJitter = std::sqrt(rawJitterSum / jitterSamples);
+    stats.filteredJitter = std::sqrt(filteredJitterSum / jitterSamples);
+  }
+
+  return stats;
+}
@@ -0,0 +1,104 @@
+#include <pose_shm_publisher.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+PoseShmPublisher::PoseShmPublisher(const std::string& name, uint32_t slotCount) : name(name) {
+  slotCount = std::max<uint32_t>(slotCount, 1);
+
+  // Start with a fresh object, so readers of a previous run can not mix up the two.
+  shm_unlink(name.c_str());
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    std::cerr << "Error: Could not create shared memory " << name << ": " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  mappingSize = poseShmSize(slotCount);
+  if (ftruncate(fd, mappingSize) != 0) {
+    std::cerr << "Error: Could not resize shared memory " << name << ": " << std::strerror(errno) << std::endl;
+    close(fd);
+    shm_unlink(name.c_str());
+    return;
+  }
+
+  mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Error: Could not map shared memory " << name << ": " << std::strerror(errno) << std::endl;
+    mapping = nullptr;
+    shm_unlink(name.c_str());
+    return;
+  }
+
+  // Construct the header and slots in place. All sequences start at 0, which means the slot has never been written.
+  PoseShmHeader* newHeader = new (mapping) PoseShmHeader;
+  slots = reinterpret_cast<PoseShmSlot*>(static_cast<char*>(mapping) + sizeof(PoseShmHeader));
+  for (uint32_t i = 0; i < slotCount; i++) {
+    new (&slots[i]) PoseShmSlot;
+  }
+
+  newHeader->version = POSE_SHM_VERSION;
+  newHeader->slotCount = slotCount;
+  newHeader->slotSize = sizeof(PoseShmSlot);
+  newHeader->closed.store(0, std::memory_order_relaxed);
+  newHeader->writeIndex.store(0, std::memory_order_relaxed);
+  newHeader->magic.store(POSE_SHM_MAGIC, std::memory_order_release);
+
+  header = newHeader;
+}
+
+PoseShmPublisher::~PoseShmPublisher() {
+  if (header == nullptr) {
+    return;
+  }
+
+  header->closed.store(1, std::memory_order_release);
+  munmap(mapping, mappingSize);
+  shm_unlink(name.c_str());
+}
+
+void PoseShmPublisher::publish(const TrackedFrame& frame) {
+  if (header == nullptr) {
+    return;
+  }
+
+  PoseShmSlot& slot = slots[writeIndex % header->slotCount];
+
+  // Odd while writing, so readers that copy the slot in the meantime notice.
+  slot.sequence.store(2 * writeIndex + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  PoseShmFrame& out = slot.frame;
+  out.sequence = frame.sequence;
+  out.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.captureTime.time_since_epoch()).count();
+  out.cameraId = frame.cameraId;
+  out.markerCount = std::min<size_t>(frame.poses.tvecs.size(), POSE_SHM_MAX_MARKERS);
+
+  for (uint32_t i = 0; i < out.markerCount; i++) {
+    PoseShmMarker& marker = out.markers[i];
+    marker.id = frame.markerIds.at(i);
+
+    const std::vector<cv::Point2f>& corners = frame.markerCorners.at(i);
+    for (int j = 0; j < 4; j++) {
+      marker.corners[2 * j] = corners.at(j).x;
+      marker.corners[2 * j + 1] = corners.at(j).y;
+    }
+
+    for (int j = 0; j < 3; j++) {
+      marker.rvec[j] = frame.poses.rvecs.at(i)[j];
+      marker.tvec[j] = frame.poses.tvecs.at(i)[j];
+    }
+  }
+
+  slot.sequence.store(2 * writeIndex + 2, std::memory_order_release);
+  header->writeIndex.store(++writeIndex, std::memory_order_release);
+}
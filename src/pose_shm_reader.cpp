@@ -0,0 +1,119 @@
+#include <pose_shm.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PoseShmReader::PoseShmReader(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    std::cerr << "Error: Could not open shared memory " << name << ": " << std::strerror(errno) << std::endl;
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PoseShmHeader)) {
+    std::cerr << "Error: Shared memory " << name << " is not a pose ring." << std::endl;
+    close(fd);
+    return;
+  }
+
+  mappingSize = st.st_size;
+  mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after closing the descriptor.
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    std::cerr << "Error: Could not map shared memory " << name << ": " << std::strerror(errno) << std::endl;
+    mapping = nullptr;
+    return;
+  }
+
+  const PoseShmHeader* candidate = static_cast<const PoseShmHeader*>(mapping);
+  if (candidate->magic.load(std::memory_order_acquire) != POSE_SHM_MAGIC || candidate->version != POSE_SHM_VERSION ||
+      candidate->slotSize != sizeof(PoseShmSlot) || poseShmSize(candidate->slotCount) > mappingSize || candidate->slotCount == 0) {
+    std::cerr << "Error: Shared memory " << name << " is not a supported pose ring." << std::endl;
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    return;
+  }
+
+  header = candidate;
+  slots = reinterpret_cast<const PoseShmSlot*>(static_cast<const char*>(mapping) + sizeof(PoseShmHeader));
+
+  skipToLatest();
+}
+
+PoseShmReader::~PoseShmReader() {
+  if (mapping != nullptr) {
+    munmap(mapping, mappingSize);
+  }
+}
+
+void PoseShmReader::skipToLatest() {
+  nextIndex = header->writeIndex.load(std::memory_order_acquire);
+}
+
+bool PoseShmReader::tryRead(PoseShmFrame& frame) {
+  while (true) {
+    uint64_t writeIndex = header->writeIndex.load(std::memory_order_acquire);
+
+    if (nextIndex >= writeIndex) {
+      return false;
+    }
+
+    // Frames older than the ring are gone. Start with the oldest one that can still be complete.
+    if (writeIndex - nextIndex > header->slotCount) {
+      uint64_t oldest = writeIndex - header->slotCount;
+      lostCount += oldest - nextIndex;
+      nextIndex = oldest;
+    }
+
+    const PoseShmSlot& slot = slots[nextIndex % header->slotCount];
+    uint64_t expected = 2 * nextIndex + 2;
+
+    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before < expected) {
+      return false;
+    }
+
+    if (before == expected) {
+      // Only copy the markers that are in use. markerCount may be torn if the slot is being overwritten,
+      // which the sequence check below detects, so it only has to be kept in bounds.
+      uint32_t markerCount = std::min<uint32_t>(slot.frame.markerCount, POSE_SHM_MAX_MARKERS);
+      std::memcpy(&frame, &slot.frame, offsetof(PoseShmFrame, markers) + markerCount * sizeof(PoseShmMarker));
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) == before) {
+        frame.markerCount = markerCount;
+        nextIndex++;
+        return true;
+      }
+    }
+
+    // The publisher already moved on to a later frame in this slot. Go around again, which skips ahead.
+    lostCount++;
+    nextIndex++;
+  }
+}
+
+bool PoseShmReader::read(PoseShmFrame& frame, std::chrono::microseconds pollInterval) {
+  while (!tryRead(frame)) {
+    if (isClosed()) {
+      // A last frame may have been published right before the publisher exited.
+      return tryRead(frame);
+    }
+
+    if (pollInterval.count() > 0) {
+      std::this_thread::sleep_for(pollInterval);
+    }
+  }
+
+  return true;
+}
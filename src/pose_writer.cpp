@@ -0,0 +1,125 @@
+#include <pose_writer.h>
+
+#include <charconv>
+#include <chrono>
+#include <iostream>
+
+#define CSV_HEADER "sequence,timestamp_ns,camera,id,rx,ry,rz,tx,ty,tz"
+#define CSV_LINE_BUFFER_SIZE 512
+
+PoseWriter::PoseWriter(const std::string& path, PoseOutputFormat format) : format(format) {
+  if (path == POSE_OUTPUT_STDOUT) {
+    out = &std::cout;
+  } else {
+    std::ios::openmode mode = std::ios::out | std::ios::trunc;
+    if (format == PoseOutputFormat::BINARY) {
+      mode |= std::ios::binary;
+    }
+
+    file.open(path, mode);
+    if (file.is_open()) {
+      out = &file;
+    }
+  }
+
+  if (out != nullptr && format == PoseOutputFormat::CSV) {
+    *out << CSV_HEADER << "\n";
+  }
+}
+
+void PoseWriter::write(const TrackedFrame& frame) {
+  if (out == nullptr) {
+    return;
+  }
+
+  if (format == PoseOutputFormat::CSV) {
+    writeCsv(frame);
+  } else {
+    writeBinary(frame);
+  }
+
+  out->flush();
+}
+
+void PoseWriter::writeCsv(const TrackedFrame& frame) {
+  int64_t timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.captureTime.time_since_epoch()).count();
+
+  for (size_t i = 0; i < frame.poses.tvecs.size(); i++) {
+    writeCsvLine(frame, timestampNs, frame.markerIds.at(i), frame.poses.rvecs.at(i), frame.poses.tvecs.at(i));
+  }
+
+  for (const BoardPose& pose : frame.boardPoses) {
+    writeCsvLine(frame, timestampNs, pose.boardId, pose.rvec, pose.tvec);
+  }
+}
+
+void PoseWriter::writeCsvLine(const TrackedFrame& frame, int64_t timestampNs, int id, const cv::Vec3d& rvec, const cv::Vec3d& tvec) {
+  // Format with to_chars into a stack buffer, which avoids both locale handling and allocations.
+  char line[CSV_LINE_BUFFER_SIZE];
+  char* pos = line;
+  char* end = line + sizeof(line);
+
+  pos = std::to_chars(pos, end, frame.sequence).ptr;
+  *pos++ = ',';
+  pos = std::to_chars(pos, end, timestampNs).ptr;
+  *pos++ = ',';
+  pos = std::to_chars(pos, end, frame.cameraId).ptr;
+  *pos++ = ',';
+  pos = std::to_chars(pos, end, id).ptr;
+
+  for (int j = 0; j < 3; j++) {
+    *pos++ = ',';
+    pos = std::to_chars(pos, end, rvec[j]).ptr;
+  }
+
+  for (int j = 0; j < 3; j++) {
+    *pos++ = ',';
+    pos = std::to_chars(pos, end, tvec[j]).ptr;
+  }
+
+  *pos++ = '\n';
+
+  out->write(line, pos - line);
+}
+
+void PoseWriter::writeBinary(const TrackedFrame& frame) {
+  PoseRecord record;
+  record.sequence = frame.sequence;
+  record.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(frame.captureTime.time_since_epoch()).count();
+  record.cameraId = frame.cameraId;
+  record.markerCount = frame.poses.tvecs.size() + frame.boardPoses.size();
+
+  for (size_t i = 0; i < frame.poses.tvecs.size(); i++) {
+    record.markerId = frame.markerIds.at(i);
+
+    for (int j = 0; j < 3; j++) {
+      record.rvec[j] = frame.poses.rvecs.at(i)[j];
+      record.tvec[j] = frame.poses.tvecs.at(i)[j];
+    }
+
+    out->write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+
+  for (const BoardPose& pose : frame.boardPoses) {
+    record.markerId = pose.boardId;
+
+    for (int j = 0; j < 3; j++) {
+      record.rvec[j] = pose.rvec[j];
+      record.tvec[j] = pose.tvec[j];
+    }
+
+    out->write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+}
+
+bool parsePoseOutputFormat(const std::string& str, PoseOutputFormat& format) {
+  if (str == "csv") {
+    format = PoseOutputFormat::CSV;
+  } else if (str == "binary") {
+    format = PoseOutputFormat::BINARY;
+  } else {
+    return false;
+  }
+
+  return true;
+}
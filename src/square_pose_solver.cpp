@@ -0,0 +1,401 @@
+#include <square_pose_solver.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include <allocation_counter.h>
+
+namespace {
+
+// Row major 3x3 matrix. Small enough that plain arrays are simpler and faster than cv::Mat here.
+typedef double Mat33[9];
+
+// Solve the 8x8 system A*x = b in place with Gaussian elimination and partial pivoting.
+bool solve8(double A[8][8], double b[8], double x[8]) {
+  for (int col = 0; col < 8; col++) {
+    int pivot = col;
+    for (int row = col + 1; row < 8; row++) {
+      if (std::fabs(A[row][col]) > std::fabs(A[pivot][col])) {
+        pivot = row;
+      }
+    }
+
+    if (std::fabs(A[pivot][col]) < 1e-12) {
+      return false;
+    }
+
+    if (pivot != col) {
+      for (int k = 0; k < 8; k++) {
+        std::swap(A[pivot][k], A[col][k]);
+      }
+      std::swap(b[pivot], b[col]);
+    }
+
+    for (int row = col + 1; row < 8; row++) {
+      double f = A[row][col] / A[col][col];
+      for (int k = col; k < 8; k++) {
+        A[row][k] -= f * A[col][k];
+      }
+      b[row] -= f * b[col];
+    }
+  }
+
+  for (int row = 7; row >= 0; row--) {
+    double sum = b[row];
+    for (int k = row + 1; k < 8; k++) {
+      sum -= A[row][k] * x[k];
+    }
+    x[row] = sum / A[row][row];
+  }
+
+  return true;
+}
+
+// Homography H (with H[8] = 1) that maps the marker plane coordinates of the four corners to normalized image coordinates.
+bool squareHomography(const double objectPoints[4][2], const cv::Point2f* imagePoints, Mat33 H) {
+  double A[8][8];
+  double b[8];
+  double h[8];
+
+  for (int i = 0; i < 4; i++) {
+    double x = objectPoints[i][0];
+    double y = objectPoints[i][1];
+    double u = imagePoints[i].x;
+    double v = imagePoints[i].y;
+
+    double rowU[8] = {x, y, 1, 0, 0, 0, -u * x, -u * y};
+    double rowV[8] = {0, 0, 0, x, y, 1, -v * x, -v * y};
+
+    for (int k = 0; k < 8; k++) {
+      A[2 * i][k] = rowU[k];
+      A[2 * i + 1][k] = rowV[k];
+    }
+    b[2 * i] = u;
+    b[2 * i + 1] = v;
+  }
+
+  if (!solve8(A, b, h)) {
+    return false;
+  }
+
+  for (int k = 0; k < 8; k++) {
+    H[k] = h[k];
+  }
+  H[8] = 1.0;
+
+  return true;
+}
+
+// Rotation that maps the z axis onto the direction of (p, q, 1).
+void rotationFromZAxis(double p, double q, Mat33 R) {
+  double n = std::sqrt(p * p + q * q + 1.0);
+  double ax = p / n;
+  double ay = q / n;
+  double az = 1.0 / n;
+
+  // Rotation axis is z x a = (-ay, ax, 0), the sine of the angle is its length and the cosine is az.
+  double s2 = ax * ax + ay * ay;
+
+  R[0] = 1; R[1] = 0; R[2] = 0;
+  R[3] = 0; R[4] = 1; R[5] = 0;
+  R[6] = 0; R[7] = 0; R[8] = 1;
+
+  if (s2 < 1e-20) {
+    return;
+  }
+
+  // Rodrigues formula R = I + [k]x + [k]x^2 * (1 - c) / s^2 with k = (-ay, ax, 0).
+  double kx = -ay;
+  double ky = ax;
+  double f = (1.0 - az) / s2;
+
+  R[0] += -ky * ky * f;
+  R[1] += kx * ky * f;
+  R[2] += ky;
+  R[3] += kx * ky * f;
+  R[4] += -kx * kx * f;
+  R[5] += -kx;
+  R[6] += -ky;
+  R[7] += kx;
+  R[8] += -(kx * kx + ky * ky) * f;
+}
+
+// The two IPPE rotation solutions from the Jacobian J of the homography at the marker center,
+// and the normalized image position (p, q) of the marker center.
+bool ippeRotations(double j00, double j01, double j10, double j11, double p, double q, Mat33 R1, Mat33 R2) {
+  Mat33 Rv;
+  rotationFromZAxis(p, q, Rv);
+
+  double b00 = Rv[0] - p * Rv[6];
+  double b01 = Rv[1] - p * Rv[7];
+  double b10 = Rv[3] - q * Rv[6];
+  double b11 = Rv[4] - q * Rv[7];
+
+  double det = b00 * b11 - b01 * b10;
+  if (std::fabs(det) < 1e-15) {
+    return false;
+  }
+
+  double dtinv = 1.0 / det;
+  double binv00 = dtinv * b11;
+  double binv01 = -dtinv * b01;
+  double binv10 = -dtinv * b10;
+  double binv11 = dtinv * b00;
+
+  double a00 = binv00 * j00 + binv01 * j10;
+  double a01 = binv00 * j01 + binv01 * j11;
+  double a10 = binv10 * j00 + binv11 * j10;
+  double a11 = binv10 * j01 + binv11 * j11;
+
+  // Largest singular value of A.
+  double ata00 = a00 * a00 + a10 * a10;
+  double ata01 = a00 * a01 + a10 * a11;
+  double ata11 = a01 * a01 + a11 * a11;
+  double gamma2 = 0.5 * (ata00 + ata11 + std::sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01));
+  double gamma = std::sqrt(gamma2);
+
+  if (!(gamma > std::numeric_limits<float>::epsilon())) {
+    return false;
+  }
+
+  double r00 = a00 / gamma;
+  double r01 = a01 / gamma;
+  double r10 = a10 / gamma;
+  double r11 = a11 / gamma;
+
+  double c0 = std::sqrt(std::max(0.0, 1.0 - r00 * r00 - r10 * r10));
+  double c1 = std::sqrt(std::max(0.0, 1.0 - r01 * r01 - r11 * r11));
+  if (-r00 * r01 - r10 * r11 < 0) {
+    c1 = -c1;
+  }
+
+  // Both solutions only differ in the sign of the third row of the first two columns.
+  for (int s = 0; s < 2; s++) {
+    double* R = s == 0 ? R1 : R2;
+    double b0 = s == 0 ? c0 : -c0;
+    double b1 = s == 0 ? c1 : -c1;
+
+    double l0[3] = {r00, r10, b0};
+    double l1[3] = {r01, r11, b1};
+    double l2[3] = {r10 * b1 - b0 * r11, b0 * r01 - r00 * b1, r00 * r11 - r01 * r10};
+
+    for (int row = 0; row < 3; row++) {
+      R[3 * row + 0] = Rv[3 * row] * l0[0] + Rv[3 * row + 1] * l0[1] + Rv[3 * row + 2] * l0[2];
+      R[3 * row + 1] = Rv[3 * row] * l1[0] + Rv[3 * row + 1] * l1[1] + Rv[3 * row + 2] * l1[2];
+      R[3 * row + 2] = Rv[3 * row] * l2[0] + Rv[3 * row + 1] * l2[1] + Rv[3 * row + 2] * l2[2];
+    }
+  }
+
+  return true;
+}
+
+// Least squares translation for a known rotation.
+bool ippeTranslation(const double objectPoints[4][2], const cv::Point2f* imagePoints, const Mat33 R, double t[3]) {
+  // Each point gives the two equations tx - u*tz = u*pz - px and ty - v*tz = v*pz - py,
+  // where p is the rotated object point. Accumulate the normal equations.
+  double ata[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  double atb[3] = {0, 0, 0};
+
+  for (int i = 0; i < 4; i++) {
+    double x = objectPoints[i][0];
+    double y = objectPoints[i][1];
+    double u = imagePoints[i].x;
+    double v = imagePoints[i].y;
+
+    double px = R[0] * x + R[1] * y;
+    double py = R[3] * x + R[4] * y;
+    double pz = R[6] * x + R[7] * y;
+
+    double bu = u * pz - px;
+    double bv = v * pz - py;
+
+    ata[0][0] += 1;
+    ata[0][2] += -u;
+    ata[1][1] += 1;
+    ata[1][2] += -v;
+    ata[2][2] += u * u + v * v;
+
+    atb[0] += bu;
+    atb[1] += bv;
+    atb[2] += -u * bu - v * bv;
+  }
+
+  ata[2][0] = ata[0][2];
+  ata[2][1] = ata[1][2];
+
+  double det = ata[0][0] * (ata[1][1] * ata[2][2] - ata[1][2] * ata[2][1])
+             - ata[0][1] * (ata[1][0] * ata[2][2] - ata[1][2] * ata[2][0])
+             + ata[0][2] * (ata[1][0] * ata[2][1] - ata[1][1] * ata[2][0]);
+
+  if (std::fabs(det) < 1e-15) {
+    return false;
+  }
+
+  // Cramer's rule.
+  for (int k = 0; k < 3; k++) {
+    double m[3][3];
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 3; c++) {
+        m[r][c] = c == k ? atb[r] : ata[r][c];
+      }
+    }
+
+    t[k] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+          - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+          + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+  }
+
+  return true;
+}
+
+// RMS distance between the projected corners and the observed normalized corners.
+double reprojectionError(const double objectPoints[4][2], const cv::Point2f* imagePoints, const Mat33 R, const double t[3]) {
+  double sum = 0;
+
+  for (int i = 0; i < 4; i++) {
+    double x = objectPoints[i][0];
+    double y = objectPoints[i][1];
+
+    double px = R[0] * x + R[1] * y + t[0];
+    double py = R[3] * x + R[4] * y + t[1];
+    double pz = R[6] * x + R[7] * y + t[2];
+
+    if (pz <= 0) {
+      return std::numeric_limits<double>::infinity();
+    }
+
+    double du = px / pz - imagePoints[i].x;
+    double dv = py / pz - imagePoints[i].y;
+    sum += du * du + dv * dv;
+  }
+
+  return std::sqrt(sum / 4);
+}
+
+// Axis-angle vector of a rotation matrix, equivalent to cv::Rodrigues but without the allocations.
+cv::Vec3d rotationVector(const Mat33 R) {
+  double rx = R[7] - R[5];
+  double ry = R[2] - R[6];
+  double rz = R[3] - R[1];
+
+  double s = 0.5 * std::sqrt(rx * rx + ry * ry + rz * rz);
+  double c = std::clamp(0.5 * (R[0] + R[4] + R[8] - 1.0), -1.0, 1.0);
+
+  if (s < 1e-5) {
+    if (c > 0) {
+      // Close to the identity.
+      return cv::Vec3d(0.5 * rx, 0.5 * ry, 0.5 * rz);
+    }
+
+    // Close to a rotation by pi, where R = 2*a*a^T - I. Take the axis from the symmetric part,
+    // starting with its largest component for accuracy.
+    int i = 0;
+    if (R[4] > R[0]) {
+      i = 1;
+    }
+    if (R[8] > R[4 * i]) {
+      i = 2;
+    }
+
+    double a[3];
+    a[i] = std::sqrt(std::max(0.0, (R[4 * i] + 1.0) * 0.5));
+    for (int j = 0; j < 3; j++) {
+      if (j != i) {
+        a[j] = (R[3 * i + j] + R[3 * j + i]) / (4.0 * a[i]);
+      }
+    }
+
+    // Both a and -a describe the same rotation by pi. Pick the one that matches what is left of the antisymmetric part.
+    if (a[0] * rx + a[1] * ry + a[2] * rz < 0) {
+      a[0] = -a[0];
+      a[1] = -a[1];
+      a[2] = -a[2];
+    }
+
+    double theta = std::atan2(s, c);
+
+    return cv::Vec3d(a[0] * theta, a[1] * theta, a[2] * theta);
+  }
+
+  double theta = std::atan2(s, c);
+  double f = theta / (2.0 * s);
+
+  return cv::Vec3d(rx * f, ry * f, rz * f);
+}
+
+} // namespace
+
+SquarePoseSolver::SquarePoseSolver(double markerLength, const cv::Mat& cameraMatrix, const cv::Mat& distCoeffs) :
+  markerLength(markerLength), cameraMatrix(cameraMatrix.clone()), distCoeffs(distCoeffs.clone()) {
+  if (!this->cameraMatrix.empty()) {
+    // Errors are computed in normalized coordinates and reported in (approximate) pixels.
+    focalLength = 0.5 * (this->cameraMatrix.at<double>(0, 0) + this->cameraMatrix.at<double>(1, 1));
+  }
+}
+
+size_t SquarePoseSolver::solve(const std::vector<std::vector<cv::Point2f> >& corners, SquarePoseBatch& poses) {
+  size_t nMarkers = corners.size();
+  poses.resize(nMarkers);
+
+  if (nMarkers == 0) {
+    return 0;
+  }
+
+  // Undistort the corners of all markers in a single call.
+  imagePoints.resize(4 * nMarkers);
+  for (size_t i = 0; i < nMarkers; i++) {
+    for (int c = 0; c < 4; c++) {
+      imagePoints[4 * i + c] = corners[i][c];
+    }
+  }
+
+  {
+    IGNORE_ALLOCATIONS();
+    cv::undistortPoints(imagePoints, normalizedPoints, cameraMatrix, distCoeffs);
+  }
+
+  double h = markerLength / 2.0;
+  const double objectPoints[4][2] = {{-h, h}, {h, h}, {h, -h}, {-h, -h}};
+
+  size_t solved = 0;
+
+  for (size_t i = 0; i < nMarkers; i++) {
+    const cv::Point2f* points = &normalizedPoints[4 * i];
+
+    Mat33 H, R1, R2;
+    double t1[3], t2[3];
+
+    bool ok = squareHomography(objectPoints, points, H);
+    ok = ok && ippeRotations(H[0] - H[6] * H[2], H[1] - H[7] * H[2], H[3] - H[6] * H[5], H[4] - H[7] * H[5], H[2], H[5], R1, R2);
+    ok = ok && ippeTranslation(objectPoints, points, R1, t1) && ippeTranslation(objectPoints, points, R2, t2);
+
+    if (!ok) {
+      poses.rvecs[i] = poses.altRvecs[i] = cv::Vec3d(0, 0, 0);
+      poses.tvecs[i] = poses.altTvecs[i] = cv::Vec3d(0, 0, 0);
+      poses.reprojectionErrors[i] = poses.altReprojectionErrors[i] = std::numeric_limits<double>::infinity();
+      continue;
+    }
+
+    double e1 = reprojectionError(objectPoints, points, R1, t1) * focalLength;
+    double e2 = reprojectionError(objectPoints, points, R2, t2) * focalLength;
+
+    const double* bestR = e1 <= e2 ? R1 : R2;
+    const double* bestT = e1 <= e2 ? t1 : t2;
+    const double* altR = e1 <= e2 ? R2 : R1;
+    const double* altT = e1 <= e2 ? t2 : t1;
+
+    poses.rvecs[i] = rotationVector(bestR);
+    poses.tvecs[i] = cv::Vec3d(bestT[0], bestT[1], bestT[2]);
+    poses.reprojectionErrors[i] = std::min(e1, e2);
+
+    poses.altRvecs[i] = rotationVector(altR);
+    poses.altTvecs[i] = cv::Vec3d(altT[0], altT[1], altT[2]);
+    poses.altReprojectionErrors[i] = std::max(e1, e2);
+
+    solved++;
+  }
+
+  return solved;
+}
@@ -0,0 +1,173 @@
+#include <stage_timer.h>
+
+#include <bit>
+#include <format>
+
+// Buckets 0-3 hold 0-3 us directly, after that every power of two is split into 4 buckets.
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+const char* timedStageName(TimedStage stage) {
+  static const char* names[(size_t)TimedStage::COUNT] = {"capture", "detect", "pose", "draw", "display", "output"};
+
+  return names[(size_t)stage];
+}
+
+void LatencyHistogramSnapshot::merge(const LatencyHistogramSnapshot& other) {
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    buckets[i] += other.buckets[i];
+  }
+
+  count += other.count;
+  totalMicroseconds += other.totalMicroseconds;
+  maxMicroseconds = std::max(maxMicroseconds, other.maxMicroseconds);
+}
+
+uint64_t LatencyHistogramSnapshot::percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t)(p / 100.0 * count + 0.5));
+  uint64_t cumulative = 0;
+
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    cumulative += buckets[i];
+
+    if (cumulative >= rank) {
+      // The maximum is exact, so it is a tighter bound for the highest bucket.
+      return std::min(LatencyHistogram::bucketUpperBound(i), maxMicroseconds);
+    }
+  }
+
+  return maxMicroseconds;
+}
+
+int LatencyHistogram::bucketIndex(uint64_t microseconds) {
+  if (microseconds < SUB_BUCKETS) {
+    return microseconds;
+  }
+
+  int exponent = std::bit_width(microseconds) - 1;
+  int subBucket = (microseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+  int index = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+
+  return std::min(index, LATENCY_HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index) {
+  if (index < SUB_BUCKETS) {
+    return index + 1;
+  }
+
+  int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  uint64_t subBucket = index % SUB_BUCKETS;
+
+  return (SUB_BUCKETS + subBucket + 1) << (exponent - SUB_BUCKET_BITS);
+}
+
+LatencyHistogramSnapshot LatencyHistogram::snapshot() const {
+  LatencyHistogramSnapshot snapshot;
+
+  for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    snapshot.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+  }
+
+  snapshot.count = count.load(std::memory_order_relaxed);
+  snapshot.totalMicroseconds = totalMicroseconds.load(std::memory_order_relaxed);
+  snapshot.maxMicroseconds = maxMicroseconds.load(std::memory_order_relaxed);
+
+  return snapshot;
+}
+
+StageTimingRegistry& StageTimingRegistry::instance() {
+  static StageTimingRegistry registry;
+
+  return registry;
+}
+
+LatencyHistogram& StageTimingRegistry::local(TimedStage stage) {
+  thread_local StageHistograms* histograms = nullptr;
+
+  if (histograms == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(std::make_unique<StageHistograms>());
+    histograms = threads.back().get();
+  }
+
+  return (*histograms)[(size_t)stage];
+}
+
+std::array<LatencyHistogramSnapshot, (size_t)TimedStage::COUNT> StageTimingRegistry::snapshot() {
+  std::array<LatencyHistogramSnapshot, (size_t)TimedStage::COUNT> merged;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (const auto& histograms : threads) {
+    for (size_t s = 0; s < (size_t)TimedStage::COUNT; s++) {
+      merged[s].merge((*histograms)[s].snapshot());
+    }
+  }
+
+  return merged;
+}
+
+void StageTimingRegistry::printSummary(std::ostream& out) {
+  auto stages = snapshot();
+  bool first = true;
+
+  for (size_t s = 0; s < stages.size(); s++) {
+    if (stages[s].count == 0) {
+      continue;
+    }
+
+    out << (first ? "" : " | ")
+        << std::format("{} p50 {:.2f} ms p99 {:.2f} ms", timedStageName((TimedStage)s), stages[s].percentile(50) / 1000.0, stages[s].percentile(99) / 1000.0);
+    first = false;
+  }
+
+  out << std::endl;
+}
+
+void StageTimingRegistry::printPeriodicSummary(std::ostream& out, std::chrono::steady_clock::duration interval) {
+  auto now = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (now - lastSummary < interval) {
+      return;
+    }
+    lastSummary = now;
+  }
+
+  printSummary(out);
+}
+
+void StageTimingRegistry::dump(std::ostream& out) {
+  auto stages = snapshot();
+
+  out << std::format("{:<8}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n", "stage", "count", "mean ms", "p50 ms", "p95 ms", "p99 ms", "max ms");
+
+  for (size_t s = 0; s < stages.size(); s++) {
+    const LatencyHistogramSnapshot& stage = stages[s];
+
+    out << std::format("{:<8}{:>10}{:>10.3f}{:>10.3f}{:>10.3f}{:>10.3f}{:>10.3f}\n", timedStageName((TimedStage)s), stage.count,
+                       stage.mean() / 1000.0, stage.percentile(50) / 1000.0, stage.percentile(95) / 1000.0,
+                       stage.percentile(99) / 1000.0, stage.maxMicroseconds / 1000.0);
+  }
+
+  for (size_t s = 0; s < stages.size(); s++) {
+    if (stages[s].count == 0) {
+      continue;
+    }
+
+    out << timedStageName((TimedStage)s) << " histogram (upper bound in us: count):";
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+      if (stages[s].buckets[i] > 0) {
+        out << " " << LatencyHistogram::bucketUpperBound(i) << ":" << stages[s].buckets[i];
+      }
+    }
+    out << "\n";
+  }
+
+  out.flush();
+}
@@ -0,0 +1,336 @@
+#include <tiled_detector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace {
+
+uint64_t packRange(uint32_t begin, uint32_t end) {
+  return ((uint64_t)end << 32) | begin;
+}
+
+// Store corners at list[index], reusing the vector already there if there is one.
+void storeCorners(std::vector<std::vector<cv::Point2f> >& list, size_t index, const std::vector<cv::Point2f>& corners) {
+  if (index < list.size()) {
+    list[index].assign(corners.begin(), corners.end());
+  } else {
+    list.push_back(corners);
+  }
+}
+
+// Smallest distance of the corners to those edges of the tile that are not also edges of the image.
+// A marker cut off by a tile edge can still be detected if its border is, but then it is closer to that edge.
+double edgeDistance(const cv::Rect& tile, const cv::Size& imageSize, const std::vector<cv::Point2f>& corners) {
+  double distance = INFINITY;
+
+  for (const cv::Point2f& corner : corners) {
+    if (tile.x > 0) {
+      distance = std::min(distance, (double)corner.x - tile.x);
+    }
+    if (tile.y > 0) {
+      distance = std::min(distance, (double)corner.y - tile.y);
+    }
+    if (tile.x + tile.width < imageSize.width) {
+      distance = std::min(distance, (double)tile.x + tile.width - 1 - corner.x);
+    }
+    if (tile.y + tile.height < imageSize.height) {
+      distance = std::min(distance, (double)tile.y + tile.height - 1 - corner.y);
+    }
+  }
+
+  return distance;
+}
+
+cv::Point2f center(const std::vector<cv::Point2f>& corners) {
+  return (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+}
+
+double meanSideLength(const std::vector<cv::Point2f>& corners) {
+  double length = 0;
+  for (int c = 0; c < 4; c++) {
+    length += cv::norm(corners[c] - corners[(c + 1) % 4]);
+  }
+  return length / 4;
+}
+
+} // namespace
+
+void TiledDetector::Worker::detect(const cv::Mat& image, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                                   std::vector<std::vector<cv::Point2f> >& rejected) {
+  if (candidateDetector) {
+    candidateDetector->detectMarkers(image, corners, ids, rejected);
+  } else {
+    detector->detectMarkers(image, corners, ids, rejected);
+  }
+}
+
+TiledDetector::TiledDetector(const cv::aruco::Dictionary& dictionary, const cv::aruco::DetectorParameters& params, bool fastCandidates,
+                             double markerLength, double minDistance, double maxDistance, int threadCount) :
+  params(params), markerLength(markerLength), minDistance(minDistance), maxDistance(maxDistance) {
+  threadCount = std::max(1, threadCount);
+
+  for (int i = 0; i < threadCount; i++) {
+    auto worker = std::make_unique<Worker>();
+    if (fastCandidates) {
+      worker->candidateDetector = std::make_unique<CandidateDetector>(dictionary, params);
+    } else {
+      worker->detector = std::make_unique<cv::aruco::ArucoDetector>(dictionary, params);
+    }
+    workers.push_back(std::move(worker));
+  }
+
+  for (int i = 1; i < threadCount; i++) {
+    threads.emplace_back(&TiledDetector::threadLoop, this, i);
+  }
+}
+
+TiledDetector::~TiledDetector() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void TiledDetector::setDetectorParameters(const cv::aruco::DetectorParameters& params) {
+  this->params = params;
+  // The parameters of the tiles are derived from these, so the layout is computed again for the next frame.
+  tiledSize = cv::Size();
+}
+
+void TiledDetector::updateTiles(const cv::Size& imageSize, double focalLength) {
+  if (imageSize == tiledSize && focalLength == tiledFocalLength) {
+    return;
+  }
+
+  tiledSize = imageSize;
+  tiledFocalLength = focalLength;
+
+  // Side length in pixels of a marker facing the camera at the closest and farthest expected distance.
+  double largest = focalLength * markerLength / minDistance;
+  double smallest = focalLength * markerLength / maxDistance;
+
+  // The largest marker has to fit into the overlap at any rotation, together with the distance to the border the detector keeps.
+  int overlap = (int)std::ceil(largest * std::numbers::sqrt2) + 2 * params.minDistanceToBorder + 2;
+  int minTileLength = 2 * overlap;
+
+  // About two tiles per thread, so a thread that got tiles with many markers is helped by the others.
+  int targetTiles = 2 * workers.size();
+  int columns = std::max(1, (int)std::round(std::sqrt(targetTiles * (double)imageSize.width / imageSize.height)));
+  auto tileLength = [overlap](int length, int count) {
+    return (length + (count - 1) * overlap + count - 1) / count;
+  };
+
+  while (columns > 1 && tileLength(imageSize.width, columns) < minTileLength) {
+    columns--;
+  }
+
+  // Rows are only chosen once the columns are known, so fewer columns are made up for by more rows.
+  int rows = std::max(1, (int)std::ceil(targetTiles / (double)columns));
+  while (rows > 1 && tileLength(imageSize.height, rows) < minTileLength) {
+    rows--;
+  }
+
+  int tileWidth = std::min(imageSize.width, tileLength(imageSize.width, columns));
+  int tileHeight = std::min(imageSize.height, tileLength(imageSize.height, rows));
+
+  tiles.clear();
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < columns; c++) {
+      // The last row and column are aligned with the image border, so they may overlap a bit more.
+      int x = std::min(c * (tileWidth - overlap), imageSize.width - tileWidth);
+      int y = std::min(r * (tileHeight - overlap), imageSize.height - tileHeight);
+      tiles.emplace_back(x, y, tileWidth, tileHeight);
+    }
+  }
+
+  if (results.size() < tiles.size()) {
+    results.resize(tiles.size());
+  }
+
+  cv::aruco::DetectorParameters tileParams = params;
+
+  if (tiles.size() > 1) {
+    // Perimeter limits are relative to the size of the searched image, so they are converted to keep the same size in pixels
+    // as for the whole frame. They are narrowed down to the expected marker sizes, allowing for markers seen at an angle.
+    int frameSide = std::max(imageSize.width, imageSize.height);
+    int tileSide = std::max(tileWidth, tileHeight);
+    double minPerimeter = std::max(2 * smallest, params.minMarkerPerimeterRate * frameSide);
+    double maxPerimeter = std::max(minPerimeter, std::min(6 * largest, params.maxMarkerPerimeterRate * frameSide));
+
+    tileParams.minMarkerPerimeterRate = minPerimeter / tileSide;
+    tileParams.maxMarkerPerimeterRate = maxPerimeter / tileSide;
+  }
+
+  for (auto& worker : workers) {
+    if (worker->candidateDetector) {
+      worker->candidateDetector->setDetectorParameters(tileParams);
+    } else {
+      worker->detector->setDetectorParameters(tileParams);
+    }
+  }
+}
+
+void TiledDetector::detectMarkers(const cv::Mat& image, double focalLength, std::vector<std::vector<cv::Point2f> >& corners,
+                                  std::vector<int>& ids, std::vector<std::vector<cv::Point2f> >& rejected) {
+  updateTiles(image.size(), focalLength);
+
+  if (tiles.size() == 1) {
+    workers[0]->detect(image, corners, ids, rejected);
+    return;
+  }
+
+  currentImage = &image;
+
+  // Every worker starts with a block of neighboring tiles.
+  size_t workerCount = workers.size();
+  for (size_t w = 0; w < workerCount; w++) {
+    workers[w]->tiles = packRange(tiles.size() * w / workerCount, tiles.size() * (w + 1) / workerCount);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingThreads = threads.size();
+    generation++;
+  }
+  workAvailable.notify_all();
+
+  runTiles(0);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this] { return pendingThreads == 0; });
+  }
+
+  currentImage = nullptr;
+  mergeResults(image.size(), corners, ids, rejected);
+}
+
+void TiledDetector::threadLoop(int workerIndex) {
+  uint64_t seenGeneration = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      workAvailable.wait(lock, [&] { return stopping || generation != seenGeneration; });
+      if (stopping) {
+        return;
+      }
+      seenGeneration = generation;
+    }
+
+    runTiles(workerIndex);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pendingThreads == 0) {
+        workDone.notify_one();
+      }
+    }
+  }
+}
+
+bool TiledDetector::takeTile(int workerIndex, int& tile) {
+  // Own tiles are taken from the front of the block.
+  std::atomic<uint64_t>& own = workers[workerIndex]->tiles;
+  uint64_t range = own.load();
+  while ((uint32_t)range < (uint32_t)(range >> 32)) {
+    if (own.compare_exchange_weak(range, packRange((uint32_t)range + 1, range >> 32))) {
+      tile = (uint32_t)range;
+      return true;
+    }
+  }
+
+  // Tiles of other workers are stolen from the back of their block, so both rarely compete for the same tile.
+  size_t workerCount = workers.size();
+  for (size_t i = 1; i < workerCount; i++) {
+    std::atomic<uint64_t>& other = workers[(workerIndex + i) % workerCount]->tiles;
+    range = other.load();
+    while ((uint32_t)range < (uint32_t)(range >> 32)) {
+      uint32_t end = (range >> 32) - 1;
+      if (other.compare_exchange_weak(range, packRange((uint32_t)range, end))) {
+        tile = end;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void TiledDetector::runTiles(int workerIndex) {
+  Worker& worker = *workers[workerIndex];
+  int tile;
+
+  while (takeTile(workerIndex, tile)) {
+    const cv::Rect& rect = tiles[tile];
+    TileResult& result = results[tile];
+
+    // Detecting in a view of the frame does not copy any pixels.
+    worker.detect((*currentImage)(rect), result.corners, result.ids, result.rejected);
+
+    cv::Point2f offset(rect.x, rect.y);
+    for (auto& markerCorners : result.corners) {
+      for (cv::Point2f& corner : markerCorners) {
+        corner += offset;
+      }
+    }
+    for (auto& candidate : result.rejected) {
+      for (cv::Point2f& corner : candidate) {
+        corner += offset;
+      }
+    }
+  }
+}
+
+void TiledDetector::mergeResults(const cv::Size& imageSize, std::vector<std::vector<cv::Point2f> >& corners, std::vector<int>& ids,
+                                 std::vector<std::vector<cv::Point2f> >& rejected) {
+  size_t markerCount = 0;
+  size_t rejectedCount = 0;
+  ids.clear();
+  edgeDistances.clear();
+
+  for (size_t t = 0; t < tiles.size(); t++) {
+    const TileResult& result = results[t];
+
+    for (size_t i = 0; i < result.ids.size(); i++) {
+      const std::vector<cv::Point2f>& markerCorners = result.corners[i];
+      double distance = edgeDistance(tiles[t], imageSize, markerCorners);
+      cv::Point2f markerCenter = center(markerCorners);
+      double sameMarkerDistance = 0.5 * meanSideLength(markerCorners);
+      bool duplicate = false;
+
+      // A marker in the overlap of several tiles is found in each of them. The detection farthest away from the edges of its tile
+      // is kept, because a marker cut off by a tile edge can still be found, but with its corners in the wrong place.
+      for (size_t m = 0; m < markerCount && !duplicate; m++) {
+        if (ids[m] != result.ids[i] || cv::norm(center(corners[m]) - markerCenter) > sameMarkerDistance) {
+          continue;
+        }
+
+        duplicate = true;
+        if (distance > edgeDistances[m]) {
+          corners[m].assign(markerCorners.begin(), markerCorners.end());
+          edgeDistances[m] = distance;
+        }
+      }
+
+      if (!duplicate) {
+        ids.push_back(result.ids[i]);
+        edgeDistances.push_back(distance);
+        storeCorners(corners, markerCount++, markerCorners);
+      }
+    }
+
+    for (const auto& candidate : result.rejected) {
+      storeCorners(rejected, rejectedCount++, candidate);
+    }
+  }
+
+  corners.resize(markerCount);
+  rejected.resize(rejectedCount);
+}